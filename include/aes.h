@@ -0,0 +1,62 @@
+#ifndef _AES
+#define _AES
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+
+// Expanded AES-128 key schedule for the native (AES-NI/VAES) PRG engine.
+// getDPFContext attaches one to the PRF cipher context so that tree
+// expansion does not go through OpenSSL's EVP dispatch for every node.
+struct AesKey {
+  uint128_t roundKeys[11];
+};
+
+// Native ECB kernels, from narrowest to widest. All of them produce the same
+// output; the wider ones keep more blocks in flight per instruction.
+enum AesImpl {
+  AES_IMPL_NONE = 0, // no native support, use OpenSSL EVP
+  AES_IMPL_AESNI,    // 128-bit AES-NI
+  AES_IMPL_VAES256,  // 256-bit VAES + AVX2
+  AES_IMPL_VAES512,  // 512-bit VAES + AVX-512F
+};
+
+typedef void (*AesEncryptFn)(const struct AesKey *aesKey, const uint128_t *in,
+                             uint128_t *out, size_t n);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns 1 if the CPU supports the AES-NI instructions.
+int aesniSupported();
+
+// Returns the widest kernel the CPU (and OS) supports. Setting the
+// environment variable DPF_AES_IMPL to a lower AesImpl value caps the choice,
+// which is useful for testing and benchmarking the narrower kernels.
+int aesDetectImpl();
+
+// Returns the encryption kernel for impl, or NULL for AES_IMPL_NONE and for
+// kernels that were not compiled in.
+AesEncryptFn aesEncryptKernel(int impl);
+
+// Expands a 16-byte AES-128 key into aesKey.
+void aesniExpandKey(const uint8_t *key, struct AesKey *aesKey);
+
+// Encrypt n blocks in ECB mode with the 128-, 256- and 512-bit kernels.
+// Output is bit-identical to EVP_aes_128_ecb() under the same key. in and out
+// may alias. Only call a kernel that aesDetectImpl() reported as supported.
+void aesniEncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                        uint128_t *out, size_t n);
+void vaes256EncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                          uint128_t *out, size_t n);
+void vaes512EncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                          uint128_t *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _CHACHA
+#define _CHACHA
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+
+// ChaCha with a 128-bit key ("expand 16-byte k"), the PRG primitive for
+// machines with weak or missing AES acceleration. getDPFContext attaches the
+// PRF key in this form next to the AES key schedule.
+struct ChachaKey {
+  uint32_t words[4];
+};
+
+typedef void (*ChachaBlocksFn)(const struct ChachaKey *key, int rounds,
+                               const uint128_t *in, uint128_t *out, size_t n);
+typedef void (*ChachaStreamFn)(const uint128_t *keys, size_t n, int rounds,
+                               uint8_t *out, size_t len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns 1 if the CPU supports the 8-way AVX2 kernels.
+int chachaAvx2Supported();
+
+// Returns the widest block / stream kernels this CPU supports.
+ChachaBlocksFn chachaBlocksKernel();
+ChachaStreamFn chachaStreamKernel();
+
+// Loads a 16-byte key into key.
+void chachaExpandKey(const uint8_t *bytes, struct ChachaKey *key);
+
+// Fixed-key block function: out[i] is the first 16 bytes of the ChaCha block
+// whose counter and nonce words hold in[i]. in and out may alias.
+void chachaBlocks(const struct ChachaKey *key, int rounds,
+                  const uint128_t *in, uint128_t *out, size_t n);
+void chachaBlocksAvx2(const struct ChachaKey *key, int rounds,
+                      const uint128_t *in, uint128_t *out, size_t n);
+
+// Seed-keyed expander: writes len bytes of the keystream (counter 0, zero
+// nonce) under each of the n keys to out + i * len.
+void chachaStream(const uint128_t *keys, size_t n, int rounds, uint8_t *out,
+                  size_t len);
+void chachaStreamAvx2(const uint128_t *keys, size_t n, int rounds,
+                      uint8_t *out, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,43 @@
 typedef __int128 int128_t;
 typedef unsigned __int128 uint128_t;
 
+// Number of seeds expanded per AES call by the batched PRGs
+#define PRG_BATCH 32
+
+// Leaf bytes converted per batch by the big-state full-domain evaluators, so
+// that the outputs are still in cache when their correction words are applied
+#define LEAF_BLOCK_BYTES 32768
+
+// Default memory budget for the 2^t subset-XOR tables of last correction
+// words built by the big-state full-domain evaluators (setLastCWTableBudget)
+#define LASTCW_TABLE_BYTES (1 << 20)
+// Largest point count t for which such a table is built
+#define LASTCW_TABLE_MAX_T 8
+
+// fullDomainDPF and fullDomainVDPF walk the top of the tree depth first and
+// expand subtrees of 2^DPF_BLOCK_LEVELS leaves breadth first, so their memory
+// use does not grow with the domain; higher-arity trees (karyFullDomain) use
+// blocks of as many whole levels as fit in that many leaves
+#define DPF_BLOCK_LEVELS 10
+
+// fullDomainDPFMulti expands the blocks of up to this many keys together
+#define DPF_LOCKSTEP_KEYS 16
+
+// Default log2 of the leaves per subtree that the big-state full-domain
+// evaluators expand breadth first (setBigStateBlockLevels); above them the
+// tree is walked depth first
+#define BIGSTATE_BLOCK_LEVELS 12
+
+// Parallel full-domain evaluation of VDPF/VDMPF keys chains the proofs of
+// the leaves on the calling thread; the workers hand over about this many
+// bytes of step-1 hashes per round
+#define PARALLEL_PROOF_BYTES (1 << 26)
+
+// getRandomBlock: blocks buffered per refill (4 KB) and blocks drawn under one
+// DRBG key before it is redrawn from RAND_bytes
+#define RAND_BUFFER_BLOCKS 256
+#define RAND_RESEED_BLOCKS (1ULL << 24)
+
 static inline uint128_t reverse_lsb(uint128_t input) { return input ^ 1; }
 
 static inline uint128_t lsb(uint128_t input) { return input & 1; }
@@ -14,12 +51,28 @@ static inline uint128_t lsb(uint128_t input) { return input & 1; }
 static inline uint8_t seed_lsb(uint128_t input) { return (input & 2) >> 1; }
 
 static inline uint128_t set_lsb_zero(uint128_t input) {
-  int lsb = (input & 1);
-  if (lsb == 1) {
-    return reverse_lsb(input);
-  } else {
-    return input;
-  }
+  return input & ~(uint128_t)1;
+}
+
+// Branch-free helpers for steps that depend on a pseudorandom control bit
+// (or an index bit): mask arithmetic keeps the tree walks free of
+// mispredicted branches and constant-time. bit must be 0 or 1.
+static inline uint128_t bitMask(int bit) { return -(uint128_t)bit; }
+
+// Returns a if bit is 0 and b if bit is 1
+static inline uint128_t selectBlock(int bit, uint128_t a, uint128_t b) {
+  return a ^ ((a ^ b) & bitMask(bit));
+}
+
+static inline int selectBit(int bit, int a, int b) {
+  return a ^ ((a ^ b) & -bit);
+}
+
+// XORs len bytes of cw into out if bit is 1
+static inline void xorIfSet(uint8_t *out, const uint8_t *cw, int len, int bit) {
+  uint8_t mask = -bit;
+  for (int i = 0; i < len; i++)
+    out[i] ^= cw[i] & mask;
 }
 
 static inline int getbit(uint128_t x, int size, int b) {
@@ -27,9 +80,7 @@ static inline int getbit(uint128_t x, int size, int b) {
 }
 
 static inline uint128_t correct(uint128_t raw0, uint128_t raw1, int t) {
-  if (t == 0)
-    return raw0;
-  return raw0 ^ raw1;
+  return raw0 ^ (raw1 & bitMask(t));
 }
 
 static inline uint128_t convert(uint128_t *raw) {
@@ -37,6 +88,42 @@ static inline uint128_t convert(uint128_t *raw) {
   return r;
 }
 
+// Number of tree levels cut off in packed-leaf mode (KEY_FLAG_PACKED_LEAVES):
+// each leaf then converts to one block with the dataSize-byte outputs of
+// 2^bits adjacent points, as long as that fits in 16 bytes
+static inline int packedLeafBits(int size, int dataSize) {
+  int bits = 0;
+  while (bits < size && (dataSize << (bits + 1)) <= 16)
+    bits++;
+  return bits;
+}
+
+// Higher-arity trees consume arityBits index bits per level; the top level
+// takes whatever is left so that any domain size works
+static inline int karyLevels(int size, int arityBits) {
+  return (size + arityBits - 1) / arityBits;
+}
+
+static inline int karyLevelBits(int size, int arityBits, int level) {
+  if (level == 0)
+    return size - arityBits * (karyLevels(size, arityBits) - 1);
+  return arityBits;
+}
+
+// Returns log2(arity) for the supported arities 2, 4 and 8, or 0
+static inline int karyArityBits(int arity) {
+  switch (arity) {
+  case 2:
+    return 1;
+  case 4:
+    return 2;
+  case 8:
+    return 3;
+  default:
+    return 0;
+  }
+}
+
 static void printBytes(void *p, int num) {
   unsigned char *c = (unsigned char *)p;
   for (int i = 0; i < num; i++) {
@@ -45,6 +132,61 @@ static void printBytes(void *p, int num) {
   printf("\n");
 }
 
+// Depth-first walk over the nodes at one depth of a DPF tree whose seeds
+// carry their control bit in the lsb (dpfPRGBatchPacked). path[d] is the
+// current node on level d, right[d] its right sibling; only these
+// O(depth) seeds are kept.
+struct DPFWalk {
+  int depth;
+  uint128_t path[65];
+  uint128_t right[65];
+};
+
+// Runs task(arg, i) for every i in [0, n), possibly concurrently, and
+// returns once all of them are done. setThreadPool hands the full-domain
+// evaluators' workers to an external pool through such a function.
+typedef void (*DPFThreadPoolFn)(void *pool, int n,
+                                void (*task)(void *arg, int i), void *arg);
+
+// Cuts the output of a streaming full-domain evaluation into the chunks its
+// visitor asked for. Evaluators push the shares of each block as they are
+// done; whole chunks are passed on in place and only the rest is buffered.
+struct DPFChunkStream {
+  void (*visit)(uint64_t firstIndex, uint64_t count, const uint8_t *shares,
+                void *user); // DPFChunkFn
+  void *user;
+  int dataSize;
+  uint64_t chunk; // points per visit
+  uint64_t next;  // first point not yet visited
+  uint64_t end;   // points from here on are dropped
+  uint64_t fill;  // points waiting in buf
+  uint8_t *buf;
+};
+
+// Output of a range evaluation: the shares of points [lo, hi), which the
+// evaluators cut out of the streamed blocks with copyRangeChunk
+struct DPFRangeOut {
+  uint8_t *out;
+  uint64_t lo, hi;
+  int dataSize;
+};
+
+// A higher-arity tree (genKaryDPF/genKaryDMPF key) as karyFullDomain sees
+// it: every node has a seed and t control bits, and levelCW gives the
+// (sCW, tCW) pair that the nonzero control bits of a parent on level `level`
+// select for each of its children. lastCWs holds t rows of dataSize bytes,
+// row i being applied to the leaves with bit t - 1 - i set.
+struct KaryTree {
+  int size, arityBits, t;
+  uint128_t root;
+  int rootBits;
+  uint8_t flags;
+  const uint8_t *lastCWs;
+  const unsigned char *levelCWs[64]; // CWs of each level, in key order
+  void (*levelCW)(const struct KaryTree *tree, int level, int bits,
+                  uint128_t *sCW, int *tCW);
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,8 +194,70 @@ extern "C" {
 EVP_CIPHER_CTX *getDPFContext(uint8_t *key);
 void destroyContext(EVP_CIPHER_CTX *ctx);
 uint128_t getRandomBlock();
+void reseedRandom();
+void prgEncryptBlocks(EVP_CIPHER_CTX *ctx, const uint128_t *in, uint128_t *out,
+                      int n);
+void setKeyFlags(EVP_CIPHER_CTX *ctx, uint8_t flags);
+uint8_t getKeyFlags(EVP_CIPHER_CTX *ctx);
+void setPRGBackend(EVP_CIPHER_CTX *ctx, int backend);
+void setLastCWTableBudget(EVP_CIPHER_CTX *ctx, size_t bytes);
+size_t getLastCWTableBudget(EVP_CIPHER_CTX *ctx);
+void setBigStateBlockLevels(EVP_CIPHER_CTX *ctx, int levels);
+int getBigStateBlockLevels(EVP_CIPHER_CTX *ctx);
+void setFullDomainThreads(EVP_CIPHER_CTX *ctx, int threads);
+int getFullDomainThreads(EVP_CIPHER_CTX *ctx);
+void setThreadPool(EVP_CIPHER_CTX *ctx, DPFThreadPoolFn run, void *pool);
+EVP_CIPHER_CTX *cloneDPFContext(EVP_CIPHER_CTX *ctx);
+void runParallel(EVP_CIPHER_CTX *ctx, void (*task)(void *arg, int i),
+                 void *arg);
+void ccrHashBatch(EVP_CIPHER_CTX *ctx, const uint128_t *in, uint128_t *out,
+                  uint64_t n);
+void leafConvert(EVP_CIPHER_CTX *ctx, uint8_t flags, const uint128_t *seeds,
+                 uint64_t n, int dataSize, uint8_t *out);
+void xorRows(uint8_t *out, const uint8_t *const *rows, int n, size_t len);
+int checkKeyPRG(EVP_CIPHER_CTX *ctx, uint8_t flags);
+int checkVerifiableKey(EVP_CIPHER_CTX *ctx, uint8_t flags, uint8_t *out,
+                       uint64_t outBytes, uint8_t *proof);
+int chunkStreamInit(struct DPFChunkStream *stream, int dataSize,
+                    uint64_t chunkSize,
+                    void (*visit)(uint64_t, uint64_t, const uint8_t *, void *),
+                    void *user);
+void chunkStreamPush(struct DPFChunkStream *stream, const uint8_t *shares,
+                     uint64_t count);
+void chunkStreamFinish(struct DPFChunkStream *stream);
+void copyRangeChunk(uint64_t firstIndex, uint64_t count, const uint8_t *shares,
+                    void *user);
 void dpfPRG(EVP_CIPHER_CTX *ctx, uint128_t input, uint128_t *output1,
             uint128_t *output2, int *bit1, int *bit2);
+void dpfPRGBatch(EVP_CIPHER_CTX *ctx, const uint128_t *seeds, uint64_t n,
+                 uint128_t *outL, uint128_t *outR, int *bitsL, int *bitsR);
+void dpfPRGBatchPacked(EVP_CIPHER_CTX *ctx, const uint128_t *seeds, uint64_t n,
+                       uint128_t *outL, uint128_t *outR);
+void dpfWalkStart(EVP_CIPHER_CTX *ctx, struct DPFWalk *walk, uint128_t root,
+                  const uint128_t *cwL, const uint128_t *cwR, int depth,
+                  uint64_t first);
+void dpfWalkNext(EVP_CIPHER_CTX *ctx, struct DPFWalk *walk,
+                 const uint128_t *cwL, const uint128_t *cwR, uint64_t next);
+uint128_t *dpfExpandSubtree(EVP_CIPHER_CTX *ctx, uint128_t root,
+                            const uint128_t *cwL, const uint128_t *cwR,
+                            int levels, uint128_t *buf0, uint128_t *buf1);
+uint128_t *dpfExpandSubtrees(EVP_CIPHER_CTX *ctx, int n,
+                             const uint128_t *roots,
+                             const uint128_t *const *cwL,
+                             const uint128_t *const *cwR, int levels,
+                             uint128_t *buf0, uint128_t *buf1, uint128_t *sL,
+                             uint128_t *sR);
+void karyPRG(EVP_CIPHER_CTX *ctx, int levelBits, int t, uint128_t seed,
+             int child, uint128_t *output, int *bits);
+void karyPRGBatch(EVP_CIPHER_CTX *ctx, int levelBits, int t,
+                  const uint128_t *seeds, uint64_t n, uint128_t *children,
+                  int *bits);
+void karyFullDomain(EVP_CIPHER_CTX *ctx, const struct KaryTree *tree,
+                    int dataSize, uint8_t *out, struct DPFChunkStream *stream,
+                    uint64_t lo, uint64_t hi);
+void dmpfPRGBatch(EVP_CIPHER_CTX *ctx, int t, const uint128_t *seeds,
+                  uint64_t n, uint128_t *outL, uint128_t *outR, int *bitsL,
+                  int *bitsR);
 
 // Comparison function for uint64_t values (for qsort)
 int compareUint64(const void *a, const void *b);
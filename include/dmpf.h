@@ -42,6 +42,64 @@ void evalDMPF(EVP_CIPHER_CTX *ctx, uint64_t index, int dataSize,
 void fullDomainDMPF(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
                     uint8_t *out);
 
+// Evaluate Big State DMPF on the points [lo, hi) only: the walk visits just
+// the subtrees that intersect the range, so a shard owning a slice of the
+// domain does about that share of the full-domain work
+// Parameters:
+//   lo: first point
+//   hi: end of the range, at most 2^size
+//   out: output array of (hi - lo) * dataSize bytes (must be pre-allocated)
+//   other parameters as for fullDomainDMPF
+void evalRangeDMPF(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize, uint64_t lo,
+                   uint64_t hi, uint8_t *out);
+
+// Visitor of a streaming full-domain evaluation (as in dpf.h)
+typedef void (*DPFChunkFn)(uint64_t firstIndex, uint64_t count,
+                           const uint8_t *shares, void *user);
+
+// Streaming full domain evaluation for Big State DMPF: instead of filling an
+// output array, hands the shares to visit in order, chunkSize points at a
+// time (the last chunk may be shorter), from a buffer of about one block
+// (setBigStateBlockLevels) that is reused, so they are consumed while still
+// in cache. Runs on the calling thread.
+// Parameters:
+//   chunkSize: points per call of visit
+//   visit: called with (firstIndex, count, shares, user)
+//   user: passed to visit
+//   other parameters as for fullDomainDMPF
+void fullDomainDMPFStream(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
+                          uint64_t chunkSize, DPFChunkFn visit, void *user);
+
+// Full domain evaluation of the first domainSize points only, for tables
+// whose size is not a power of two: subtrees lying past domainSize are not
+// expanded, so N just above 2^(size - 1) costs about half of 2^size
+// Parameters:
+//   domainSize: number of points, at most 2^size
+//   out: output array of domainSize * dataSize bytes (must be pre-allocated)
+//   other parameters as for fullDomainDMPF / fullDomainDMPFStream
+void truncatedDomainDMPF(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
+                         uint64_t domainSize, uint8_t *out);
+void truncatedDomainDMPFStream(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
+                               uint64_t domainSize, uint64_t chunkSize,
+                               DPFChunkFn visit, void *user);
+
+// Generate Big State DMPF keys on a tree of arity 4 or 8 (2 gives regular
+// genDMPF keys). Every level consumes log2(arity) index bits and carries a
+// correction word per child of each of the t tracked nodes. evalDMPF and
+// fullDomainDMPF accept these keys; the verifiable and compressed variants
+// only support binary keys.
+// Parameters:
+//   arity: tree arity (2, 4 or 8)
+//   k0, k1: output keys of karyDMPFKeySize bytes (must be pre-allocated)
+//   other parameters as for genDMPF
+void genKaryDMPF(EVP_CIPHER_CTX *ctx, int arity, int t, int size,
+                 uint64_t *index, int dataSize, uint8_t *data, uint8_t *k0,
+                 uint8_t *k1);
+
+// Size in bytes of each key made by genKaryDMPF, or -1 for an unsupported
+// arity
+int karyDMPFKeySize(int arity, int t, int size, int dataSize);
+
 // Compress Big State DMPF keys
 // Parameters:
 //   ctx: EVP_CIPHER_CTX pointer for encryption context
@@ -63,6 +121,25 @@ void compressDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
 void decompressDMPF(EVP_CIPHER_CTX *ctx, uint8_t *key, int dataSize,
                     uint8_t *out);
 
+// Bounds the table of all 2^t subset XORs of the last correction words that
+// fullDomainDMPF and decompressDMPF precompute for keys with t <= 8 points,
+// so that every leaf is corrected with a single XOR. The default is
+// LASTCW_TABLE_BYTES; 0 disables the table.
+void setLastCWTableBudget(EVP_CIPHER_CTX *ctx, size_t bytes);
+
+// Sets the height of the subtrees that fullDomainDMPF, fullDomainVDMPF and
+// decompressDMPF expand breadth first: a block of 2^levels leaves should fit
+// in L2 next to its parent layer. The levels above are walked depth first.
+// The default is BIGSTATE_BLOCK_LEVELS (12).
+void setBigStateBlockLevels(EVP_CIPHER_CTX *ctx, int levels);
+
+// Sets the number of threads that fullDomainDPF, fullDomainVDPF,
+// fullDomainDMPF, fullDomainVDMPF and decompressDMPF split a key's subtrees
+// across, each with a cipher context (and hash clones) of its own; the
+// outputs and proofs equal those of one thread. The default is 1.
+// setThreadPool (common.h) runs the workers on an external pool instead.
+void setFullDomainThreads(EVP_CIPHER_CTX *ctx, int threads);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
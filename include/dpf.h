@@ -31,15 +31,66 @@
 
 #define FIELDMASK ((1L << FIELDBITS) - 1)
 
+// Key mode flags. They share the byte that holds the root control bit
+// (k[17] for DPF/VDPF keys, k[18] for DMPF/VDMPF keys); keys generated
+// before a mode existed have its flag clear and keep the legacy behaviour.
+#define KEY_CONTROL_BIT 0x01
+// leaf seeds are converted with a fixed-key hash instead of seed-keyed CTR
+#define KEY_FLAG_FIXED_KEY_LEAF 0x02
+// the tree stops packedLeafBits(size, dataSize) levels early and every leaf
+// holds the outputs of that many adjacent points (payloads of <= 8 bytes)
+#define KEY_FLAG_PACKED_LEAVES 0x10
+// log2(arity) - 1 of the evaluation tree: 0 for the binary tree, 1 for 4-ary
+// and 2 for 8-ary keys (genKaryDPF/genKaryDMPF)
+#define KEY_ARITY_SHIFT 2
+#define KEY_ARITY_MASK 0x0c
+// PRG backend the tree and leaves were expanded with (setPRGBackend). AES
+// keys evaluate the same under EVP and the native AES-NI/VAES kernels.
+#define KEY_PRG_SHIFT 5
+#define KEY_PRG_MASK 0x60
+#define KEY_PRG_AES 0
+#define KEY_PRG_CHACHA8 1
+#define KEY_PRG_CHACHA12 2
+// set by genVDPF/genVDMPF in keys whose proofs use the MMO hash AES_k(x) ^ x.
+// Earlier keys were made with a keystream that ignored the hash input, so
+// their proofs do not bind the leaves; evaluators reject them
+// (checkVerifiableKey).
+#define KEY_FLAG_MMO_HASH 0x80
+
+// Higher-arity DPF keys keep the DPF header and replace the per-level CWs by
+// one (16-byte sCW, 1-byte tCW) pair per child
+#define KARY_CW_SIZE 17
+
+// Half-Tree DPF keys: k[0] = size, k[1..16] = root seed (its lsb is the
+// control bit), k[17] = key mode flags with the arity field set to
+// KEY_TYPE_HALF_TREE, then one 16-byte correction word per level and the
+// dataSize-byte last CW. No regular key has an arity field of 3, so the two
+// key types cannot be mistaken for one another.
+#define KEY_TYPE_HALF_TREE KEY_ARITY_MASK
+#define IS_HALF_TREE_KEY(flags) (((flags) & KEY_ARITY_MASK) == KEY_TYPE_HALF_TREE)
+#define HALF_TREE_HEAD_SIZE 18
+#define HALF_TREE_KEY_SIZE(size, dataSize)                                     \
+  (HALF_TREE_HEAD_SIZE + 16 * (size) + (dataSize))
+
 struct Hash; // Forward declaration
 typedef struct Hash hash;
 
 typedef __int128 int128_t;
 typedef unsigned __int128 uint128_t;
 
+// Visitor of a streaming full-domain evaluation: receives the shares of the
+// count consecutive points from firstIndex on, dataSize bytes each, in order.
+// shares is only valid during the call.
+typedef void (*DPFChunkFn)(uint64_t firstIndex, uint64_t count,
+                           const uint8_t *shares, void *user);
+
 // PRG cipher context
 extern EVP_CIPHER_CTX *getDPFContext(uint8_t *);
 extern void destroyContext(EVP_CIPHER_CTX *);
+extern void setKeyFlags(EVP_CIPHER_CTX *, uint8_t flags);
+extern uint8_t getKeyFlags(EVP_CIPHER_CTX *);
+extern void setPRGBackend(EVP_CIPHER_CTX *, int backend);
+extern void setFullDomainThreads(EVP_CIPHER_CTX *, int threads);
 
 // DPF functions
 extern void genDPF(EVP_CIPHER_CTX *ctx, int size, uint64_t index, int dataSize,
@@ -50,6 +101,51 @@ extern void evalDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x,
                     int dataSize, uint8_t *dataShare);
 extern void fullDomainDPF(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
                           int dataSize, uint8_t *out);
+// Evaluates points [lo, hi) into out ((hi - lo) * dataSize bytes), walking
+// only the subtrees that cover them
+extern void evalRangeDPF(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                         int dataSize, uint64_t lo, uint64_t hi, uint8_t *out);
+// fullDomainDPF of numKeys keys over the same domain in lockstep, filling
+// outs[i] for keys[i]; binary keys made with the same flags and dataSize
+// share every PRG batch, others are evaluated one by one. DMPF keys have no
+// lockstep path; setFullDomainThreads spreads them over cores instead.
+extern void fullDomainDPFMulti(EVP_CIPHER_CTX *ctx, int size,
+                               unsigned char **keys, int numKeys, int dataSize,
+                               uint8_t **outs);
+// fullDomainDPF over the first domainSize points only (out holds
+// domainSize * dataSize bytes), for domains that are not a power of two;
+// subtrees past domainSize are pruned
+extern void truncatedDomainDPF(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                               int dataSize, uint64_t domainSize,
+                               uint8_t *out);
+extern void truncatedDomainDPFStream(EVP_CIPHER_CTX *ctx, int size,
+                                     unsigned char *k, int dataSize,
+                                     uint64_t domainSize, uint64_t chunkSize,
+                                     DPFChunkFn visit, void *user);
+// fullDomainDPF without the output buffer: the shares are handed to visit
+// in chunks of chunkSize points (the last one may be shorter)
+extern void fullDomainDPFStream(EVP_CIPHER_CTX *ctx, int size,
+                                unsigned char *k, int dataSize,
+                                uint64_t chunkSize, DPFChunkFn visit,
+                                void *user);
+
+// Higher-arity DPF functions; evalDPF and fullDomainDPF accept these keys
+extern void genKaryDPF(EVP_CIPHER_CTX *ctx, int arity, int size,
+                       uint64_t index, int dataSize, uint8_t *data,
+                       unsigned char *k0, unsigned char *k1);
+extern int karyDPFKeySize(int arity, int size, int dataSize);
+
+// Half-Tree DPF functions
+extern void genHalfTreeDPF(EVP_CIPHER_CTX *ctx, int size, uint64_t index,
+                           int dataSize, uint8_t *data, unsigned char *k0,
+                           unsigned char *k1);
+extern void evalHalfTreeDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x,
+                            int dataSize, uint8_t *dataShare);
+extern void fullDomainHalfTreeDPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                  int dataSize, uint8_t *out);
+extern void fullDomainHalfTreeDPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                        int dataSize, uint64_t chunkSize,
+                                        DPFChunkFn visit, void *user);
 
 // VDPF functions
 // extern void genVDPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int size,
@@ -9,29 +9,53 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 
+#include "aes.h"
+
 typedef __int128 int128_t;
 typedef unsigned __int128 uint128_t;
 
+// Inputs hashed per kernel call by the batch variants
+#define MMO_BATCH 32
+
+// The hash is Matyas-Meyer-Oseas over AES-128 under a fixed key (the hash
+// seed): every block x maps to AES_k(x) ^ x. With a native kernel the blocks
+// are encrypted with aesKey; otherwise mmoCtx (AES-128-ECB) encrypts them.
+// The hash holds no state between calls.
 struct Hash {
   EVP_CIPHER_CTX *mmoCtx;
   int outblocks;
+  struct AesKey aesKey;
+  AesEncryptFn encrypt; // chosen in initMMOHash, NULL for EVP
 };
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // PRF cipher context
 extern struct Hash *initMMOHash(uint8_t *seed, uint64_t outblocks);
 extern void destroyMMOHash(struct Hash *hash);
 
-// MMO functions
-#ifdef __cplusplus
-extern "C" {
-#endif
+// Returns a copy of hash for use on another thread: an EVP context may not be
+// shared between threads
+struct Hash *cloneMMOHash(struct Hash *hash);
 
+// MMO functions
 void mmoHash2to4(struct Hash *hash, uint8_t *input, uint8_t *output);
+void mmoHash4to4(struct Hash *hash, uint8_t *input, uint8_t *output);
+
+// Hash n independent inputs in one call: inputs holds n * 2 blocks and outputs
+// n * 4 blocks. Equivalent to n mmoHash2to4 calls, with each of the two
+// rounds of a batch of MMO_BATCH inputs done in one kernel call.
+void mmoHash2to4Batch(struct Hash *hash, const uint8_t *inputs, uint64_t n,
+                      uint8_t *outputs);
+
+// As above for mmoHash4to4: inputs and outputs both hold n * 4 blocks.
+void mmoHash4to4Batch(struct Hash *hash, const uint8_t *inputs, uint64_t n,
+                      uint8_t *outputs);
 
 #ifdef __cplusplus
 }
 #endif
 
-extern void mmoHash4to4(struct Hash *hash, uint8_t *input, uint8_t *output);
-
 #endif
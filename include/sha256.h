@@ -37,6 +37,7 @@ extern "C"
 		size_t space_left;
 		size_t total_len;
 		uint32_t h[8];
+		int shani; /* use the SHA-NI compression function, set by sha_256_init */
 	};
 
 	/*
@@ -62,6 +63,9 @@ extern "C"
 	 * buffer available, and invoke this function. Once a SHA-256 hash has been calculated (see further below) a SHA-256
 	 * structure can be initialized again for the next calculation.
 	 *
+	 * @note The structure holds all state of the calculation, so concurrent calculations on distinct structures are
+	 * safe. sha_256_init selects the x86 SHA extensions when the CPU has them, unless DPF_SHA_IMPL=0 is set.
+	 *
 	 * @note If either of the passed pointers is NULL, the results are unpredictable.
 	 */
 	void sha_256_init(struct Sha_256 *sha_256, uint8_t hash[SIZE_OF_SHA_256_HASH]);
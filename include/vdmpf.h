@@ -10,6 +10,8 @@
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#include "dmpf.h"
+
 typedef __int128 int128_t;
 typedef unsigned __int128 uint128_t;
 
@@ -29,6 +31,13 @@ void fullDomainVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
                      struct Hash *mmo_hash2, int dataSize, uint8_t *k,
                      uint8_t *out, uint8_t *proof);
 
+// fullDomainVDMPF delivering the shares to visit like fullDomainDMPFStream;
+// the proof is only complete once the last chunk has been visited
+void fullDomainVDMPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                           struct Hash *mmo_hash2, int dataSize, uint8_t *k,
+                           uint64_t chunkSize, DPFChunkFn visit, void *user,
+                           uint8_t *proof);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,8 @@
 #include <openssl/err.h>
 #include <openssl/rand.h>
 
+#include "dpf.h"
+
 typedef struct Hash hash;
 typedef __int128 int128_t;
 typedef unsigned __int128 uint128_t;
@@ -23,6 +25,12 @@ extern void batchEvalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1, struct Ha
                         int dataSize, unsigned char *k, uint64_t *in, uint64_t inl, uint8_t *out, uint8_t *pi);
 extern void fullDomainVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1, struct Hash *mmo_hash2,
                           int dataSize, unsigned char *k, uint8_t *out, uint8_t *proof);
+// fullDomainVDPF delivering the shares to visit like fullDomainDPFStream;
+// the proof is only complete once the last chunk has been visited
+extern void fullDomainVDPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                                 struct Hash *mmo_hash2, int dataSize,
+                                 unsigned char *k, uint64_t chunkSize,
+                                 DPFChunkFn visit, void *user, uint8_t *proof);
 extern void evalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
                      struct Hash *mmo_hash2, int dataSize, uint8_t*k,
                      uint64_t index, uint8_t *out, uint8_t *proof);
@@ -0,0 +1,201 @@
+// Native AES-128 for the fixed-key PRG, using the AES-NI and VAES
+// instructions. The kernels are compiled with target attributes rather than
+// global -maes/-mvaes so that libdpf.a still runs on machines without them;
+// callers pick one with aesDetectImpl() before using it.
+
+#include "../include/aes.h"
+
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Number of registers kept in flight so that the AES units stay busy
+#define AES_PIPELINE 8
+#define VAES_PIPELINE 4
+
+int aesniSupported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+}
+
+int aesDetectImpl() {
+  int impl = AES_IMPL_NONE;
+  if (aesniSupported()) {
+    impl = AES_IMPL_AESNI;
+    if (__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2"))
+      impl = AES_IMPL_VAES256;
+    if (__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f"))
+      impl = AES_IMPL_VAES512;
+  }
+
+  const char *cap = getenv("DPF_AES_IMPL");
+  if (cap && *cap) {
+    int max = atoi(cap);
+    if (max >= AES_IMPL_NONE && max < impl)
+      impl = max;
+  }
+  return impl;
+}
+
+AesEncryptFn aesEncryptKernel(int impl) {
+  switch (impl) {
+  case AES_IMPL_AESNI:
+    return aesniEncryptBlocks;
+  case AES_IMPL_VAES256:
+    return vaes256EncryptBlocks;
+  case AES_IMPL_VAES512:
+    return vaes512EncryptBlocks;
+  default:
+    return NULL;
+  }
+}
+
+__attribute__((target("aes,sse2"))) static inline __m128i
+expandStep(__m128i key, __m128i keygened) {
+  keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3, 3, 3, 3));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, keygened);
+}
+
+#define EXPAND_ROUND(rk, i, rcon)                                              \
+  rk[i] = expandStep(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+__attribute__((target("aes,sse2"))) void
+aesniExpandKey(const uint8_t *key, struct AesKey *aesKey) {
+  __m128i rk[11];
+  rk[0] = _mm_loadu_si128((const __m128i *)key);
+  EXPAND_ROUND(rk, 1, 0x01);
+  EXPAND_ROUND(rk, 2, 0x02);
+  EXPAND_ROUND(rk, 3, 0x04);
+  EXPAND_ROUND(rk, 4, 0x08);
+  EXPAND_ROUND(rk, 5, 0x10);
+  EXPAND_ROUND(rk, 6, 0x20);
+  EXPAND_ROUND(rk, 7, 0x40);
+  EXPAND_ROUND(rk, 8, 0x80);
+  EXPAND_ROUND(rk, 9, 0x1b);
+  EXPAND_ROUND(rk, 10, 0x36);
+  for (int i = 0; i < 11; i++)
+    _mm_storeu_si128((__m128i *)&aesKey->roundKeys[i], rk[i]);
+}
+
+__attribute__((target("aes,sse2"))) void
+aesniEncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                   uint128_t *out, size_t n) {
+  __m128i rk[11];
+  for (int i = 0; i < 11; i++)
+    rk[i] = _mm_loadu_si128((const __m128i *)&aesKey->roundKeys[i]);
+
+  size_t i = 0;
+  for (; i + AES_PIPELINE <= n; i += AES_PIPELINE) {
+    __m128i b[AES_PIPELINE];
+    for (int j = 0; j < AES_PIPELINE; j++)
+      b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i + j]), rk[0]);
+    for (int r = 1; r < 10; r++)
+      for (int j = 0; j < AES_PIPELINE; j++)
+        b[j] = _mm_aesenc_si128(b[j], rk[r]);
+    for (int j = 0; j < AES_PIPELINE; j++)
+      _mm_storeu_si128((__m128i *)&out[i + j],
+                       _mm_aesenclast_si128(b[j], rk[10]));
+  }
+
+  for (; i < n; i++) {
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i]), rk[0]);
+    for (int r = 1; r < 10; r++)
+      b = _mm_aesenc_si128(b, rk[r]);
+    _mm_storeu_si128((__m128i *)&out[i], _mm_aesenclast_si128(b, rk[10]));
+  }
+}
+
+// 256-bit kernel: each ymm register holds two blocks, so a full pipeline
+// covers 8 blocks. The tail goes through the 128-bit kernel.
+__attribute__((target("vaes,avx2,aes"))) void
+vaes256EncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                     uint128_t *out, size_t n) {
+  __m256i rk[11];
+  for (int i = 0; i < 11; i++)
+    rk[i] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)&aesKey->roundKeys[i]));
+
+  size_t i = 0;
+  for (; i + 2 * VAES_PIPELINE <= n; i += 2 * VAES_PIPELINE) {
+    __m256i b[VAES_PIPELINE];
+    for (int j = 0; j < VAES_PIPELINE; j++)
+      b[j] = _mm256_xor_si256(
+          _mm256_loadu_si256((const __m256i *)&in[i + 2 * j]), rk[0]);
+    for (int r = 1; r < 10; r++)
+      for (int j = 0; j < VAES_PIPELINE; j++)
+        b[j] = _mm256_aesenc_epi128(b[j], rk[r]);
+    for (int j = 0; j < VAES_PIPELINE; j++)
+      _mm256_storeu_si256((__m256i *)&out[i + 2 * j],
+                          _mm256_aesenclast_epi128(b[j], rk[10]));
+  }
+
+  if (i < n)
+    aesniEncryptBlocks(aesKey, in + i, out + i, n - i);
+}
+
+// 512-bit kernel: four blocks per zmm register, 16 blocks per pipeline.
+__attribute__((target("vaes,avx512f,aes"))) void
+vaes512EncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                     uint128_t *out, size_t n) {
+  __m512i rk[11];
+  for (int i = 0; i < 11; i++)
+    rk[i] = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)&aesKey->roundKeys[i]));
+
+  size_t i = 0;
+  for (; i + 4 * VAES_PIPELINE <= n; i += 4 * VAES_PIPELINE) {
+    __m512i b[VAES_PIPELINE];
+    for (int j = 0; j < VAES_PIPELINE; j++)
+      b[j] = _mm512_xor_si512(_mm512_loadu_si512(&in[i + 4 * j]), rk[0]);
+    for (int r = 1; r < 10; r++)
+      for (int j = 0; j < VAES_PIPELINE; j++)
+        b[j] = _mm512_aesenc_epi128(b[j], rk[r]);
+    for (int j = 0; j < VAES_PIPELINE; j++)
+      _mm512_storeu_si512(&out[i + 4 * j],
+                          _mm512_aesenclast_epi128(b[j], rk[10]));
+  }
+
+  if (i < n)
+    aesniEncryptBlocks(aesKey, in + i, out + i, n - i);
+}
+
+#else
+
+int aesniSupported() { return 0; }
+
+int aesDetectImpl() { return AES_IMPL_NONE; }
+
+AesEncryptFn aesEncryptKernel(int impl) {
+  (void)impl;
+  return NULL;
+}
+
+void aesniExpandKey(const uint8_t *key, struct AesKey *aesKey) {
+  (void)key;
+  (void)aesKey;
+}
+
+void aesniEncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                        uint128_t *out, size_t n) {
+  (void)aesKey;
+  (void)in;
+  (void)out;
+  (void)n;
+}
+
+void vaes256EncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                          uint128_t *out, size_t n) {
+  aesniEncryptBlocks(aesKey, in, out, n);
+}
+
+void vaes512EncryptBlocks(const struct AesKey *aesKey, const uint128_t *in,
+                          uint128_t *out, size_t n) {
+  aesniEncryptBlocks(aesKey, in, out, n);
+}
+
+#endif
@@ -1,5 +1,6 @@
 // g++ -Wall -Wextra -O2 -std=c++17 -Iinclude src/big_state.cc obj/dpf.o
 // obj/common.o obj/mmo.o -o big_state -lssl -lcrypto
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
@@ -11,6 +12,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "../include/common.h"
@@ -20,10 +23,15 @@
 
 using CW = std::tuple<uint128_t, int, int>;
 
-extern struct Sha_256 sha_256;
-
 const int HEAD_SIZE = 19;
 const int DMPF_CW_SIZE = 24;
+// higher-arity keys: one (16-byte sCW, 4-byte tCW) pair per child
+const int DMPF_KARY_CW_SIZE = 20;
+
+// Compressed keys have no control-bit byte; the leaf conversion mode is kept
+// in the top bits of the size byte instead
+const int COMPRESSED_SIZE_MASK = 0x3f;
+const int COMPRESSED_FLAG_SHIFT = 6;
 
 // Export these functions with C linkage so they can be called from C code
 extern "C" {
@@ -34,6 +42,12 @@ void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
 void evalBigStateDMPF(EVP_CIPHER_CTX *ctx, uint64_t index, int dataSize,
                       uint8_t *dataShare, uint8_t *k);
 
+void genKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, int arity, int t, int size,
+                         uint64_t *index, int dataSize, uint8_t *data,
+                         uint8_t *k0, uint8_t *k1);
+
+int karyBigStateDMPFKeySize(int arity, int t, int size, int dataSize);
+
 void fullDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k, int dataSize,
                             uint8_t *out);
 
@@ -41,6 +55,29 @@ void fullDomainBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
                              struct Hash *mmo_hash2, int dataSize, uint8_t *k,
                              uint8_t *out, uint8_t *proof);
 
+void fullDomainBigStateDMPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                  int dataSize, uint64_t chunkSize,
+                                  DPFChunkFn visit, void *user);
+
+void evalRangeBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                           int dataSize, uint64_t lo, uint64_t hi,
+                           uint8_t *out);
+
+void truncatedDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                 int dataSize, uint64_t domainSize,
+                                 uint8_t *out);
+
+void truncatedDomainBigStateDMPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                       int dataSize, uint64_t domainSize,
+                                       uint64_t chunkSize, DPFChunkFn visit,
+                                       void *user);
+
+void fullDomainBigStateVDMPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                                   struct Hash *mmo_hash2, int dataSize,
+                                   uint8_t *k, uint64_t chunkSize,
+                                   DPFChunkFn visit, void *user,
+                                   uint8_t *proof);
+
 void genBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int t, int size,
                      uint64_t *index, int dataSize, uint8_t *data, uint8_t *k0,
                      uint8_t *k1);
@@ -56,6 +93,16 @@ void BigStateDecompress(EVP_CIPHER_CTX *ctx, uint8_t *key, int dataSize,
                         uint8_t *out);
 }
 
+static void genBigStateDMPFWithFlags(EVP_CIPHER_CTX *ctx, uint8_t flags, int t,
+                                     int size, uint64_t *index, int dataSize,
+                                     uint8_t *data, uint8_t *k0, uint8_t *k1);
+static void evalKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, uint64_t index,
+                                 int dataSize, uint8_t *dataShare, uint8_t *k);
+static void fullDomainKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                       int dataSize, uint8_t *out,
+                                       DPFChunkStream *stream, uint64_t lo,
+                                       uint64_t hi);
+
 CW bigStateCorrect(const int &t, const int &index, const std::vector<CW> &CWs) {
   uint128_t sCW = 0;
   int tCW0 = 0, tCW1 = 0;
@@ -92,12 +139,8 @@ void dmpfPRG(EVP_CIPHER_CTX *ctx, int t, uint128_t input, uint128_t *output1,
   stashin[0] = input;
   stashin[1] = reverse_lsb(input);
 
-  int len = 0;
   uint128_t stash[2] = {0, 0};
-
-  if (1 != EVP_EncryptUpdate(ctx, (uint8_t *)&stash[0], &len,
-                             (uint8_t *)&stashin[0], 32))
-    printf("errors occured in encrypt\n");
+  prgEncryptBlocks(ctx, stashin, stash, 2);
 
   stash[0] = stash[0] ^ input;
   stash[1] = stash[1] ^ input;
@@ -114,6 +157,24 @@ void dmpfPRG(EVP_CIPHER_CTX *ctx, int t, uint128_t input, uint128_t *output1,
 
 void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
                      int dataSize, uint8_t *data, uint8_t *k0, uint8_t *k1) {
+  genBigStateDMPFWithFlags(ctx, getKeyFlags(ctx), t, size, index, dataSize,
+                           data, k0, k1);
+}
+
+// genBigStateDMPF with explicit key mode flags. In packed-leaf mode the tree
+// stops packBits levels early and the t leaves (fewer if indices share a
+// packed leaf) each carry the outputs of 2^packBits adjacent points.
+static void genBigStateDMPFWithFlags(EVP_CIPHER_CTX *ctx, uint8_t flags, int t,
+                                     int size, uint64_t *index, int dataSize,
+                                     uint8_t *data, uint8_t *k0, uint8_t *k1) {
+  int packBits = 0;
+  if (flags & KEY_FLAG_PACKED_LEAVES)
+    packBits = packedLeafBits(size, dataSize);
+  if (packBits == 0)
+    flags &= ~KEY_FLAG_PACKED_LEAVES;
+  int depth = size - packBits;
+  int leafSize = dataSize << packBits;
+
   // Initialize seeds and bits
   for (int i = 0; i < t - 1; i++) {
     if (index[i] >= index[i + 1]) {
@@ -124,8 +185,8 @@ void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
   }
 
   // construct sorted index
-  std::vector<std::set<uint64_t>> sortedIndex(size + 1);
-  for (int i = 1; i <= size; i++) {
+  std::vector<std::set<uint64_t>> sortedIndex(depth + 1);
+  for (int i = 1; i <= depth; i++) {
     for (int j = 0; j < t; j++) {
       // get the first i bits of index[j]
       auto prefix = index[j] >> (size - i);
@@ -154,12 +215,12 @@ void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
   int tCW0, tCW1;
 
   // n * t CWs
-  std::vector<std::vector<CW>> CWs(size);
-  for (int i = 0; i < size; i++) {
+  std::vector<std::vector<CW>> CWs(depth);
+  for (int i = 0; i < depth; i++) {
     CWs[i].resize(t);
   }
 
-  for (int i = 1; i <= size; i++) {
+  for (int i = 1; i <= depth; i++) {
     // std::cout << "Processing layer " << i << " with " <<
     // sortedIndex[i].size() << " prefixes." << std::endl;
     auto it = sortedIndex[i - 1].begin();
@@ -272,62 +333,40 @@ void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
     bits1 = std::move(nextBits1);
   }
 
+  // Convert the final seeds in the key mode selected on the context
+  uint8_t *convert0 = (uint8_t *)malloc(t * leafSize);
+  uint8_t *convert1 = (uint8_t *)malloc(t * leafSize);
+  leafConvert(ctx, flags, seeds0.data(), t, leafSize, convert0);
+  leafConvert(ctx, flags, seeds1.data(), t, leafSize, convert1);
+
+  uint8_t *lastCWs = k0 + HEAD_SIZE + depth * t * DMPF_CW_SIZE;
+  for (int i = 0; i < t * leafSize; i++)
+    lastCWs[i] = convert0[i] ^ convert1[i];
+
   for (int i = 0; i < t; i++) {
-    // Use CTR mode encryption to generate PRG output
-    EVP_CIPHER_CTX *seedCtx0;
-    EVP_CIPHER_CTX *seedCtx1;
-    int len = 0;
-    if (!(seedCtx0 = EVP_CIPHER_CTX_new()))
-      printf("errors occurred in creating context\n");
-    if (!(seedCtx1 = EVP_CIPHER_CTX_new()))
-      printf("errors occurred in creating context\n");
-
-    // generate lastCW
-    // Allocate memory for data conversion
-    uint8_t *lastCW = (uint8_t *)malloc(dataSize);
-    uint8_t *convert0 = (uint8_t *)malloc(dataSize + 16);
-    uint8_t *convert1 = (uint8_t *)malloc(dataSize + 16);
-    uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-    memset(zeros, 0, dataSize + 16);
-    memcpy(lastCW, data + i * dataSize, dataSize);
-
-    if (1 != EVP_EncryptInit_ex(seedCtx0, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds0[i], NULL))
-      printf("errors occurred in init of dpf gen\n");
-    if (1 != EVP_EncryptInit_ex(seedCtx1, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds1[i], NULL))
-      printf("errors occurred in init of dpf gen\n");
-    if (1 != EVP_EncryptUpdate(seedCtx0, convert0, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
-    if (1 != EVP_EncryptUpdate(seedCtx1, convert1, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
-
-    // Calculate final lastCW_i
+    // Calculate final lastCW_i: data_i goes to its slot in the leaf of its
+    // prefix (the i-th leaf when nothing is packed)
+    auto leafIt = sortedIndex[depth].find(index[i] >> packBits);
+    int leaf = std::distance(sortedIndex[depth].begin(), leafIt);
+    int slot = (index[i] & ((1ULL << packBits) - 1)) * dataSize;
+    uint8_t *lastCW = lastCWs + leaf * leafSize + slot;
     for (int j = 0; j < dataSize; j++) {
-      lastCW[j] =
-          lastCW[j] ^ ((uint8_t *)convert0)[j] ^ ((uint8_t *)convert1)[j];
+      lastCW[j] ^= data[i * dataSize + j];
     }
-
-    memcpy(k0 + HEAD_SIZE + size * t * DMPF_CW_SIZE + i * dataSize, lastCW,
-           dataSize);
-    EVP_CIPHER_CTX_free(seedCtx0);
-    EVP_CIPHER_CTX_free(seedCtx1);
-
-    // cleanup
-    free(zeros);
-    free(convert0);
-    free(convert1);
-    free(lastCW);
   }
 
+  // cleanup
+  free(convert0);
+  free(convert1);
+
   // Prepare k0 and k1
   // k0 and k1 are of size HEAD_SIZE + size * t * DMP
   k0[0] = size;
   k0[1] = t;
-  k0[HEAD_SIZE - 1] = 0;
+  k0[HEAD_SIZE - 1] = 0 | flags;
   memcpy(&k0[2], &root0, 16);
   // copy CWs to k0
-  for (int i = 0; i < size; i++) {
+  for (int i = 0; i < depth; i++) {
     for (int j = 0; j < t; j++) {
       uint128_t sCW = std::get<0>(CWs[i][j]);
       int tCW0 = std::get<1>(CWs[i][j]);
@@ -340,10 +379,10 @@ void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
   }
 
   // copy k1
-  memcpy(k1, k0, HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize);
+  memcpy(k1, k0, HEAD_SIZE + depth * t * DMPF_CW_SIZE + t * leafSize);
   k1[0] = size;
   k1[1] = t;
-  k1[HEAD_SIZE - 1] = 1;
+  k1[HEAD_SIZE - 1] = 1 | flags;
   memcpy(&k1[2], &root1, 16);
 }
 
@@ -572,59 +611,31 @@ void genBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int t, int size,
     // END: verification code
     // *********************************
 
-    for (int i = 0; i < t; i++) {
-      // Use CTR mode encryption to generate PRG output
-      EVP_CIPHER_CTX *seedCtx0;
-      EVP_CIPHER_CTX *seedCtx1;
-      int len = 0;
-      if (!(seedCtx0 = EVP_CIPHER_CTX_new()))
-        printf("errors occurred in creating context\n");
-      if (!(seedCtx1 = EVP_CIPHER_CTX_new()))
-        printf("errors occurred in creating context\n");
-
-      // generate lastCW
-      // Allocate memory for data conversion
-      uint8_t *lastCW = (uint8_t *)malloc(dataSize);
-      uint8_t *convert0 = (uint8_t *)malloc(dataSize + 16);
-      uint8_t *convert1 = (uint8_t *)malloc(dataSize + 16);
-      uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-      memset(zeros, 0, dataSize + 16);
-      memcpy(lastCW, data + i * dataSize, dataSize);
-
-      if (1 != EVP_EncryptInit_ex(seedCtx0, EVP_aes_128_ctr(), NULL,
-                                  (uint8_t *)&seeds0[i], NULL))
-        printf("errors occurred in init of dpf gen\n");
-      if (1 != EVP_EncryptInit_ex(seedCtx1, EVP_aes_128_ctr(), NULL,
-                                  (uint8_t *)&seeds1[i], NULL))
-        printf("errors occurred in init of dpf gen\n");
-      if (1 != EVP_EncryptUpdate(seedCtx0, convert0, &len, zeros, dataSize))
-        printf("errors occurred in encrypt\n");
-      if (1 != EVP_EncryptUpdate(seedCtx1, convert1, &len, zeros, dataSize))
-        printf("errors occurred in encrypt\n");
+    // Convert the final seeds in the key mode selected on the context
+    uint8_t flags =
+        (getKeyFlags(ctx) & ~KEY_FLAG_PACKED_LEAVES) | KEY_FLAG_MMO_HASH;
+    uint8_t *convert0 = (uint8_t *)malloc(t * dataSize);
+    uint8_t *convert1 = (uint8_t *)malloc(t * dataSize);
+    leafConvert(ctx, flags, seeds0.data(), t, dataSize, convert0);
+    leafConvert(ctx, flags, seeds1.data(), t, dataSize, convert1);
 
+    for (int i = 0; i < t; i++) {
       // Calculate final lastCW_i
+      uint8_t *lastCW = k0 + HEAD_SIZE + size * t * DMPF_CW_SIZE + i * dataSize;
       for (int j = 0; j < dataSize; j++) {
-        lastCW[j] =
-            lastCW[j] ^ ((uint8_t *)convert0)[j] ^ ((uint8_t *)convert1)[j];
+        lastCW[j] = data[i * dataSize + j] ^ convert0[i * dataSize + j] ^
+                    convert1[i * dataSize + j];
       }
-
-      memcpy(k0 + HEAD_SIZE + size * t * DMPF_CW_SIZE + i * dataSize, lastCW,
-             dataSize);
-
-      EVP_CIPHER_CTX_free(seedCtx0);
-      EVP_CIPHER_CTX_free(seedCtx1);
-
-      // cleanup
-      free(zeros);
-      free(convert0);
-      free(convert1);
-      free(lastCW);
     }
 
+    // cleanup
+    free(convert0);
+    free(convert1);
+
     // Prepare k0 and k1
     k0[0] = size;
     k0[1] = t;
-    k0[HEAD_SIZE - 1] = 0;
+    k0[HEAD_SIZE - 1] = 0 | flags;
     memcpy(&k0[2], &root0, 16);
     for (int i = 0; i < size; i++) {
       for (int j = 0; j < t; j++) {
@@ -648,523 +659,886 @@ void genBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int t, int size,
                16 * (hash->outblocks) * t);
     k1[0] = size;
     k1[1] = t;
-    k1[HEAD_SIZE - 1] = 1;
+    k1[HEAD_SIZE - 1] = 1 | flags;
     memcpy(&k1[2], &root1, 16); // only value that is different from k0
   }
 }
 
-void evalBigStateDMPF(EVP_CIPHER_CTX *ctx, uint64_t index, int dataSize,
-                      uint8_t *dataShare, uint8_t *k) {
-  // parse the key
-  int size = k[0];
-  int t = k[1];
-  int bit = 0;
-  uint128_t seed;
-  memcpy(&seed, &k[2], 16);
-  if (k[HEAD_SIZE - 1] == 1) {
-    bit = 1 << (t - 1);
-  }
+// *********************************
+// Traversal engine shared by the big-state evaluators
+// *********************************
+//
+// Full-domain and point evaluation, with or without a VDMPF proof, and
+// decompression all walk the same tree. The helpers below are templated on
+// the point count T and the leaf width W (0 = only known at run time) so the
+// correction and payload loops unroll, and on a Proof policy that sees every
+// evaluated leaf. dispatchBigState picks the instantiation for a key.
+
+// A DMPF/VDMPF key with its header parsed
+struct BigStateKey {
+  const uint8_t *k;
+  int size;     // log2 of the domain
+  int t;        // number of points
+  int depth;    // tree depth, size - packBits
+  int packBits; // log2 of the points per leaf
+  int dataSize; // bytes per point
+  int leafSize; // bytes per leaf, dataSize << packBits
+  uint8_t flags;
+  uint128_t root;
+  int rootBit;
+  const uint8_t *lastCWs; // t * leafSize bytes
+};
+
+static BigStateKey parseBigStateKey(const uint8_t *k, int dataSize) {
+  BigStateKey key;
+  key.k = k;
+  key.size = k[0];
+  key.t = k[1];
+  memcpy(&key.root, &k[2], 16);
+  key.rootBit = (k[HEAD_SIZE - 1] & KEY_CONTROL_BIT) ? 1 << (key.t - 1) : 0;
+  key.flags = k[HEAD_SIZE - 1] & ~KEY_CONTROL_BIT;
+  // with packed leaves the tree is packBits levels shorter and every leaf
+  // converts to the outputs of 2^packBits consecutive points
+  key.packBits = 0;
+  if (key.flags & KEY_FLAG_PACKED_LEAVES)
+    key.packBits = packedLeafBits(key.size, dataSize);
+  key.depth = key.size - key.packBits;
+  key.dataSize = dataSize;
+  key.leafSize = dataSize << key.packBits;
+  key.lastCWs = k + HEAD_SIZE + key.depth * key.t * DMPF_CW_SIZE;
+  return key;
+}
 
-  std::vector<CW> CWs(t);
+// Reads the t correction words of a level (1-based) from a CW area
+static inline void loadLevelCWs(const uint8_t *cwArea, int level, int t,
+                                CW *CWs) {
   uint128_t sCW;
   int tCW0, tCW1;
-
-  uint128_t sL, sR;
-  int tL, tR;
-
-  for (int i = 1; i <= size; i++) {
-    CWs.clear();
-    CWs.resize(t);
-    for (int j = 0; j < t; j++) {
-      memcpy(&sCW, &k[HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE], 16);
-      memcpy(&tCW0, &k[HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE + 16], 4);
-      memcpy(&tCW1, &k[HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE + 20], 4);
-      CWs[j] = std::make_tuple(sCW, tCW0, tCW1);
-    }
-    auto [sCW, tCW0, tCW1] = bigStateCorrect(t, bit, CWs);
-    dmpfPRG(ctx, t, seed, &sL, &sR, &tL, &tR);
-    int indexBit = getbit(index, size, i);
-
-    if (indexBit == 0) {
-      seed = sL ^ sCW;
-      bit = tL ^ tCW0;
-    } else {
-      seed = sR ^ sCW;
-      bit = tR ^ tCW1;
-    }
+  for (int j = 0; j < t; j++) {
+    const uint8_t *cw = cwArea + ((level - 1) * t + j) * DMPF_CW_SIZE;
+    memcpy(&sCW, cw, 16);
+    memcpy(&tCW0, cw + 16, 4);
+    memcpy(&tCW1, cw + 20, 4);
+    CWs[j] = std::make_tuple(sCW, tCW0, tCW1);
   }
+}
 
-  // Generate dataShare using PRG with the final seed
-  int len = 0;
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  if (!zeros) {
-    std::cerr << "Failed to allocate memory for zeros" << std::endl;
-    return;
-  }
-  memset(zeros, 0, dataSize + 16);
-  // Initialize dataShare with zeros, only dataSize bytes
-  memset(dataShare, 0, dataSize);
-  EVP_CIPHER_CTX *seedCtx;
-  if (!(seedCtx = EVP_CIPHER_CTX_new())) {
-    printf("errors occurred in creating context\n");
-    free(zeros);
-    return;
-  }
-  if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                              (uint8_t *)&seed, NULL)) {
-    printf("errors occurred in init of dpf eval\n");
-    EVP_CIPHER_CTX_free(seedCtx);
-    free(zeros);
-    return;
-  }
-  if (1 != EVP_EncryptUpdate(seedCtx, dataShare, &len, zeros, dataSize)) {
-    printf("errors occurred in encrypt\n");
-    EVP_CIPHER_CTX_free(seedCtx);
-    free(zeros);
-    return;
+// bigStateCorrect with a compile-time point count
+template <int T>
+static inline CW bigStateCorrectT(int t, int state, const CW *CWs) {
+  const int tt = T ? T : t;
+  uint128_t sCW = 0;
+  int tCW0 = 0, tCW1 = 0;
+  for (int j = 0; j < tt; j++) {
+    int bit = (state >> (tt - 1 - j)) & 1;
+    sCW ^= std::get<0>(CWs[j]) & bitMask(bit);
+    tCW0 ^= std::get<1>(CWs[j]) & -bit;
+    tCW1 ^= std::get<2>(CWs[j]) & -bit;
   }
+  return std::make_tuple(sCW, tCW0, tCW1);
+}
 
-  for (int i = 0; i < t; i++) {
-    if (getbit(bit, t, i + 1) == 1) {
-      // If t[i] == 1, xor in the correction word (lastCW) from the key
-      // The correction word is at the end of the key: offset = HEAD_SIZE + size
-      // t * DMPF_CW_SIZE + i * dataSize
-      for (int j = 0; j < dataSize; j++) {
-        dataShare[j] ^=
-            k[HEAD_SIZE + size * t * DMPF_CW_SIZE + i * dataSize + j];
+// Method-of-four-Russians form of bigStateCorrect for one level: entry
+// 256 * c + e is the XOR of the correction words selected by bits
+// 8c..8c+7 of the control state being e, so a node's correction takes
+// ceil(t / 8) lookups instead of t tests. Building it costs 255 XORs per
+// 8-bit slice, so it only pays off on levels with many nodes.
+struct CorrectionEntry {
+  uint128_t sCW;
+  int tCW0, tCW1;
+};
+
+// Layers narrower than this are corrected word by word
+const int CORRECTION_TABLE_MIN_NODES = 32;
+
+static inline int correctionChunks(int t) { return (t + 7) / 8; }
+
+static void buildCorrectionTable(int t, const CW *CWs,
+                                 CorrectionEntry *table) {
+  for (int c = 0; c < correctionChunks(t); c++) {
+    CorrectionEntry *chunk = table + 256 * c;
+    chunk[0] = {0, 0, 0};
+    for (int e = 1; e < 256; e++) {
+      // state bit b selects CWs[t - 1 - b]; add the lowest set bit of e to
+      // the entry without it
+      const CorrectionEntry &prev = chunk[e & (e - 1)];
+      int j = t - 1 - (8 * c + __builtin_ctz(e));
+      if (j < 0) {
+        chunk[e] = prev;
+        continue;
       }
+      chunk[e].sCW = prev.sCW ^ std::get<0>(CWs[j]);
+      chunk[e].tCW0 = prev.tCW0 ^ std::get<1>(CWs[j]);
+      chunk[e].tCW1 = prev.tCW1 ^ std::get<2>(CWs[j]);
     }
   }
-  EVP_CIPHER_CTX_free(seedCtx);
-  free(zeros);
 }
 
-void evalBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
-                       struct Hash *mmo_hash2, uint64_t index, int dataSize,
-                       uint8_t *dataShare, uint8_t *proof, uint8_t *k) {
-  // parse the key
-  int size = k[0];
-  int t = k[1];
-  int bit = 0;
-  uint128_t seed;
-  memcpy(&seed, &k[2], 16);
-  if (k[HEAD_SIZE - 1] == 1) {
-    bit = 1 << (t - 1);
+template <int T>
+static inline CorrectionEntry tableCorrect(const CorrectionEntry *table, int t,
+                                           int state) {
+  const int chunks = correctionChunks(T ? T : t);
+  uint32_t bits = (uint32_t)state;
+  CorrectionEntry corr = table[bits & 0xff];
+  for (int c = 1; c < chunks; c++) {
+    const CorrectionEntry &e = table[256 * c + ((bits >> (8 * c)) & 0xff)];
+    corr.sCW ^= e.sCW;
+    corr.tCW0 ^= e.tCW0;
+    corr.tCW1 ^= e.tCW1;
   }
+  return corr;
+}
 
-  std::vector<CW> CWs(t);
-  uint128_t sCW;
-  int tCW0, tCW1;
+// Collects the last correction word of every point set in state, walking the
+// set bits with ctz; returns the number of rows written to rows (at most t)
+static inline int selectLastCWs(int state, int t, int width,
+                                const uint8_t *lastCWs, const uint8_t **rows) {
+  int n = 0;
+  for (uint32_t s = (uint32_t)state; s; s &= s - 1)
+    rows[n++] = lastCWs + (t - 1 - __builtin_ctz(s)) * width;
+  return n;
+}
 
-  uint128_t sL, sR;
-  int tL, tR;
+// XORs the last correction word of every point set in state into a leaf.
+// Fixed small widths stay inline and add every word under a mask; wider
+// payloads go through xorRows, which folds all selected words into the leaf
+// in a single SIMD pass.
+template <int T, int W>
+static inline void applyLastCWs(uint8_t *leaf, int state, int t, int width,
+                                const uint8_t *lastCWs) {
+  const int tt = T ? T : t;
+  const int w = W ? W : width;
+  if (W) {
+    for (int j = 0; j < tt; j++)
+      xorIfSet(leaf, lastCWs + j * W, W, (state >> (tt - 1 - j)) & 1);
+    return;
+  }
+  const uint8_t *rows[32];
+  int n = selectLastCWs(state, tt, w, lastCWs, rows);
+  xorRows(leaf, rows, n, w);
+}
 
-  for (int i = 1; i <= size; i++) {
-    CWs.clear();
-    CWs.resize(t);
-    for (int j = 0; j < t; j++) {
-      memcpy(&sCW, &k[HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE], 16);
-      memcpy(&tCW0, &k[HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE + 16], 4);
-      memcpy(&tCW1, &k[HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE + 20], 4);
-      CWs[j] = std::make_tuple(sCW, tCW0, tCW1);
-    }
-    auto [sCW, tCW0, tCW1] = bigStateCorrect(t, bit, CWs);
-    dmpfPRG(ctx, t, seed, &sL, &sR, &tL, &tR);
-    int indexBit = getbit(index, size, i);
-
-    if (indexBit == 0) {
-      seed = sL ^ sCW;
-      bit = tL ^ tCW0;
-    } else {
-      seed = sR ^ sCW;
-      bit = tR ^ tCW1;
+// All 2^t subset XORs of a key's last correction words: row e holds the
+// words selected by control state e, so a leaf needs a single XOR however
+// many of its bits are set. Only built for t <= LASTCW_TABLE_MAX_T, when the
+// table fits the context's budget and there are at least 2^t leaves to
+// amortize it over.
+struct LastCWTable {
+  std::vector<uint8_t> rows;
+  int width = 0;
+
+  bool build(EVP_CIPHER_CTX *ctx, int t, int w, const uint8_t *lastCWs,
+             uint64_t leaves) {
+    uint64_t entries = 1ULL << t;
+    if (t > LASTCW_TABLE_MAX_T || leaves < entries ||
+        entries * w > getLastCWTableBudget(ctx))
+      return false;
+
+    width = w;
+    rows.assign(entries * w, 0);
+    for (uint64_t e = 1; e < entries; e++) {
+      // add the lowest set bit of e to the row without it
+      memcpy(&rows[e * w], &rows[(e & (e - 1)) * w], w);
+      const uint8_t *cw = lastCWs + (t - 1 - __builtin_ctzll(e)) * w;
+      xorRows(&rows[e * w], &cw, 1, w);
     }
+    return true;
   }
 
-  // *********************************
-  // START: verification code
-  // *********************************
-
-  // recover CSs
-  uint128_t cs[4 * t];
-  uint128_t pi[4 * t];
-  uint128_t hashinput[mmo_hash1->outblocks];
-  memcpy(cs, &k[HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize],
-         16 * (mmo_hash1->outblocks) * t);
-  memcpy(pi, &k[HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize],
-         16 * (mmo_hash1->outblocks) * t);
-
-  int seedBit = seed_lsb(seed);
-
-  for (int i = 0; i < t; i++) {
-    uint128_t tpi[mmo_hash1->outblocks];
-    uint128_t cpi[mmo_hash1->outblocks];
-
-    hashinput[0] = index;
-    hashinput[1] = seed;
-    hashinput[2] = 0;
-    hashinput[3] = 0;
-
-    mmoHash2to4(mmo_hash1, (uint8_t *)&hashinput[0], (uint8_t *)&tpi);
-
-    hashinput[0] = pi[i * 4] ^ correct(tpi[0], cs[i * 4], seedBit);
-    hashinput[1] = pi[i * 4 + 1] ^ correct(tpi[1], cs[i * 4 + 1], seedBit);
-    hashinput[2] = pi[i * 4 + 2] ^ correct(tpi[2], cs[i * 4 + 2], seedBit);
-    hashinput[3] = pi[i * 4 + 3] ^ correct(tpi[3], cs[i * 4 + 3], seedBit);
-
-    mmoHash2to4(mmo_hash2, (uint8_t *)&hashinput[0], (uint8_t *)&cpi);
-
-    pi[i * 4] ^= cpi[0];
-    pi[i * 4 + 1] ^= cpi[1];
-    pi[i * 4 + 2] ^= cpi[2];
-    pi[i * 4 + 3] ^= cpi[3];
-
-    // *********************************
-    // END: DMPF verification code
-    // *********************************
+  const uint8_t *row(int state) const { return &rows[(size_t)state * width]; }
+};
+
+// Smallest unsigned type that holds a t-bit control state. The evaluators
+// keep the states of a layer in an array of these beside the seed array, so
+// small point counts move 1 or 2 bytes per node instead of 4; run-time t
+// (T = 0) uses 32 bits.
+template <int T>
+using BigState = typename std::conditional<
+    T != 0 && T <= 8, uint8_t,
+    typename std::conditional<T != 0 && T <= 16, uint16_t,
+                              uint32_t>::type>::type;
+
+// Cache-blocked traversal of a big-state tree. The top depth - blockLevels
+// levels are walked depth first, keeping only the current path and its right
+// siblings; every subtree of 2^blockLevels leaves below them is expanded
+// breadth first through the batched PRG in block-sized buffers, so a layer
+// stays in cache however large the domain (setBigStateBlockLevels).
+// Leaf i of block b is leaf b * blockLeaves() + i of the tree; consecutive
+// blocks only redo the path below the level where they part, any other block
+// is reached from the root. maxBlockLevels further caps the block height.
+template <int T> class BigStateTraversal {
+public:
+  BigStateTraversal(EVP_CIPHER_CTX *ctx, const uint8_t *cwArea, int depth,
+                    int t, uint128_t root, BigState<T> rootBit,
+                    int maxBlockLevels = 30)
+      : ctx(ctx), tt(T ? T : t) {
+    blockLevels =
+        std::min({depth, getBigStateBlockLevels(ctx), maxBlockLevels});
+    topLevels = depth - blockLevels;
+    CWs.resize((size_t)depth * tt);
+    for (int i = 1; i <= depth; i++)
+      loadLevelCWs(cwArea, i, tt, &CWs[(size_t)(i - 1) * tt]);
+
+    // correction tables of the wide block levels are built once and shared
+    // by all blocks
+    int chunk = 256 * correctionChunks(tt);
+    tables.resize((size_t)blockLevels * chunk);
+    for (int i = 1; i <= blockLevels; i++)
+      if (1 << (i - 1) >= CORRECTION_TABLE_MIN_NODES)
+        buildCorrectionTable(tt, levelCWs(topLevels + i),
+                             &tables[(size_t)(i - 1) * chunk]);
+
+    uint64_t leaves = blockLeaves();
+    seeds.resize(leaves);
+    bits.resize(leaves);
+    nextSeeds.resize(leaves);
+    nextBits.resize(leaves);
+
+    pathSeeds.resize(topLevels + 1);
+    pathBits.resize(topLevels + 1);
+    rightSeeds.resize(topLevels + 1);
+    rightBits.resize(topLevels + 1);
+    pathSeeds[0] = root;
+    pathBits[0] = rootBit;
+    descend(1, 0);
   }
 
-  // Generate dataShare using PRG with the final seed
-  int len = 0;
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  if (!zeros) {
-    std::cerr << "Failed to allocate memory for zeros" << std::endl;
-    return;
-  }
-  memset(zeros, 0, dataSize + 16);
-  // Initialize dataShare with zeros, only dataSize bytes
-  memset(dataShare, 0, dataSize);
-  EVP_CIPHER_CTX *seedCtx;
-  if (!(seedCtx = EVP_CIPHER_CTX_new())) {
-    printf("errors occurred in creating context\n");
-    free(zeros);
-    return;
+  uint64_t blocks() const { return 1ULL << topLevels; }
+  uint64_t blockLeaves() const { return 1ULL << blockLevels; }
+  const uint128_t *leafSeeds() const { return seeds.data(); }
+  const BigState<T> *leafBits() const { return bits.data(); }
+
+  // Expands block b into leafSeeds/leafBits
+  void expand(uint64_t b) {
+    if (b == current + 1) {
+      // the level of the lowest set bit of b turns from the left child to
+      // the right one and everything below it is redone
+      int d = topLevels - __builtin_ctzll(b);
+      pathSeeds[d] = rightSeeds[d];
+      pathBits[d] = rightBits[d];
+      descend(d + 1, b);
+    } else if (b != current) {
+      descend(1, b);
+    }
+    current = b;
+    seeds[0] = pathSeeds[topLevels];
+    bits[0] = pathBits[topLevels];
+    for (int i = 1; i <= blockLevels; i++)
+      expandLevel(i);
   }
-  if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                              (uint8_t *)&seed, NULL)) {
-    printf("errors occurred in init of dpf eval\n");
-    EVP_CIPHER_CTX_free(seedCtx);
-    free(zeros);
-    return;
+
+private:
+  EVP_CIPHER_CTX *ctx;
+  const int tt;
+  int blockLevels, topLevels;
+  uint64_t current = 0; // block the path leads to
+  std::vector<CW> CWs;  // levels 1..depth
+  std::vector<CorrectionEntry> tables;
+  std::vector<uint128_t> seeds, nextSeeds, pathSeeds, rightSeeds;
+  std::vector<BigState<T>> bits, nextBits, pathBits, rightBits;
+
+  const CW *levelCWs(int level) const {
+    return &CWs[(size_t)(level - 1) * tt];
   }
-  if (1 != EVP_EncryptUpdate(seedCtx, dataShare, &len, zeros, dataSize)) {
-    printf("errors occurred in encrypt\n");
-    EVP_CIPHER_CTX_free(seedCtx);
-    free(zeros);
-    return;
+
+  // Recomputes the path to block b (and the right siblings on it) from
+  // level from down
+  void descend(int from, uint64_t b) {
+    uint128_t sL, sR;
+    int tL, tR;
+    for (int d = from; d <= topLevels; d++) {
+      auto [sCW, tCW0, tCW1] =
+          bigStateCorrectT<T>(tt, pathBits[d - 1], levelCWs(d));
+      dmpfPRG(ctx, tt, pathSeeds[d - 1], &sL, &sR, &tL, &tR);
+      int xbit = (b >> (topLevels - d)) & 1;
+      pathSeeds[d] = selectBlock(xbit, sL, sR) ^ sCW;
+      pathBits[d] = selectBit(xbit, tL ^ tCW0, tR ^ tCW1);
+      rightSeeds[d] = sR ^ sCW;
+      rightBits[d] = tR ^ tCW1;
+    }
   }
 
-  for (int i = 0; i < t; i++) {
-    if (getbit(bit, t, i + 1) == 1) {
-      // If t[i] == 1, xor in the correction word (lastCW) from the key
-      // The correction word is at the end of the key: offset = HEAD_SIZE + size
-      // t * DMPF_CW_SIZE + i * dataSize
-      for (int j = 0; j < dataSize; j++) {
-        dataShare[j] ^=
-            k[HEAD_SIZE + size * t * DMPF_CW_SIZE + i * dataSize + j];
+  // Expands level i (1-based) of the current block
+  void expandLevel(int i) {
+    const CW *cws = levelCWs(topLevels + i);
+    int prevLayerSize = 1 << (i - 1);
+    bool useTable = prevLayerSize >= CORRECTION_TABLE_MIN_NODES;
+    const CorrectionEntry *table =
+        &tables[(size_t)(i - 1) * 256 * correctionChunks(tt)];
+
+    uint128_t sL[PRG_BATCH], sR[PRG_BATCH];
+    int tL[PRG_BATCH], tR[PRG_BATCH];
+    for (int j = 0; j < prevLayerSize; j += PRG_BATCH) {
+      int m = std::min(PRG_BATCH, prevLayerSize - j);
+      dmpfPRGBatch(ctx, tt, &seeds[j], m, sL, sR, tL, tR);
+
+      for (int l = 0; l < m; l++) {
+        CorrectionEntry corr;
+        if (useTable) {
+          corr = tableCorrect<T>(table, tt, bits[j + l]);
+        } else {
+          auto [sCW, tCW0, tCW1] = bigStateCorrectT<T>(tt, bits[j + l], cws);
+          corr = {sCW, tCW0, tCW1};
+        }
+
+        nextSeeds[2 * (j + l)] = sL[l] ^ corr.sCW;
+        nextSeeds[2 * (j + l) + 1] = sR[l] ^ corr.sCW;
+        nextBits[2 * (j + l)] = tL[l] ^ corr.tCW0;
+        nextBits[2 * (j + l) + 1] = tR[l] ^ corr.tCW1;
       }
     }
+
+    // Swap vectors instead of move to avoid deallocation
+    seeds.swap(nextSeeds);
+    bits.swap(nextBits);
   }
-  EVP_CIPHER_CTX_free(seedCtx);
-  free(zeros);
+};
+
+// Follows the path of index (a size-bit point) down depth levels
+template <int T>
+static void walkBigStateTree(EVP_CIPHER_CTX *ctx, const uint8_t *cwArea,
+                             int depth, int size, int t, uint64_t index,
+                             uint128_t *seed, int *bit) {
+  const int tt = T ? T : t;
+  std::vector<CW> CWs(tt);
+  uint128_t sL, sR;
+  int tL, tR;
 
-  // VDPF output hash (just SHA256 of pi)
-  uint8_t hash[32];
-  sha_256_init(&sha_256, hash);
-  sha_256_write(&sha_256, (uint8_t *)&pi[0], sizeof(uint128_t) * 4 * t);
-  sha_256_close(&sha_256);
-  memcpy(proof, hash, sizeof(uint8_t) * 32);
-}
+  for (int i = 1; i <= depth; i++) {
+    loadLevelCWs(cwArea, i, tt, CWs.data());
+    auto [sCW, tCW0, tCW1] = bigStateCorrectT<T>(tt, *bit, CWs.data());
+    dmpfPRG(ctx, tt, *seed, &sL, &sR, &tL, &tR);
 
-void fullDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k, int dataSize,
-                            uint8_t *out) {
-  // parse the key
-  int size = k[0];
-  int t = k[1];
-  int bit = 0;
-  uint128_t root;
-  memcpy(&root, &k[2], 16);
-  if (k[HEAD_SIZE - 1] == 1) {
-    bit = 1 << (t - 1);
+    int xbit = getbit(index, size, i);
+    *seed = selectBlock(xbit, sL, sR) ^ sCW;
+    *bit = selectBit(xbit, tL ^ tCW0, tR ^ tCW1);
   }
+}
 
-  // Pre-calculate constants
-  int domainSize = 1 << size;
-  int cwOffset = HEAD_SIZE + size * t * DMPF_CW_SIZE;
-
-  // Pre-allocate vectors with exact size to avoid reallocation
-  std::vector<uint128_t> seeds(domainSize);
-  std::vector<int> bits(domainSize);
-  seeds[0] = root; // root seed
-  bits[0] = bit;   // root bit
+// Proof policy of the plain DMPF evaluators
+struct NoProof {
+  // Parallel full-domain evaluation (see MMOProof)
+  struct Worker {
+    Worker(NoProof &) {}
+    void leaf(uint64_t, uint128_t, uint32_t) {}
+  };
+  size_t leafBytes() const { return 0; }
+  void beginRound(uint64_t, uint64_t) {}
+  void endRound() {}
+
+  void leaf(uint64_t, uint128_t, uint32_t) {}
+  void finish(uint8_t *) {}
+};
+
+// Step 1 of the VDMPF proof of leaf x: H(x||seed), corrected with the cs of
+// every point set in the leaf's control state. The two servers' states
+// differ exactly in the bit of the point at x, if any, whose cs cancels the
+// difference of their hashes.
+static void mmoProofStepOne(struct Hash *mmo_hash1, int t, const uint128_t *cs,
+                            uint64_t x, uint128_t seed, uint32_t state,
+                            uint128_t *ctpi) {
+  uint128_t hashinput[2] = {x, seed};
+  mmoHash2to4(mmo_hash1, (uint8_t *)hashinput, (uint8_t *)ctpi);
+  for (int j = 0; j < t; j++) {
+    uint128_t mask = bitMask((state >> (t - 1 - j)) & 1);
+    for (int b = 0; b < 4; b++)
+      ctpi[b] ^= cs[4 * j + b] & mask;
+  }
+}
 
-  // Pre-allocate CWs vector once and reuse
-  std::vector<CW> CWs(t);
-  uint128_t sCW;
-  int tCW0, tCW1;
+// Proof policy of the VDMPF evaluators: folds every evaluated leaf into pi
+// and hashes pi into the proof.
+//
+// In parallel full-domain evaluation the workers run step 1 of their leaves
+// on clones of mmo_hash1 and hand the corrected hashes over; endRound chains
+// the leaves of a round into pi in order, since each step depends on the pi
+// the previous leaf left.
+struct MMOProof {
+  struct Hash *mmo_hash1, *mmo_hash2;
+  int t;
+  std::vector<uint128_t> cs;
+  uint128_t pi[4];
+  uint64_t roundFirst;             // first leaf of the current round
+  std::vector<uint128_t> roundTpi; // 4 blocks per leaf
+
+  MMOProof(struct Hash *h1, struct Hash *h2, const BigStateKey &key)
+      : mmo_hash1(h1), mmo_hash2(h2), t(key.t), cs(4 * key.t) {
+    // recover CSs, which follow the last correction words; pi starts as
+    // their XOR
+    const uint8_t *csBytes = key.lastCWs + key.t * key.leafSize;
+    memcpy(cs.data(), csBytes, 16 * 4 * t);
+    memset(pi, 0, sizeof(pi));
+    for (int j = 0; j < 4 * t; j++)
+      pi[j % 4] ^= cs[j];
+  }
 
-  uint128_t sL, sR;
-  int tL, tR;
+  struct Worker {
+    MMOProof &proof;
+    struct Hash *mmo_hash1;
 
-  // Pre-allocate next vectors to avoid repeated allocation
-  std::vector<uint128_t> nextSeeds(domainSize);
-  std::vector<int> nextBits(domainSize);
+    Worker(MMOProof &p) : proof(p), mmo_hash1(cloneMMOHash(p.mmo_hash1)) {}
+    Worker(const Worker &) = delete;
+    ~Worker() { destroyMMOHash(mmo_hash1); }
 
-  for (int i = 1; i <= size; i++) {
-    // Load CWs for this layer - reuse the same vector
-    for (int j = 0; j < t; j++) {
-      int offset = HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE;
-      memcpy(&sCW, &k[offset], 16);
-      memcpy(&tCW0, &k[offset + 16], 4);
-      memcpy(&tCW1, &k[offset + 20], 4);
-      CWs[j] = std::make_tuple(sCW, tCW0, tCW1);
+    void leaf(uint64_t x, uint128_t seed, uint32_t state) {
+      mmoProofStepOne(mmo_hash1, proof.t, proof.cs.data(), x, seed, state,
+                      &proof.roundTpi[4 * (x - proof.roundFirst)]);
     }
+  };
 
-    int prevLayerSize = 1 << (i - 1);
-    for (int j = 0; j < prevLayerSize; j++) {
-      dmpfPRG(ctx, t, seeds[j], &sL, &sR, &tL, &tR);
-      auto [sCW, tCW0, tCW1] = bigStateCorrect(t, bits[j], CWs);
-
-      nextSeeds[2 * j] = sL ^ sCW;
-      nextSeeds[2 * j + 1] = sR ^ sCW;
-      nextBits[2 * j] = tL ^ tCW0;
-      nextBits[2 * j + 1] = tR ^ tCW1;
-    }
+  size_t leafBytes() const { return 16 * 4; }
 
-    // Swap vectors instead of move to avoid deallocation
-    seeds.swap(nextSeeds);
-    bits.swap(nextBits);
+  void beginRound(uint64_t first, uint64_t leaves) {
+    roundFirst = first;
+    roundTpi.resize(4 * leaves);
   }
 
-  // Pre-allocate zeros buffer once
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  if (!zeros) {
-    std::cerr << "Failed to allocate memory for zeros" << std::endl;
-    return;
+  void endRound() {
+    for (size_t i = 0; i < roundTpi.size(); i += 4)
+      chain(&roundTpi[i]);
   }
-  memset(zeros, 0, dataSize + 16);
-  memset(out, 0, domainSize * dataSize); // Initialize out with zeros
-
-  // Pre-allocate a single EVP_CIPHER_CTX and reuse it
-  EVP_CIPHER_CTX *seedCtx = EVP_CIPHER_CTX_new();
-  if (!seedCtx) {
-    printf("errors occurred in creating context\n");
-    free(zeros);
-    return;
+
+  void leaf(uint64_t x, uint128_t seed, uint32_t state) {
+    uint128_t ctpi[4];
+    mmoProofStepOne(mmo_hash1, t, cs.data(), x, seed, state, ctpi);
+    chain(ctpi);
   }
 
-  int len = 0;
-  for (int i = 0; i < domainSize; i++) {
-    // Reset context for each iteration instead of creating new one
-    EVP_CIPHER_CTX_reset(seedCtx);
+  // Steps 2 and 3: pi ^= H'(pi ^ ctpi)
+  void chain(const uint128_t *ctpi) {
+    uint128_t hashinput[4], cpi[4];
+    for (int b = 0; b < 4; b++)
+      hashinput[b] = pi[b] ^ ctpi[b];
+    mmoHash4to4(mmo_hash2, (uint8_t *)hashinput, (uint8_t *)cpi);
+    for (int b = 0; b < 4; b++)
+      pi[b] ^= cpi[b];
+  }
 
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds[i], NULL)) {
-      printf("errors occurred in init of dpf eval\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
+  // VDPF output hash (just SHA256 of pi)
+  void finish(uint8_t *proof) {
+    calc_sha_256(proof, (uint8_t *)pi, sizeof(pi));
+  }
+};
+
+// Hands blocks [first, last) to the workers of ctx (setFullDomainThreads),
+// which claim them one at a time. Every worker gets a context of its own and
+// calls setup(workerCtx) for a function that converts a block b.
+template <typename Setup>
+static void parallelBlocks(EVP_CIPHER_CTX *ctx, uint64_t first, uint64_t last,
+                           Setup setup) {
+  struct Job {
+    EVP_CIPHER_CTX *ctx;
+    Setup *setup;
+    uint64_t next, last;
+  } job = {ctx, &setup, first, last};
+
+  runParallel(
+      ctx,
+      [](void *arg, int) {
+        Job *job = (Job *)arg;
+        EVP_CIPHER_CTX *workerCtx = cloneDPFContext(job->ctx);
+        {
+          auto convert = (*job->setup)(workerCtx);
+          uint64_t b;
+          while ((b = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+                 job->last)
+            convert(b);
+        }
+        destroyContext(workerCtx);
+      },
+      &job);
+}
+
+template <typename Proof> struct BigStateEval {
+  template <int T, int W>
+  static void run(EVP_CIPHER_CTX *ctx, const BigStateKey &key, uint64_t index,
+                  uint8_t *dataShare, Proof &proof) {
+    uint128_t seed = key.root;
+    int bit = key.rootBit;
+    walkBigStateTree<T>(ctx, key.k + HEAD_SIZE, key.depth, key.size, key.t,
+                        index, &seed, &bit);
+    proof.leaf(index, seed, bit);
+
+    // a packed leaf is converted whole and only the slot of index is kept
+    uint8_t packed[16];
+    uint8_t *leaf = key.packBits ? packed : dataShare;
+    leafConvert(ctx, key.flags, &seed, 1, key.leafSize, leaf);
+    applyLastCWs<T, W>(leaf, bit, key.t, key.leafSize, key.lastCWs);
+    if (key.packBits) {
+      int slot = (index & ((1ULL << key.packBits) - 1)) * key.dataSize;
+      memcpy(dataShare, &packed[slot], key.dataSize);
     }
-    if (1 !=
-        EVP_EncryptUpdate(seedCtx, out + i * dataSize, &len, zeros, dataSize)) {
-      printf("errors occurred in encrypt\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
+  }
+};
+
+// Evaluation of points [0, hi) into out, or, if out is NULL, of the blocks
+// that cover points [lo, hi) into stream, through one block-sized buffer.
+// Blocks are no larger than the range, so a range only walks the subtrees it
+// intersects.
+template <typename Proof> struct BigStateFullDomain {
+  template <int T, int W>
+  static void run(EVP_CIPHER_CTX *ctx, const BigStateKey &key, uint8_t *out,
+                  DPFChunkStream *stream, uint64_t lo, uint64_t hi,
+                  Proof &proof) {
+    const int w = W ? W : key.leafSize;
+    uint64_t leafLo = lo >> key.packBits;
+    uint64_t leafHi = ((hi - 1) >> key.packBits) + 1;
+
+    LastCWTable table;
+    bool useTable = table.build(ctx, key.t, w, key.lastCWs, leafHi - leafLo);
+    const LastCWTable *lastCWTable = useTable ? &table : nullptr;
+
+    if (getFullDomainThreads(ctx) > 1 && out) {
+      runWorkers<T, W>(ctx, key, lastCWTable, out, hi, proof);
       return;
     }
 
-    // Apply correction words - cache the offset calculation
-    uint8_t *outPtr = out + i * dataSize;
-    for (int j = 0; j < t; j++) {
-      if (getbit(bits[i], t, j + 1) == 1) {
-        uint8_t *cwPtr = k + cwOffset + j * dataSize;
-        for (int l = 0; l < dataSize; l++) {
-          outPtr[l] ^= cwPtr[l];
-        }
-      }
+    int rangeLevels = 63 - __builtin_clzll(leafHi - leafLo);
+    BigStateTraversal<T> tree(ctx, key.k + HEAD_SIZE, key.depth, key.t,
+                              key.root, key.rootBit, rangeLevels);
+    uint64_t blockLeaves = tree.blockLeaves();
+    uint64_t first = leafLo / blockLeaves, last = (leafHi - 1) / blockLeaves;
+    if (stream)
+      stream->next = (first * blockLeaves) << key.packBits;
+    BlockOut blockOut(out, hi * key.dataSize, blockLeaves * w);
+    for (uint64_t b = first; b <= last; b++) {
+      convertBlock<T, W>(ctx, key, tree, lastCWTable, b, blockOut.begin(b),
+                         proof);
+      if (out)
+        blockOut.end(b);
+      else
+        chunkStreamPush(stream, blockOut.buf.data(),
+                        blockLeaves << key.packBits);
     }
   }
 
-  EVP_CIPHER_CTX_free(seedCtx);
-  free(zeros);
-}
+  // Where block b is converted: straight into out, or into buf when out is
+  // NULL (streaming) or ends inside the block (truncated domain)
+  struct BlockOut {
+    uint8_t *out;
+    uint64_t outBytes, blockBytes;
+    std::vector<uint8_t> buf;
+
+    BlockOut(uint8_t *out, uint64_t outBytes, uint64_t blockBytes)
+        : out(out), outBytes(outBytes), blockBytes(blockBytes),
+          buf(!out || outBytes % blockBytes ? blockBytes : 0) {}
+
+    uint8_t *begin(uint64_t b) {
+      uint64_t offset = b * blockBytes;
+      return !out || offset + blockBytes > outBytes ? buf.data()
+                                                    : out + offset;
+    }
 
-void fullDomainBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
-                             struct Hash *mmo_hash2, int dataSize, uint8_t *k,
-                             uint8_t *out, uint8_t *proof) {
-  // parse the key
-  int size = k[0];
-  int t = k[1];
-  int bit = 0;
-  uint128_t root;
-  memcpy(&root, &k[2], 16);
-  if (k[HEAD_SIZE - 1] == 1) {
-    bit = 1 << (t - 1);
+    // copies the part of an overhanging block that fits out
+    void end(uint64_t b) {
+      uint64_t offset = b * blockBytes;
+      if (offset + blockBytes > outBytes)
+        memcpy(out + offset, buf.data(), outBytes - offset);
+    }
+  };
+
+  // Expands block b of tree and converts its leaves into blockOut
+  template <int T, int W, typename LeafProof>
+  static void convertBlock(EVP_CIPHER_CTX *ctx, const BigStateKey &key,
+                           BigStateTraversal<T> &tree,
+                           const LastCWTable *table, uint64_t b,
+                           uint8_t *blockOut, LeafProof &proof) {
+    const int w = W ? W : key.leafSize;
+    tree.expand(b);
+    const uint128_t *seeds = tree.leafSeeds();
+    const BigState<T> *bits = tree.leafBits();
+    uint64_t blockLeaves = tree.blockLeaves();
+
+    // Convert a cache-sized batch of the leaves, then fold in their
+    // correction words while the outputs are still in cache
+    uint64_t batch = std::max(1, LEAF_BLOCK_BYTES / w);
+    for (uint64_t i = 0; i < blockLeaves; i += batch) {
+      uint64_t m = std::min(batch, blockLeaves - i);
+      leafConvert(ctx, key.flags, &seeds[i], m, w, blockOut + i * w);
+      for (uint64_t l = i; l < i + m; l++) {
+        if (table) {
+          const uint8_t *row = table->row(bits[l]);
+          xorRows(blockOut + l * w, &row, 1, w);
+        } else {
+          applyLastCWs<T, W>(blockOut + l * w, bits[l], key.t, w,
+                             key.lastCWs);
+        }
+        proof.leaf(b * blockLeaves + l, seeds[l], bits[l]);
+      }
+    }
   }
 
-  // Pre-calculate constants
-  int domainSize = 1 << size;
-  int cwOffset = HEAD_SIZE + size * t * DMPF_CW_SIZE;
-
-  // Pre-allocate vectors with exact size to avoid reallocation
-  std::vector<uint128_t> seeds(domainSize);
-  std::vector<int> bits(domainSize);
-  seeds[0] = root; // root seed
-  bits[0] = bit;   // root bit
-
-  // Pre-allocate CWs vector once and reuse
-  std::vector<CW> CWs(t);
-  uint128_t sCW;
-  int tCW0, tCW1;
-
-  uint128_t sL, sR;
-  int tL, tR;
-
-  // recover CSs
-  uint128_t cs[4 * t];
-  uint128_t pi[4 * t];
-  uint128_t hashinput[mmo_hash1->outblocks];
-  memcpy(cs, &k[HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize],
-         16 * (mmo_hash1->outblocks) * t);
-  memcpy(pi, &k[HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize],
-         16 * (mmo_hash1->outblocks) * t);
-
-  // Pre-allocate next vectors to avoid repeated allocation
-  std::vector<uint128_t> nextSeeds(domainSize);
-  std::vector<int> nextBits(domainSize);
-
-  for (int i = 1; i <= size; i++) {
-    // Load CWs for this layer - reuse the same vector
-    for (int j = 0; j < t; j++) {
-      int offset = HEAD_SIZE + ((i - 1) * t + j) * DMPF_CW_SIZE;
-      memcpy(&sCW, &k[offset], 16);
-      memcpy(&tCW0, &k[offset + 16], 4);
-      memcpy(&tCW1, &k[offset + 20], 4);
-      CWs[j] = std::make_tuple(sCW, tCW0, tCW1);
+  // Splits the blocks among the workers. Proofs are handed over in rounds
+  // of about PARALLEL_PROOF_BYTES, with blocks small enough that every
+  // worker gets a few per round.
+  template <int T, int W>
+  static void runWorkers(EVP_CIPHER_CTX *ctx, const BigStateKey &key,
+                         const LastCWTable *table, uint8_t *out, uint64_t hi,
+                         Proof &proof) {
+    int maxBlockLevels = 30;
+    uint64_t roundLeaves = 1ULL << key.depth;
+    if (proof.leafBytes()) {
+      roundLeaves = std::max<uint64_t>(
+          1, PARALLEL_PROOF_BYTES / proof.leafBytes());
+      uint64_t workerLeaves =
+          roundLeaves / (4 * (uint64_t)getFullDomainThreads(ctx));
+      maxBlockLevels = 0;
+      while (maxBlockLevels < 30 && (2ULL << maxBlockLevels) <= workerLeaves)
+        maxBlockLevels++;
     }
 
-    int prevLayerSize = 1 << (i - 1);
-    for (int j = 0; j < prevLayerSize; j++) {
-      dmpfPRG(ctx, t, seeds[j], &sL, &sR, &tL, &tR);
-      auto [sCW, tCW0, tCW1] = bigStateCorrect(t, bits[j], CWs);
-
-      nextSeeds[2 * j] = sL ^ sCW;
-      nextSeeds[2 * j + 1] = sR ^ sCW;
-      nextBits[2 * j] = tL ^ tCW0;
-      nextBits[2 * j + 1] = tR ^ tCW1;
+    // the shape of the blocks, as every worker's traversal will see it
+    int blockLevels =
+        std::min({key.depth, getBigStateBlockLevels(ctx), maxBlockLevels});
+    uint64_t blockLeaves = 1ULL << blockLevels;
+    uint64_t leafHi = ((hi - 1) >> key.packBits) + 1;
+    uint64_t blocks = (leafHi - 1) / blockLeaves + 1;
+    uint64_t roundBlocks =
+        std::min(blocks, std::max<uint64_t>(1, roundLeaves / blockLeaves));
+
+    for (uint64_t first = 0; first < blocks; first += roundBlocks) {
+      uint64_t last = std::min(blocks, first + roundBlocks);
+      proof.beginRound(first * blockLeaves, (last - first) * blockLeaves);
+      parallelBlocks(ctx, first, last, [&](EVP_CIPHER_CTX *workerCtx) {
+        return [&, workerCtx,
+                tree = BigStateTraversal<T>(workerCtx, key.k + HEAD_SIZE,
+                                            key.depth, key.t, key.root,
+                                            key.rootBit, maxBlockLevels),
+                worker = typename Proof::Worker(proof),
+                blockOut = BlockOut(out, hi * key.dataSize,
+                                    blockLeaves * key.leafSize)](
+                   uint64_t b) mutable {
+          convertBlock<T, W>(workerCtx, key, tree, table, b,
+                             blockOut.begin(b), worker);
+          blockOut.end(b);
+        };
+      });
+      proof.endRound();
     }
+  }
+};
+
+// Calls Fn::run<T, W> with the instantiation for t points and width-byte
+// leaves; shapes without one use the run-time loops (T or W = 0)
+template <typename Fn, int T, typename... Args>
+static inline void dispatchBigStateWidth(int width, Args &&...args) {
+  switch (width) {
+  case 4:
+    Fn::template run<T, 4>(std::forward<Args>(args)...);
+    break;
+  case 8:
+    Fn::template run<T, 8>(std::forward<Args>(args)...);
+    break;
+  case 16:
+    Fn::template run<T, 16>(std::forward<Args>(args)...);
+    break;
+  case 32:
+    Fn::template run<T, 32>(std::forward<Args>(args)...);
+    break;
+  default:
+    Fn::template run<T, 0>(std::forward<Args>(args)...);
+  }
+}
 
-    // Swap vectors instead of move to avoid deallocation
-    seeds.swap(nextSeeds);
-    bits.swap(nextBits);
+template <typename Fn, typename... Args>
+static inline void dispatchBigState(int t, int width, Args &&...args) {
+  switch (t) {
+  case 1:
+    dispatchBigStateWidth<Fn, 1>(width, std::forward<Args>(args)...);
+    break;
+  case 2:
+    dispatchBigStateWidth<Fn, 2>(width, std::forward<Args>(args)...);
+    break;
+  case 4:
+    dispatchBigStateWidth<Fn, 4>(width, std::forward<Args>(args)...);
+    break;
+  case 8:
+    dispatchBigStateWidth<Fn, 8>(width, std::forward<Args>(args)...);
+    break;
+  case 16:
+    dispatchBigStateWidth<Fn, 16>(width, std::forward<Args>(args)...);
+    break;
+  case 32:
+    dispatchBigStateWidth<Fn, 32>(width, std::forward<Args>(args)...);
+    break;
+  default:
+    dispatchBigStateWidth<Fn, 0>(width, std::forward<Args>(args)...);
   }
+}
 
-  // Pre-allocate zeros buffer once
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  if (!zeros) {
-    std::cerr << "Failed to allocate memory for zeros" << std::endl;
+void evalBigStateDMPF(EVP_CIPHER_CTX *ctx, uint64_t index, int dataSize,
+                      uint8_t *dataShare, uint8_t *k) {
+  if (!checkKeyPRG(ctx, k[HEAD_SIZE - 1]))
     return;
-  }
-  memset(zeros, 0, dataSize + 16);
-  memset(out, 0, domainSize * dataSize); // Initialize out with zeros
-
-  // Pre-allocate a single EVP_CIPHER_CTX and reuse it
-  EVP_CIPHER_CTX *seedCtx = EVP_CIPHER_CTX_new();
-  if (!seedCtx) {
-    printf("errors occurred in creating context\n");
-    free(zeros);
+  if (k[HEAD_SIZE - 1] & KEY_ARITY_MASK) {
+    evalKaryBigStateDMPF(ctx, index, dataSize, dataShare, k);
     return;
   }
 
-  int len = 0;
-  for (int i = 0; i < domainSize; i++) {
-    // Reset context for each iteration instead of creating new one
-    EVP_CIPHER_CTX_reset(seedCtx);
+  BigStateKey key = parseBigStateKey(k, dataSize);
+  NoProof proof;
+  dispatchBigState<BigStateEval<NoProof>>(key.t, key.leafSize, ctx, key,
+                                          index, dataShare, proof);
+}
 
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds[i], NULL)) {
-      printf("errors occurred in init of dpf eval\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
-    }
-    if (1 !=
-        EVP_EncryptUpdate(seedCtx, out + i * dataSize, &len, zeros, dataSize)) {
-      printf("errors occurred in encrypt\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
-    }
+void evalBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                       struct Hash *mmo_hash2, uint64_t index, int dataSize,
+                       uint8_t *dataShare, uint8_t *proof, uint8_t *k) {
+  if (!checkVerifiableKey(ctx, k[HEAD_SIZE - 1], dataShare, dataSize,
+                          proof))
+    return;
+  BigStateKey key = parseBigStateKey(k, dataSize);
+  MMOProof mmoProof(mmo_hash1, mmo_hash2, key);
+  dispatchBigState<BigStateEval<MMOProof>>(key.t, key.leafSize, ctx, key,
+                                           index, dataShare, mmoProof);
+  mmoProof.finish(proof);
+}
 
-    // Apply correction words - cache the offset calculation
-    uint8_t *outPtr = out + i * dataSize;
-    for (int j = 0; j < t; j++) {
-      if (getbit(bits[i], t, j + 1) == 1) {
-        uint8_t *cwPtr = k + cwOffset + j * dataSize;
-        for (int l = 0; l < dataSize; l++) {
-          outPtr[l] ^= cwPtr[l];
-        }
-      }
-    }
+void fullDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k, int dataSize,
+                            uint8_t *out) {
+  truncatedDomainBigStateDMPF(ctx, k, dataSize, 1ULL << k[0], out);
+}
 
-    // *********************************
-    // START: verification code
-    // *********************************
+void truncatedDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                 int dataSize, uint64_t domainSize,
+                                 uint8_t *out) {
+  if (domainSize == 0 || domainSize > (1ULL << k[0])) {
+    std::cerr << "Error: invalid domain size " << domainSize << std::endl;
+    return;
+  }
+  if (!checkKeyPRG(ctx, k[HEAD_SIZE - 1]))
+    return;
 
-    int bit = seed_lsb(seeds[i]);
+  if (k[HEAD_SIZE - 1] & KEY_ARITY_MASK) {
+    fullDomainKaryBigStateDMPF(ctx, k, dataSize, out, nullptr, 0, domainSize);
+    return;
+  }
 
-    for (int j = 0; j < t; j++) {
-      uint128_t tpi[mmo_hash1->outblocks];
-      uint128_t cpi[mmo_hash1->outblocks];
+  BigStateKey key = parseBigStateKey(k, dataSize);
+  NoProof proof;
+  dispatchBigState<BigStateFullDomain<NoProof>>(
+      key.t, key.leafSize, ctx, key, out, nullptr, 0, domainSize, proof);
+}
 
-      hashinput[0] = i;
-      hashinput[1] = seeds[i];
-      hashinput[2] = 0;
-      hashinput[3] = 0;
+// Streams the blocks of a DMPF key that cover points [lo, hi)
+static void streamBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                               int dataSize, DPFChunkStream *stream,
+                               uint64_t lo, uint64_t hi) {
+  if (!checkKeyPRG(ctx, k[HEAD_SIZE - 1]))
+    return;
+  if (k[HEAD_SIZE - 1] & KEY_ARITY_MASK) {
+    fullDomainKaryBigStateDMPF(ctx, k, dataSize, nullptr, stream, lo, hi);
+    return;
+  }
 
-      mmoHash2to4(mmo_hash1, (uint8_t *)&hashinput[0], (uint8_t *)&tpi);
+  BigStateKey key = parseBigStateKey(k, dataSize);
+  NoProof proof;
+  dispatchBigState<BigStateFullDomain<NoProof>>(
+      key.t, key.leafSize, ctx, key, nullptr, stream, lo, hi, proof);
+}
 
-      hashinput[0] = pi[j * 4] ^ correct(tpi[0], cs[j * 4], bit);
-      hashinput[1] = pi[j * 4 + 1] ^ correct(tpi[1], cs[j * 4 + 1], bit);
-      hashinput[2] = pi[j * 4 + 2] ^ correct(tpi[2], cs[j * 4 + 2], bit);
-      hashinput[3] = pi[j * 4 + 3] ^ correct(tpi[3], cs[j * 4 + 3], bit);
+void fullDomainBigStateDMPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                  int dataSize, uint64_t chunkSize,
+                                  DPFChunkFn visit, void *user) {
+  DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  streamBigStateDMPF(ctx, k, dataSize, &stream, 0, 1ULL << k[0]);
+  chunkStreamFinish(&stream);
+}
 
-      mmoHash2to4(mmo_hash2, (uint8_t *)&hashinput[0], (uint8_t *)&cpi);
+void truncatedDomainBigStateDMPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                       int dataSize, uint64_t domainSize,
+                                       uint64_t chunkSize, DPFChunkFn visit,
+                                       void *user) {
+  if (domainSize == 0 || domainSize > (1ULL << k[0])) {
+    std::cerr << "Error: invalid domain size " << domainSize << std::endl;
+    return;
+  }
 
-      pi[j * 4] ^= cpi[0];
-      pi[j * 4 + 1] ^= cpi[1];
-      pi[j * 4 + 2] ^= cpi[2];
-      pi[j * 4 + 3] ^= cpi[3];
-    }
+  DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  stream.end = domainSize;
+  streamBigStateDMPF(ctx, k, dataSize, &stream, 0, domainSize);
+  chunkStreamFinish(&stream);
+}
 
-    // *********************************
-    // END: verification code
-    // *********************************
+void evalRangeBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                           int dataSize, uint64_t lo, uint64_t hi,
+                           uint8_t *out) {
+  if (lo >= hi || hi > (1ULL << k[0])) {
+    std::cerr << "Error: invalid range [" << lo << ", " << hi << ")"
+              << std::endl;
+    return;
   }
 
-  // VDPF output hash (just SHA256 of pi)
-  uint8_t hash[32];
-  sha_256_init(&sha_256, hash);
-  sha_256_write(&sha_256, (uint8_t *)&pi[0], sizeof(uint128_t) * 4 * t);
-  sha_256_close(&sha_256);
-  memcpy(proof, hash, sizeof(uint8_t) * 32);
-  EVP_CIPHER_CTX_free(seedCtx);
-  free(zeros);
+  // every block comes through the stream whole and the visitor keeps the
+  // part inside the range
+  DPFRangeOut range = {out, lo, hi, dataSize};
+  DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, 1ULL << BIGSTATE_BLOCK_LEVELS,
+                       copyRangeChunk, &range))
+    return;
+  streamBigStateDMPF(ctx, k, dataSize, &stream, lo, hi);
+  chunkStreamFinish(&stream);
+}
+
+void fullDomainBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                             struct Hash *mmo_hash2, int dataSize, uint8_t *k,
+                             uint8_t *out, uint8_t *proof) {
+  if (!checkVerifiableKey(ctx, k[HEAD_SIZE - 1], out,
+                          (1ULL << k[0]) * dataSize, proof))
+    return;
+  BigStateKey key = parseBigStateKey(k, dataSize);
+  MMOProof mmoProof(mmo_hash1, mmo_hash2, key);
+  dispatchBigState<BigStateFullDomain<MMOProof>>(key.t, key.leafSize, ctx,
+                                                 key, out, nullptr, 0,
+                                                 1ULL << key.size, mmoProof);
+  mmoProof.finish(proof);
+}
+
+void fullDomainBigStateVDMPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                                   struct Hash *mmo_hash2, int dataSize,
+                                   uint8_t *k, uint64_t chunkSize,
+                                   DPFChunkFn visit, void *user,
+                                   uint8_t *proof) {
+  if (!checkVerifiableKey(ctx, k[HEAD_SIZE - 1], nullptr, 0, proof))
+    return;
+  DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  BigStateKey key = parseBigStateKey(k, dataSize);
+  MMOProof mmoProof(mmo_hash1, mmo_hash2, key);
+  dispatchBigState<BigStateFullDomain<MMOProof>>(key.t, key.leafSize, ctx,
+                                                 key, nullptr, &stream, 0,
+                                                 1ULL << key.size, mmoProof);
+  chunkStreamFinish(&stream);
+  mmoProof.finish(proof);
 }
 
 void BigStateCompress(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
                       int dataSize, uint8_t *data, uint8_t *key) {
+  if (getKeyFlags(ctx) & KEY_PRG_MASK) {
+    std::cerr << "Error: compressed DMPF keys only support the AES PRG"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   // Generate the big state DMPF keys
   uint8_t *k0 =
       (uint8_t *)malloc(HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize);
   uint8_t *k1 =
       (uint8_t *)malloc(HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize);
 
-  genBigStateDMPF(ctx, t, size, index, dataSize, data, k0, k1);
+  // compressed keys only have room for the leaf conversion mode
+  genBigStateDMPFWithFlags(ctx, getKeyFlags(ctx) & KEY_FLAG_FIXED_KEY_LEAF, t,
+                           size, index, dataSize, data, k0, k1);
 
   // Generate compressed keys
   int compressedSize = (CWSIZE + 16) + size * t * DMPF_CW_SIZE + t * dataSize;
-  key[0] = size;
+  uint8_t flags = k0[HEAD_SIZE - 1] & KEY_FLAG_FIXED_KEY_LEAF;
+  key[0] = size | (flags << COMPRESSED_FLAG_SHIFT);
   key[1] = t;
   memcpy(&key[2], &k0[2], 16);
   memcpy(&key[18], &k1[2], 16);
@@ -1175,181 +1549,361 @@ void BigStateCompress(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
   free(k1);
 }
 
-void BigStateDecompress(EVP_CIPHER_CTX *ctx, uint8_t *key, int dataSize,
-                        uint8_t *out) {
-  // Extract size and t from the key
-  int size = key[0];
-  int t = key[1];
+struct BigStateDecompressFn {
+  template <int T, int W>
+  static void run(EVP_CIPHER_CTX *ctx, uint8_t *key, int size, int t,
+                  int dataSize, uint8_t flags, uint8_t *out) {
+    const int w = W ? W : dataSize;
+    uint64_t domainSize = 1ULL << size;
+    // 34 = 2 + 16 + 16 (size, t, root0, root1)
+    const uint8_t *cwArea = key + 34;
+    const uint8_t *lastCWs = cwArea + size * t * DMPF_CW_SIZE;
+
+    uint128_t root0, root1;
+    memcpy(&root0, &key[2], 16);
+    memcpy(&root1, &key[18], 16);
+
+    LastCWTable table;
+    bool useTable = table.build(ctx, t, w, lastCWs, domainSize);
+    const LastCWTable *lastCWTable = useTable ? &table : nullptr;
+
+    // Traverse both trees from their roots block by block in lockstep; with
+    // several threads every worker has its own pair of traversals
+    if (getFullDomainThreads(ctx) > 1) {
+      uint64_t blocks =
+          1ULL << (size - std::min(size, getBigStateBlockLevels(ctx)));
+      parallelBlocks(ctx, 0, blocks, [&](EVP_CIPHER_CTX *workerCtx) {
+        return [&, workerCtx,
+                tree0 = BigStateTraversal<T>(workerCtx, cwArea, size, t,
+                                             root0, 0),
+                tree1 = BigStateTraversal<T>(workerCtx, cwArea, size, t,
+                                             root1, 1U << (t - 1)),
+                tempData = std::vector<uint8_t>(PRG_BATCH * w)](
+                   uint64_t b) mutable {
+          convertBlock<T, W>(workerCtx, tree0, tree1, lastCWTable, t, w, flags,
+                             lastCWs, b, tempData.data(), out);
+        };
+      });
+      return;
+    }
 
-  // Extract the root seeds from the key
-  uint128_t root0, root1;
-  memcpy(&root0, &key[2], 16);
-  memcpy(&root1, &key[18], 16);
-
-  // Pre-calculate constants
-  int domainSize = 1 << size;
-  int cwOffset =
-      34 + size * t * DMPF_CW_SIZE; // 34 = 2 + 16 + 16 (size, t, root0, root1)
-
-  // Pre-allocate vectors with exact size to avoid reallocation
-  std::vector<uint128_t> seeds0(domainSize);
-  std::vector<uint128_t> seeds1(domainSize);
-  std::vector<int> bits0(domainSize);
-  std::vector<int> bits1(domainSize);
-
-  // Initialize root seeds and bits
-  seeds0[0] = root0;
-  seeds1[0] = root1;
-  bits0[0] = 0;            // L
-  bits1[0] = 1 << (t - 1); // R
+    BigStateTraversal<T> tree0(ctx, cwArea, size, t, root0, 0); // L
+    BigStateTraversal<T> tree1(ctx, cwArea, size, t, root1,
+                               1U << (t - 1)); // R
 
-  // Pre-allocate CWs vector once and reuse
-  std::vector<CW> CWs(t);
-  uint128_t sCW;
-  int tCW0, tCW1;
+    uint8_t *tempData = (uint8_t *)malloc(PRG_BATCH * w);
+    if (!tempData) {
+      printf("errors occurred in memory allocation\n");
+      return;
+    }
+    for (uint64_t b = 0; b < tree0.blocks(); b++)
+      convertBlock<T, W>(ctx, tree0, tree1, lastCWTable, t, w, flags, lastCWs,
+                         b, tempData, out);
+    free(tempData);
+  }
 
-  uint128_t sL0, sR0, sL1, sR1;
-  int tL0, tR0, tL1, tR1;
+  // Converts the leaves of block b of tree 0 into out, and those of tree 1 a
+  // batch at a time through tempData (PRG_BATCH leaves), which is folded into
+  // out
+  template <int T, int W>
+  static void convertBlock(EVP_CIPHER_CTX *ctx, BigStateTraversal<T> &tree0,
+                           BigStateTraversal<T> &tree1,
+                           const LastCWTable *table, int t, int w,
+                           uint8_t flags, const uint8_t *lastCWs, uint64_t b,
+                           uint8_t *tempData, uint8_t *out) {
+    uint64_t blockLeaves = tree0.blockLeaves();
+    tree0.expand(b);
+    tree1.expand(b);
+    const BigState<T> *bits0 = tree0.leafBits();
+    const BigState<T> *bits1 = tree1.leafBits();
+    uint8_t *blockOut = out + b * blockLeaves * w;
+    leafConvert(ctx, flags, tree0.leafSeeds(), blockLeaves, w, blockOut);
+
+    for (uint64_t i = 0; i < blockLeaves; i += PRG_BATCH) {
+      int m = std::min((uint64_t)PRG_BATCH, blockLeaves - i);
+      leafConvert(ctx, flags, tree1.leafSeeds() + i, m, w, tempData);
+
+      for (int l = 0; l < m; l++) {
+        uint8_t *outPtr = blockOut + (i + l) * w;
+
+        // XOR the results from both seeds and the correction words, which
+        // cancel where the bits of both seeds agree, in one pass
+        const uint8_t *rows[33];
+        int state = bits0[i + l] ^ bits1[i + l];
+        rows[0] = tempData + l * w;
+        int n = 1;
+        if (table)
+          rows[n++] = table->row(state);
+        else
+          n += selectLastCWs(state, t, w, lastCWs, rows + 1);
+        xorRows(outPtr, rows, n, w);
+      }
+    }
+  }
+};
 
-  // Pre-allocate next vectors to avoid repeated allocation
-  std::vector<uint128_t> nextSeeds0(domainSize);
-  std::vector<uint128_t> nextSeeds1(domainSize);
-  std::vector<int> nextBits0(domainSize);
-  std::vector<int> nextBits1(domainSize);
+void BigStateDecompress(EVP_CIPHER_CTX *ctx, uint8_t *key, int dataSize,
+                        uint8_t *out) {
+  // Extract size, t and the key mode from the key
+  int size = key[0] & COMPRESSED_SIZE_MASK;
+  int t = key[1];
+  uint8_t flags = (key[0] >> COMPRESSED_FLAG_SHIFT) & KEY_FLAG_FIXED_KEY_LEAF;
+  // compressed keys are always made with the AES PRG
+  if (!checkKeyPRG(ctx, flags))
+    return;
 
-  for (int i = 1; i <= size; i++) {
-    // Load CWs for this layer - reuse the same vector
-    for (int j = 0; j < t; j++) {
-      int offset = 34 + ((i - 1) * t + j) * DMPF_CW_SIZE;
-      memcpy(&sCW, &key[offset], 16);
-      memcpy(&tCW0, &key[offset + 16], 4);
-      memcpy(&tCW1, &key[offset + 20], 4);
-      CWs[j] = std::make_tuple(sCW, tCW0, tCW1);
-    }
+  dispatchBigState<BigStateDecompressFn>(t, dataSize, ctx, key, size, t,
+                                         dataSize, flags, out);
+}
 
-    int prevLayerSize = 1 << (i - 1);
-    for (int j = 0; j < prevLayerSize; j++) {
-      // PRG for both seeds
-      dmpfPRG(ctx, t, seeds0[j], &sL0, &sR0, &tL0, &tR0);
-      dmpfPRG(ctx, t, seeds1[j], &sL1, &sR1, &tL1, &tR1);
-
-      // Correction for both seeds
-      auto [sCW0, tCW0Left, tCW0Right] = bigStateCorrect(t, bits0[j], CWs);
-      auto [sCW1, tCW1Left, tCW1Right] = bigStateCorrect(t, bits1[j], CWs);
-
-      // Update next layer for both seeds
-      nextSeeds0[2 * j] = sL0 ^ sCW0;
-      nextSeeds0[2 * j + 1] = sR0 ^ sCW0;
-      nextBits0[2 * j] = tL0 ^ tCW0Left;
-      nextBits0[2 * j + 1] = tR0 ^ tCW0Right;
-
-      nextSeeds1[2 * j] = sL1 ^ sCW1;
-      nextSeeds1[2 * j + 1] = sR1 ^ sCW1;
-      nextBits1[2 * j] = tL1 ^ tCW1Left;
-      nextBits1[2 * j + 1] = tR1 ^ tCW1Right;
-    }
+int karyBigStateDMPFKeySize(int arity, int t, int size, int dataSize) {
+  int arityBits = karyArityBits(arity);
+  if (arityBits == 0)
+    return -1;
+  if (arityBits == 1)
+    return HEAD_SIZE + size * t * DMPF_CW_SIZE + t * dataSize;
+
+  int cws = 0;
+  for (int l = 0; l < karyLevels(size, arityBits); l++)
+    cws += t << karyLevelBits(size, arityBits, l);
+  return HEAD_SIZE + cws * DMPF_KARY_CW_SIZE + t * dataSize;
+}
 
-    // Swap vectors instead of move to avoid deallocation
-    seeds0.swap(nextSeeds0);
-    seeds1.swap(nextSeeds1);
-    bits0.swap(nextBits0);
-    bits1.swap(nextBits1);
+// XOR of the per-child correction words selected by the set bits of state.
+// levelCWs holds t rows of `arity` (sCW, tCW) pairs, row d belonging to the
+// d-th tracked node (bit t - 1 - d of the state).
+static inline void karyBigStateCorrect(int t, int state, int arity,
+                                       const unsigned char *levelCWs,
+                                       int child, uint128_t *sCW, int *tCW) {
+  *sCW = 0;
+  *tCW = 0;
+  for (int d = 0; d < t; d++) {
+    int bit = getbit(state, t, d + 1);
+    const unsigned char *cw = levelCWs + (d * arity + child) * DMPF_KARY_CW_SIZE;
+    uint128_t s;
+    int tw;
+    memcpy(&s, cw, 16);
+    memcpy(&tw, cw + 16, 4);
+    *sCW ^= s & bitMask(bit);
+    *tCW ^= tw & -bit;
   }
+}
 
-  // Pre-allocate zeros buffer once
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  if (!zeros) {
-    std::cerr << "Failed to allocate memory for zeros" << std::endl;
-    return;
+void genKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, int arity, int t, int size,
+                         uint64_t *index, int dataSize, uint8_t *data,
+                         uint8_t *k0, uint8_t *k1) {
+  int arityBits = karyArityBits(arity);
+  if (arityBits == 0) {
+    std::cerr << "Error: unsupported arity " << arity << std::endl;
+    exit(EXIT_FAILURE);
   }
-  memset(zeros, 0, dataSize + 16);
-  memset(out, 0, domainSize * dataSize); // Initialize out with zeros
-
-  // Pre-allocate a single EVP_CIPHER_CTX and reuse it
-  EVP_CIPHER_CTX *seedCtx = EVP_CIPHER_CTX_new();
-  if (!seedCtx) {
-    printf("errors occurred in creating context\n");
-    free(zeros);
+  if (arityBits == 1) {
+    genBigStateDMPF(ctx, t, size, index, dataSize, data, k0, k1);
     return;
   }
 
-  int len = 0;
-  for (int i = 0; i < domainSize; i++) {
-    // Reset context for each iteration instead of creating new one
-    EVP_CIPHER_CTX_reset(seedCtx);
+  for (int i = 0; i < t - 1; i++) {
+    if (index[i] >= index[i + 1]) {
+      std::cerr << "Error: index[" << i << "] >= index[" << i + 1 << "]"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
 
-    // Generate data for both seeds
-    uint8_t *outPtr = out + i * dataSize;
+  int levels = karyLevels(size, arityBits);
+  uint8_t flags = (getKeyFlags(ctx) & ~KEY_FLAG_PACKED_LEAVES) |
+                  ((arityBits - 1) << KEY_ARITY_SHIFT);
+
+  // the tracked nodes of a level are the distinct prefixes of the indices,
+  // in increasing order; a node's rank is its position in that list
+  std::vector<std::vector<uint64_t>> prefixes(levels + 1);
+  prefixes[0].push_back(0);
+  int consumed = 0;
+  for (int l = 0; l < levels; l++) {
+    consumed += karyLevelBits(size, arityBits, l);
+    for (int j = 0; j < t; j++)
+      prefixes[l + 1].push_back(index[j] >> (size - consumed));
+    prefixes[l + 1].erase(
+        std::unique(prefixes[l + 1].begin(), prefixes[l + 1].end()),
+        prefixes[l + 1].end());
+  }
 
-    // Generate data for seed0
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds0[i], NULL)) {
-      printf("errors occurred in init of dpf eval\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
-    }
-    if (1 != EVP_EncryptUpdate(seedCtx, outPtr, &len, zeros, dataSize)) {
-      printf("errors occurred in encrypt\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
-    }
+  uint128_t root0 = getRandomBlock();
+  uint128_t root1 = getRandomBlock();
+  std::vector<uint128_t> seeds0(1, root0), seeds1(1, root1);
+  std::vector<int> bits0(1, 0), bits1(1, 1 << (t - 1));
 
-    // Apply correction words for seed0
-    for (int j = 0; j < t; j++) {
-      if (getbit(bits0[i], t, j + 1) == 1) {
-        uint8_t *cwPtr = key + cwOffset + j * dataSize;
-        for (int l = 0; l < dataSize; l++) {
-          outPtr[l] ^= cwPtr[l];
+  k0[0] = size;
+  k0[1] = t;
+  memcpy(&k0[2], &root0, 16);
+  k0[HEAD_SIZE - 1] = 0 | flags;
+
+  unsigned char *levelCWs = k0 + HEAD_SIZE;
+  for (int l = 0; l < levels; l++) {
+    int levelBits = karyLevelBits(size, arityBits, l);
+    int width = 1 << levelBits;
+    const std::vector<uint64_t> &prev = prefixes[l];
+    const std::vector<uint64_t> &next = prefixes[l + 1];
+    size_t n = prev.size();
+
+    std::vector<uint128_t> children0(n * width), children1(n * width);
+    std::vector<int> childBits0(n * width), childBits1(n * width);
+    karyPRGBatch(ctx, levelBits, t, seeds0.data(), n, children0.data(),
+                 childBits0.data());
+    karyPRGBatch(ctx, levelBits, t, seeds1.data(), n, children1.data(),
+                 childBits1.data());
+
+    // one CW per child of every tracked node; rows of unused ranks stay zero
+    memset(levelCWs, 0, t * width * DMPF_KARY_CW_SIZE);
+    for (size_t j = 0; j < n; j++) {
+      for (int c = 0; c < width; c++) {
+        size_t idx = j * width + c;
+        auto it = std::lower_bound(next.begin(), next.end(),
+                                   (prev[j] << levelBits) + c);
+        bool tracked = it != next.end() && *it == (prev[j] << levelBits) + c;
+
+        uint128_t sCW;
+        int tCW = childBits0[idx] ^ childBits1[idx];
+        if (tracked) {
+          sCW = set_lsb_zero(getRandomBlock());
+          tCW ^= 1 << (t - 1 - std::distance(next.begin(), it));
+        } else {
+          sCW = children0[idx] ^ children1[idx];
         }
+        unsigned char *cw = levelCWs + (j * width + c) * DMPF_KARY_CW_SIZE;
+        memcpy(cw, &sCW, 16);
+        memcpy(cw + 16, &tCW, 4);
       }
     }
 
-    // Generate data for seed1 and XOR with seed0 result
-    EVP_CIPHER_CTX_reset(seedCtx);
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds1[i], NULL)) {
-      printf("errors occurred in init of dpf eval\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
+    std::vector<uint128_t> nextSeeds0(next.size()), nextSeeds1(next.size());
+    std::vector<int> nextBits0(next.size()), nextBits1(next.size());
+    for (size_t d = 0; d < next.size(); d++) {
+      size_t j = std::lower_bound(prev.begin(), prev.end(),
+                                  next[d] >> levelBits) -
+                 prev.begin();
+      int c = next[d] & (width - 1);
+      size_t idx = j * width + c;
+
+      uint128_t sCW;
+      int tCW;
+      karyBigStateCorrect(t, bits0[j], width, levelCWs, c, &sCW, &tCW);
+      nextSeeds0[d] = children0[idx] ^ sCW;
+      nextBits0[d] = childBits0[idx] ^ tCW;
+      karyBigStateCorrect(t, bits1[j], width, levelCWs, c, &sCW, &tCW);
+      nextSeeds1[d] = children1[idx] ^ sCW;
+      nextBits1[d] = childBits1[idx] ^ tCW;
     }
 
-    uint8_t *tempData = (uint8_t *)malloc(dataSize);
-    if (!tempData) {
-      printf("errors occurred in memory allocation\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      return;
-    }
+    seeds0.swap(nextSeeds0);
+    seeds1.swap(nextSeeds1);
+    bits0.swap(nextBits0);
+    bits1.swap(nextBits1);
+    levelCWs += t * width * DMPF_KARY_CW_SIZE;
+  }
 
-    if (1 != EVP_EncryptUpdate(seedCtx, tempData, &len, zeros, dataSize)) {
-      printf("errors occurred in encrypt\n");
-      EVP_CIPHER_CTX_free(seedCtx);
-      free(zeros);
-      free(tempData);
-      return;
-    }
+  // levelCWs now points at the last CWs
+  uint8_t *convert0 = (uint8_t *)malloc(t * dataSize);
+  uint8_t *convert1 = (uint8_t *)malloc(t * dataSize);
+  leafConvert(ctx, flags, seeds0.data(), t, dataSize, convert0);
+  leafConvert(ctx, flags, seeds1.data(), t, dataSize, convert1);
+  for (int i = 0; i < t * dataSize; i++)
+    levelCWs[i] = data[i] ^ convert0[i] ^ convert1[i];
+  free(convert0);
+  free(convert1);
+
+  memcpy(k1, k0, karyBigStateDMPFKeySize(arity, t, size, dataSize));
+  memcpy(&k1[2], &root1, 16);
+  k1[HEAD_SIZE - 1] = 1 | flags;
+}
 
-    // Apply correction words for seed1
-    for (int j = 0; j < t; j++) {
-      if (getbit(bits1[i], t, j + 1) == 1) {
-        uint8_t *cwPtr = key + cwOffset + j * dataSize;
-        for (int l = 0; l < dataSize; l++) {
-          tempData[l] ^= cwPtr[l];
-        }
-      }
-    }
+// Parses a higher-arity DMPF key header; returns the offset of the last CWs
+static int parseKaryBigStateDMPF(unsigned char *k, int *size, int *t,
+                                 int *arityBits, uint128_t *root, int *bit,
+                                 uint8_t *flags) {
+  *size = k[0];
+  *t = k[1];
+  *arityBits = ((k[HEAD_SIZE - 1] & KEY_ARITY_MASK) >> KEY_ARITY_SHIFT) + 1;
+  memcpy(root, &k[2], 16);
+  *bit = (k[HEAD_SIZE - 1] & KEY_CONTROL_BIT) ? 1 << (*t - 1) : 0;
+  *flags = k[HEAD_SIZE - 1] & ~KEY_CONTROL_BIT;
+  return karyBigStateDMPFKeySize(1 << *arityBits, *t, *size, 0);
+}
 
-    // XOR the results from both seeds
-    for (int l = 0; l < dataSize; l++) {
-      outPtr[l] ^= tempData[l];
-    }
+// Applies the last CWs selected by the t-bit state to a converted leaf
+static inline void karyBigStateLeaf(int t, int state, const uint8_t *lastCWs,
+                                    int dataSize, uint8_t *out) {
+  for (int i = 0; i < t; i++)
+    xorIfSet(out, lastCWs + i * dataSize, dataSize, getbit(state, t, i + 1));
+}
 
-    free(tempData);
+// Single-point evaluation only computes the child on the path: one AES call
+// per level, size / log2(arity) levels
+static void evalKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, uint64_t index,
+                                 int dataSize, uint8_t *dataShare,
+                                 uint8_t *k) {
+  int size, t, arityBits, bit;
+  uint128_t seed;
+  uint8_t flags;
+  int lastCW =
+      parseKaryBigStateDMPF(k, &size, &t, &arityBits, &seed, &bit, &flags);
+
+  const unsigned char *levelCWs = k + HEAD_SIZE;
+  int remaining = size;
+  for (int l = 0; l < karyLevels(size, arityBits); l++) {
+    int levelBits = karyLevelBits(size, arityBits, l);
+    int width = 1 << levelBits;
+    remaining -= levelBits;
+    int digit = (index >> remaining) & (width - 1);
+
+    int childBits;
+    uint128_t sCW;
+    int tCW;
+    karyPRG(ctx, levelBits, t, seed, digit, &seed, &childBits);
+    karyBigStateCorrect(t, bit, width, levelCWs, digit, &sCW, &tCW);
+    seed ^= sCW;
+    bit = childBits ^ tCW;
+    levelCWs += t * width * DMPF_KARY_CW_SIZE;
   }
 
-  EVP_CIPHER_CTX_free(seedCtx);
-  free(zeros);
-}
\ No newline at end of file
+  leafConvert(ctx, flags, &seed, 1, dataSize, dataShare);
+  karyBigStateLeaf(t, bit, k + lastCW, dataSize, dataShare);
+}
+
+// Per-child CWs that the t-bit state of a parent selects on one level
+static void karyBigStateLevelCW(const KaryTree *tree, int level, int bits,
+                                uint128_t *sCW, int *tCW) {
+  int arity = 1 << karyLevelBits(tree->size, tree->arityBits, level);
+  for (int c = 0; c < arity; c++)
+    karyBigStateCorrect(tree->t, bits, arity, tree->levelCWs[level], c,
+                        &sCW[c], &tCW[c]);
+}
+
+// Parses a higher-arity DMPF key for karyFullDomain
+static void karyBigStateTree(unsigned char *k, KaryTree *tree) {
+  int size, t, arityBits, bit;
+  int lastCW = parseKaryBigStateDMPF(k, &size, &t, &arityBits, &tree->root,
+                                     &bit, &tree->flags);
+  tree->size = size;
+  tree->t = t;
+  tree->arityBits = arityBits;
+  tree->rootBits = bit;
+  tree->lastCWs = k + lastCW;
+  tree->levelCW = karyBigStateLevelCW;
+
+  const unsigned char *levelCWs = k + HEAD_SIZE;
+  for (int l = 0; l < karyLevels(size, arityBits); l++) {
+    tree->levelCWs[l] = levelCWs;
+    levelCWs += t * (1 << karyLevelBits(size, arityBits, l)) * DMPF_KARY_CW_SIZE;
+  }
+}
+
+// Full-domain evaluation in blocks of whole levels, like the binary tree
+static void fullDomainKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                       int dataSize, uint8_t *out,
+                                       DPFChunkStream *stream, uint64_t lo,
+                                       uint64_t hi) {
+  KaryTree tree;
+  karyBigStateTree(k, &tree);
+  karyFullDomain(ctx, &tree, dataSize, out, stream, lo, hi);
+}
@@ -0,0 +1,220 @@
+// ChaCha8/ChaCha12 PRG backend. The portable kernels run anywhere; the AVX2
+// kernels evaluate eight blocks at once with one block per 32-bit lane and
+// are compiled with target attributes like the AES kernels in aes.c.
+
+#include "../include/chacha.h"
+
+#include <string.h>
+
+// "expand 16-byte k"
+static const uint32_t sigma16[4] = {0x61707865, 0x3120646e, 0x79622d36,
+                                    0x6b206574};
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(x, a, b, c, d)                                            \
+  x[a] += x[b];                                                                \
+  x[d] = ROTL32(x[d] ^ x[a], 16);                                              \
+  x[c] += x[d];                                                                \
+  x[b] = ROTL32(x[b] ^ x[c], 12);                                              \
+  x[a] += x[b];                                                                \
+  x[d] = ROTL32(x[d] ^ x[a], 8);                                               \
+  x[c] += x[d];                                                                \
+  x[b] = ROTL32(x[b] ^ x[c], 7);
+
+// One ChaCha block: rounds double-rounds / 2 followed by the feed-forward
+static void chachaCore(const uint32_t in[16], uint32_t out[16], int rounds) {
+  uint32_t x[16];
+  memcpy(x, in, sizeof(x));
+  for (int r = 0; r < rounds; r += 2) {
+    QUARTERROUND(x, 0, 4, 8, 12)
+    QUARTERROUND(x, 1, 5, 9, 13)
+    QUARTERROUND(x, 2, 6, 10, 14)
+    QUARTERROUND(x, 3, 7, 11, 15)
+    QUARTERROUND(x, 0, 5, 10, 15)
+    QUARTERROUND(x, 1, 6, 11, 12)
+    QUARTERROUND(x, 2, 7, 8, 13)
+    QUARTERROUND(x, 3, 4, 9, 14)
+  }
+  for (int i = 0; i < 16; i++)
+    out[i] = x[i] + in[i];
+}
+
+// Fills the constant and key words of a block; the key is used twice
+static inline void chachaSetup(uint32_t state[16], const uint32_t key[4]) {
+  memcpy(&state[0], sigma16, 16);
+  memcpy(&state[4], key, 16);
+  memcpy(&state[8], key, 16);
+}
+
+void chachaExpandKey(const uint8_t *bytes, struct ChachaKey *key) {
+  memcpy(key->words, bytes, 16);
+}
+
+void chachaBlocks(const struct ChachaKey *key, int rounds,
+                  const uint128_t *in, uint128_t *out, size_t n) {
+  uint32_t state[16], block[16];
+  chachaSetup(state, key->words);
+  for (size_t i = 0; i < n; i++) {
+    memcpy(&state[12], &in[i], 16);
+    chachaCore(state, block, rounds);
+    memcpy(&out[i], block, 16);
+  }
+}
+
+void chachaStream(const uint128_t *keys, size_t n, int rounds, uint8_t *out,
+                  size_t len) {
+  uint32_t state[16], block[16];
+  for (size_t i = 0; i < n; i++) {
+    chachaSetup(state, (const uint32_t *)&keys[i]);
+    memset(&state[12], 0, 16);
+    for (size_t pos = 0; pos < len; pos += 64) {
+      state[12] = (uint32_t)(pos / 64);
+      chachaCore(state, block, rounds);
+      memcpy(out + i * len + pos, block, len - pos < 64 ? len - pos : 64);
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+int chachaAvx2Supported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#define ROTL256(v, n)                                                          \
+  _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define QUARTERROUND8(x, a, b, c, d)                                           \
+  x[a] = _mm256_add_epi32(x[a], x[b]);                                         \
+  x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot16);             \
+  x[c] = _mm256_add_epi32(x[c], x[d]);                                         \
+  x[b] = ROTL256(_mm256_xor_si256(x[b], x[c]), 12);                            \
+  x[a] = _mm256_add_epi32(x[a], x[b]);                                         \
+  x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot8);              \
+  x[c] = _mm256_add_epi32(x[c], x[d]);                                         \
+  x[b] = ROTL256(_mm256_xor_si256(x[b], x[c]), 7);
+
+// Eight ChaCha blocks, word i of block l in lane l of in[i]/out[i]
+__attribute__((target("avx2"))) static void
+chachaCore8(const __m256i in[16], __m256i out[16], int rounds) {
+  const __m256i rot16 =
+      _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2, 13,
+                      12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+  const __m256i rot8 =
+      _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3, 14,
+                      13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+  __m256i x[16];
+  for (int i = 0; i < 16; i++)
+    x[i] = in[i];
+  for (int r = 0; r < rounds; r += 2) {
+    QUARTERROUND8(x, 0, 4, 8, 12)
+    QUARTERROUND8(x, 1, 5, 9, 13)
+    QUARTERROUND8(x, 2, 6, 10, 14)
+    QUARTERROUND8(x, 3, 7, 11, 15)
+    QUARTERROUND8(x, 0, 5, 10, 15)
+    QUARTERROUND8(x, 1, 6, 11, 12)
+    QUARTERROUND8(x, 2, 7, 8, 13)
+    QUARTERROUND8(x, 3, 4, 9, 14)
+  }
+  for (int i = 0; i < 16; i++)
+    out[i] = _mm256_add_epi32(x[i], in[i]);
+}
+
+__attribute__((target("avx2"))) void
+chachaBlocksAvx2(const struct ChachaKey *key, int rounds, const uint128_t *in,
+                 uint128_t *out, size_t n) {
+  // word j of the 8 consecutive input blocks sits at 32-bit offsets 4l + j
+  const __m256i gather = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  __m256i state[16], block[16];
+  for (int i = 0; i < 4; i++) {
+    state[i] = _mm256_set1_epi32((int)sigma16[i]);
+    state[4 + i] = _mm256_set1_epi32((int)key->words[i]);
+    state[8 + i] = state[4 + i];
+  }
+
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int *words = (const int *)&in[i];
+    for (int j = 0; j < 4; j++)
+      state[12 + j] = _mm256_i32gather_epi32(words + j, gather, 4);
+    chachaCore8(state, block, rounds);
+
+    uint32_t lanes[4][8];
+    for (int j = 0; j < 4; j++)
+      _mm256_storeu_si256((__m256i *)lanes[j], block[j]);
+    uint32_t *outWords = (uint32_t *)&out[i];
+    for (int l = 0; l < 8; l++)
+      for (int j = 0; j < 4; j++)
+        outWords[4 * l + j] = lanes[j][l];
+  }
+  chachaBlocks(key, rounds, &in[i], &out[i], n - i);
+}
+
+__attribute__((target("avx2"))) void chachaStreamAvx2(const uint128_t *keys,
+                                                      size_t n, int rounds,
+                                                      uint8_t *out,
+                                                      size_t len) {
+  const __m256i gather = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  __m256i state[16], block[16];
+  for (int i = 0; i < 4; i++)
+    state[i] = _mm256_set1_epi32((int)sigma16[i]);
+  for (int i = 13; i < 16; i++)
+    state[i] = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int *words = (const int *)&keys[i];
+    for (int j = 0; j < 4; j++) {
+      state[4 + j] = _mm256_i32gather_epi32(words + j, gather, 4);
+      state[8 + j] = state[4 + j];
+    }
+    for (size_t pos = 0; pos < len; pos += 64) {
+      state[12] = _mm256_set1_epi32((int)(pos / 64));
+      chachaCore8(state, block, rounds);
+
+      uint32_t lanes[16][8];
+      for (int j = 0; j < 16; j++)
+        _mm256_storeu_si256((__m256i *)lanes[j], block[j]);
+      size_t m = len - pos < 64 ? len - pos : 64;
+      for (int l = 0; l < 8; l++) {
+        uint32_t laneWords[16];
+        for (int j = 0; j < 16; j++)
+          laneWords[j] = lanes[j][l];
+        memcpy(out + (i + l) * len + pos, laneWords, m);
+      }
+    }
+  }
+  chachaStream(&keys[i], n - i, rounds, out + i * len, len);
+}
+
+ChachaBlocksFn chachaBlocksKernel() {
+  return chachaAvx2Supported() ? chachaBlocksAvx2 : chachaBlocks;
+}
+
+ChachaStreamFn chachaStreamKernel() {
+  return chachaAvx2Supported() ? chachaStreamAvx2 : chachaStream;
+}
+
+#else
+
+int chachaAvx2Supported() { return 0; }
+
+void chachaBlocksAvx2(const struct ChachaKey *key, int rounds,
+                      const uint128_t *in, uint128_t *out, size_t n) {
+  chachaBlocks(key, rounds, in, out, n);
+}
+
+void chachaStreamAvx2(const uint128_t *keys, size_t n, int rounds,
+                      uint8_t *out, size_t len) {
+  chachaStream(keys, n, rounds, out, len);
+}
+
+ChachaBlocksFn chachaBlocksKernel() { return chachaBlocks; }
+
+ChachaStreamFn chachaStreamKernel() { return chachaStream; }
+
+#endif
@@ -1,4 +1,6 @@
 #include "../include/common.h"
+#include "../include/aes.h"
+#include "../include/chacha.h"
 #include "../include/dpf.h"
 #include "../include/mmo.h"
 
@@ -6,6 +8,23 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <pthread.h>
+
+// State attached to the PRF cipher context by getDPFContext
+struct DPFEngine {
+  uint8_t prfKey[16];   // the PRF key the context was made with
+  struct AesKey aesKey; // fixed-key schedule, expanded once
+  AesEncryptFn encrypt; // native kernel chosen at creation, NULL for EVP
+  struct ChachaKey chachaKey;  // the same PRF key for the ChaCha backends
+  ChachaBlocksFn chachaBlocks; // widest ChaCha kernels this CPU supports
+  ChachaStreamFn chachaStream;
+  uint8_t keyFlags; // mode flags (and PRG backend) recorded in new keys
+  size_t lastCWTableBytes; // budget for big-state subset-XOR tables
+  int bigStateBlockLevels; // subtree height of big-state full-domain blocks
+  int threads;             // full-domain workers, 1 = evaluate in the caller
+  DPFThreadPoolFn pool;    // external pool running them, NULL for pthreads
+  void *poolData;
+};
 
 EVP_CIPHER_CTX *getDPFContext(uint8_t *key) {
   EVP_CIPHER_CTX *randCtx;
@@ -14,38 +33,543 @@ EVP_CIPHER_CTX *getDPFContext(uint8_t *key) {
   if (1 != EVP_EncryptInit_ex(randCtx, EVP_aes_128_ecb(), NULL, key, NULL))
     printf("errors occured in randomness init\n");
   EVP_CIPHER_CTX_set_padding(randCtx, 0);
+
+  // attach the native key schedule, expanded once, and the widest AES kernel
+  // this CPU supports (VAES-512, VAES-256 or AES-NI)
+  struct DPFEngine *engine =
+      (struct DPFEngine *)malloc(sizeof(struct DPFEngine));
+  memcpy(engine->prfKey, key, 16);
+  engine->encrypt = aesEncryptKernel(aesDetectImpl());
+  if (engine->encrypt)
+    aesniExpandKey(key, &engine->aesKey);
+  chachaExpandKey(key, &engine->chachaKey);
+  engine->chachaBlocks = chachaBlocksKernel();
+  engine->chachaStream = chachaStreamKernel();
+  engine->keyFlags = 0;
+  engine->lastCWTableBytes = LASTCW_TABLE_BYTES;
+  engine->bigStateBlockLevels = BIGSTATE_BLOCK_LEVELS;
+  engine->threads = 1;
+  engine->pool = NULL;
+  engine->poolData = NULL;
+  EVP_CIPHER_CTX_set_app_data(randCtx, engine);
   return randCtx;
 }
 
-void destroyContext(EVP_CIPHER_CTX *ctx) { EVP_CIPHER_CTX_free(ctx); }
+void destroyContext(EVP_CIPHER_CTX *ctx) {
+  free(EVP_CIPHER_CTX_get_app_data(ctx));
+  EVP_CIPHER_CTX_free(ctx);
+}
 
-uint128_t getRandomBlock() {
-  static uint8_t *randKey = NULL;
-  static EVP_CIPHER_CTX *randCtx;
-  static uint128_t counter = 0;
+// Selects the key mode (KEY_FLAG_*) that key generation with this context
+// records in new keys. Evaluation always follows the flags found in the key.
+void setKeyFlags(EVP_CIPHER_CTX *ctx, uint8_t flags) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  if (engine)
+    engine->keyFlags =
+        (flags & ~(KEY_CONTROL_BIT | KEY_ARITY_MASK | KEY_PRG_MASK |
+                   KEY_FLAG_MMO_HASH)) |
+        (engine->keyFlags & KEY_PRG_MASK);
+}
+
+// Selects the PRG backend (KEY_PRG_*) used for tree expansion and leaf
+// conversion. Keys record the backend they were generated with and must be
+// evaluated with a context set to the same one.
+void setPRGBackend(EVP_CIPHER_CTX *ctx, int backend) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  if (backend != KEY_PRG_AES && backend != KEY_PRG_CHACHA8 &&
+      backend != KEY_PRG_CHACHA12) {
+    printf("unknown PRG backend %d\n", backend);
+    return;
+  }
+  if (engine)
+    engine->keyFlags = (engine->keyFlags & ~KEY_PRG_MASK) |
+                       (backend << KEY_PRG_SHIFT);
+}
+
+// ChaCha rounds of the backend recorded in flags, 0 for AES
+static inline int prgChachaRounds(uint8_t flags) {
+  switch ((flags & KEY_PRG_MASK) >> KEY_PRG_SHIFT) {
+  case KEY_PRG_CHACHA8:
+    return 8;
+  case KEY_PRG_CHACHA12:
+    return 12;
+  default:
+    return 0;
+  }
+}
+
+uint8_t getKeyFlags(EVP_CIPHER_CTX *ctx) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  return engine ? engine->keyFlags : 0;
+}
+
+void setLastCWTableBudget(EVP_CIPHER_CTX *ctx, size_t bytes) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  if (engine)
+    engine->lastCWTableBytes = bytes;
+}
+
+size_t getLastCWTableBudget(EVP_CIPHER_CTX *ctx) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  return engine ? engine->lastCWTableBytes : 0;
+}
+
+void setBigStateBlockLevels(EVP_CIPHER_CTX *ctx, int levels) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  if (levels < 0 || levels > 30) {
+    printf("invalid big-state block levels %d\n", levels);
+    return;
+  }
+  if (engine)
+    engine->bigStateBlockLevels = levels;
+}
+
+int getBigStateBlockLevels(EVP_CIPHER_CTX *ctx) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  return engine ? engine->bigStateBlockLevels : BIGSTATE_BLOCK_LEVELS;
+}
+
+void setFullDomainThreads(EVP_CIPHER_CTX *ctx, int threads) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  if (threads < 1) {
+    printf("invalid thread count %d\n", threads);
+    return;
+  }
+  if (engine)
+    engine->threads = threads;
+}
+
+int getFullDomainThreads(EVP_CIPHER_CTX *ctx) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  return engine ? engine->threads : 1;
+}
+
+void setThreadPool(EVP_CIPHER_CTX *ctx, DPFThreadPoolFn run, void *pool) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  if (engine) {
+    engine->pool = run;
+    engine->poolData = pool;
+  }
+}
+
+// Returns a new context with the same PRF key and settings as ctx, for a
+// worker thread: contexts hold cipher state and cannot be shared. The clone
+// evaluates on its own thread only.
+EVP_CIPHER_CTX *cloneDPFContext(EVP_CIPHER_CTX *ctx) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  EVP_CIPHER_CTX *clone = getDPFContext(engine->prfKey);
+  struct DPFEngine *cloneEngine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(clone);
+  cloneEngine->keyFlags = engine->keyFlags;
+  cloneEngine->lastCWTableBytes = engine->lastCWTableBytes;
+  cloneEngine->bigStateBlockLevels = engine->bigStateBlockLevels;
+  return clone;
+}
+
+struct ParallelJob {
+  void (*task)(void *arg, int i);
+  void *arg;
+  int n;
+  int next;
+};
+
+static void *parallelWorker(void *p) {
+  struct ParallelJob *job = (struct ParallelJob *)p;
+  int i;
+  while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n)
+    job->task(job->arg, i);
+  return NULL;
+}
+
+// Runs task(arg, i) for i in [0, getFullDomainThreads(ctx)) on the pool set
+// with setThreadPool, or else on that many threads, one of them the caller
+void runParallel(EVP_CIPHER_CTX *ctx, void (*task)(void *arg, int i),
+                 void *arg) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  int n = getFullDomainThreads(ctx);
+  if (engine && engine->pool) {
+    engine->pool(engine->poolData, n, task, arg);
+    return;
+  }
+
+  struct ParallelJob job = {task, arg, n, 0};
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * n);
+  int started = 0;
+  for (int i = 1; i < n; i++) {
+    if (pthread_create(&threads[started], NULL, parallelWorker, &job)) {
+      printf("errors occurred in creating worker threads\n");
+      break;
+    }
+    started++;
+  }
+  // the caller works too and picks up what threads that failed to start
+  // would have done
+  parallelWorker(&job);
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
+
+// Encrypts n blocks under the fixed PRF key held by ctx (AES-128-ECB).
+// Uses the native engine attached by getDPFContext if there is one and falls
+// back to EVP otherwise; both produce the same output. Contexts switched to a
+// ChaCha backend apply the fixed-key ChaCha block function instead.
+void prgEncryptBlocks(EVP_CIPHER_CTX *ctx, const uint128_t *in, uint128_t *out,
+                      int n) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+  int rounds = engine ? prgChachaRounds(engine->keyFlags) : 0;
+  if (rounds) {
+    engine->chachaBlocks(&engine->chachaKey, rounds, in, out, n);
+    return;
+  }
+  if (engine && engine->encrypt) {
+    engine->encrypt(&engine->aesKey, in, out, n);
+    return;
+  }
+
+  int len = 0;
+  if (1 != EVP_EncryptUpdate(ctx, (uint8_t *)out, &len, (const uint8_t *)in,
+                             16 * n))
+    printf("errors occured in encrypt\n");
+}
+
+// Linear orthomorphism sigma(xL || xR) = (xL ^ xR) || xL used by the
+// fixed-key correlation-robust hash (Guo et al., S&P 2020)
+static inline uint128_t sigma(uint128_t x) {
+  uint64_t hi = (uint64_t)(x >> 64);
+  uint64_t lo = (uint64_t)x;
+  return ((uint128_t)(hi ^ lo) << 64) | hi;
+}
+
+// Circular correlation-robust hash H(x) = AES_k(sigma(x)) ^ sigma(x) under the
+// PRF key of ctx, applied to n blocks. out may alias in.
+void ccrHashBatch(EVP_CIPHER_CTX *ctx, const uint128_t *in, uint128_t *out,
+                  uint64_t n) {
+  uint128_t stashin[2 * PRG_BATCH];
+  uint128_t stash[2 * PRG_BATCH];
+
+  for (uint64_t i = 0; i < n; i += 2 * PRG_BATCH) {
+    int m = n - i < 2 * PRG_BATCH ? n - i : 2 * PRG_BATCH;
+    for (int j = 0; j < m; j++)
+      stashin[j] = sigma(in[i + j]);
+
+    prgEncryptBlocks(ctx, stashin, stash, m);
+
+    for (int j = 0; j < m; j++)
+      out[i + j] = stash[j] ^ stashin[j];
+  }
+}
 
-  if (!randKey) {
-    randKey = (uint8_t *)malloc(16);
+// Fixed-key leaf conversion: block j of a leaf's payload is
+// H(s, j) = AES_k(sigma(s) ^ j) ^ sigma(s) ^ j under the PRF key of ctx, so
+// no key schedule is run per leaf. Blocks of consecutive leaves are hashed
+// in one pipelined batch.
+static void fixedKeyLeafConvert(EVP_CIPHER_CTX *ctx, const uint128_t *seeds,
+                                uint64_t n, int dataSize, uint8_t *out) {
+  int blocks = (dataSize + 15) / 16;
+  uint128_t stashin[2 * PRG_BATCH];
+  uint128_t stash[2 * PRG_BATCH];
+  uint64_t leaf[2 * PRG_BATCH];
+  int block[2 * PRG_BATCH];
+
+  uint64_t i = 0;
+  int j = 0;
+  while (i < n) {
+    int m = 0;
+    for (; m < 2 * PRG_BATCH && i < n; m++) {
+      stashin[m] = sigma(seeds[i]) ^ (uint128_t)j;
+      leaf[m] = i;
+      block[m] = j;
+      if (++j == blocks) {
+        j = 0;
+        i++;
+      }
+    }
+
+    prgEncryptBlocks(ctx, stashin, stash, m);
+
+    for (int l = 0; l < m; l++) {
+      uint128_t h = stash[l] ^ stashin[l];
+      int offset = 16 * block[l];
+      int len = dataSize - offset < 16 ? dataSize - offset : 16;
+      memcpy(out + leaf[l] * dataSize + offset, &h, len);
+    }
+  }
+}
+
+// Returns 1 if ctx is set to the PRG backend recorded in the key mode flags
+// `flags` (setPRGBackend). Otherwise it prints an error and returns 0, and
+// the evaluator returns without touching its output: the tree and leaves of
+// the key cannot be expanded with another backend.
+int checkKeyPRG(EVP_CIPHER_CTX *ctx, uint8_t flags) {
+  int backend = (getKeyFlags(ctx) & KEY_PRG_MASK) >> KEY_PRG_SHIFT;
+  int keyBackend = (flags & KEY_PRG_MASK) >> KEY_PRG_SHIFT;
+  if (keyBackend == backend)
+    return 1;
+  printf("errors occurred in parsing key: key was generated with PRG backend "
+         "%d, the context is set to %d\n",
+         keyBackend, backend);
+  return 0;
+}
+
+// Returns 1 if a VDPF/VDMPF key with mode flags `flags` was generated with
+// the MMO hash (KEY_FLAG_MMO_HASH) and the PRG backend of ctx. Otherwise it
+// prints an error, fills the 32-byte proof with random bytes, which the
+// other server's proof will not match, and returns 0; for keys that predate
+// the MMO hash it also zeroes the outBytes of out (if any).
+int checkVerifiableKey(EVP_CIPHER_CTX *ctx, uint8_t flags, uint8_t *out,
+                       uint64_t outBytes, uint8_t *proof) {
+  int legacy = !(flags & KEY_FLAG_MMO_HASH);
+  if (legacy) {
+    printf("errors occurred in parsing key: verifiable key predates the MMO "
+           "hash, regenerate it\n");
+    if (out)
+      memset(out, 0, outBytes);
+  } else if (checkKeyPRG(ctx, flags)) {
+    return 1;
+  }
+  uint128_t noise[2] = {getRandomBlock(), getRandomBlock()};
+  memcpy(proof, noise, 32);
+  return 0;
+}
+
+// Converts n leaf seeds into dataSize bytes of output each, written
+// contiguously to out. flags are the key mode flags of the key the seeds come
+// from: legacy keys expand each seed with AES-CTR keyed by the seed itself,
+// ChaCha keys with the ChaCha keystream under the seed.
+void leafConvert(EVP_CIPHER_CTX *ctx, uint8_t flags, const uint128_t *seeds,
+                 uint64_t n, int dataSize, uint8_t *out) {
+  struct DPFEngine *engine =
+      (struct DPFEngine *)EVP_CIPHER_CTX_get_app_data(ctx);
+
+  if (flags & KEY_FLAG_FIXED_KEY_LEAF) {
+    fixedKeyLeafConvert(ctx, seeds, n, dataSize, out);
+    return;
+  }
+
+  int rounds = prgChachaRounds(flags);
+  if (rounds && engine) {
+    engine->chachaStream(seeds, n, rounds, out, dataSize);
+    return;
+  }
+
+  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
+  memset(zeros, 0, dataSize + 16);
+
+  EVP_CIPHER_CTX *seedCtx;
+  if (!(seedCtx = EVP_CIPHER_CTX_new()))
+    printf("errors occurred in creating context\n");
+
+  int len = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
+                                (uint8_t *)&seeds[i], NULL))
+      printf("errors occurred in init of leaf conversion\n");
+    if (1 !=
+        EVP_EncryptUpdate(seedCtx, out + i * dataSize, &len, zeros, dataSize))
+      printf("errors occurred in encrypt\n");
+  }
+
+  free(zeros);
+  EVP_CIPHER_CTX_free(seedCtx);
+}
+
+// XORs n rows of len bytes into out in one pass: every chunk of out is loaded
+// once, combined with the same chunk of all rows and stored once, instead of
+// making n passes over out.
+static void xorRowsPortable(uint8_t *out, const uint8_t *const *rows, int n,
+                            size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t acc, word;
+    memcpy(&acc, out + i, 8);
+    for (int r = 0; r < n; r++) {
+      memcpy(&word, rows[r] + i, 8);
+      acc ^= word;
+    }
+    memcpy(out + i, &acc, 8);
+  }
+  for (; i < len; i++) {
+    uint8_t acc = out[i];
+    for (int r = 0; r < n; r++)
+      acc ^= rows[r][i];
+    out[i] = acc;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+__attribute__((target("avx2"))) static void
+xorRowsAvx2(uint8_t *out, const uint8_t *const *rows, int n, size_t len) {
+  size_t i = 0;
+  for (; i + 128 <= len; i += 128) {
+    __m256i acc[4];
+    for (int l = 0; l < 4; l++)
+      acc[l] = _mm256_loadu_si256((const __m256i *)(out + i + 32 * l));
+    for (int r = 0; r < n; r++)
+      for (int l = 0; l < 4; l++)
+        acc[l] = _mm256_xor_si256(
+            acc[l], _mm256_loadu_si256((const __m256i *)(rows[r] + i + 32 * l)));
+    for (int l = 0; l < 4; l++)
+      _mm256_storeu_si256((__m256i *)(out + i + 32 * l), acc[l]);
+  }
+  for (; i + 32 <= len; i += 32) {
+    __m256i acc = _mm256_loadu_si256((const __m256i *)(out + i));
+    for (int r = 0; r < n; r++)
+      acc = _mm256_xor_si256(acc,
+                             _mm256_loadu_si256((const __m256i *)(rows[r] + i)));
+    _mm256_storeu_si256((__m256i *)(out + i), acc);
+  }
+  if (i < len) {
+    const uint8_t *tail[64];
+    for (int r = 0; r < n; r++)
+      tail[r] = rows[r] + i;
+    xorRowsPortable(out + i, tail, n, len - i);
+  }
+}
+
+__attribute__((target("avx512f"))) static void
+xorRowsAvx512(uint8_t *out, const uint8_t *const *rows, int n, size_t len) {
+  size_t i = 0;
+  for (; i + 256 <= len; i += 256) {
+    __m512i acc[4];
+    for (int l = 0; l < 4; l++)
+      acc[l] = _mm512_loadu_si512(out + i + 64 * l);
+    for (int r = 0; r < n; r++)
+      for (int l = 0; l < 4; l++)
+        acc[l] = _mm512_xor_si512(acc[l],
+                                  _mm512_loadu_si512(rows[r] + i + 64 * l));
+    for (int l = 0; l < 4; l++)
+      _mm512_storeu_si512(out + i + 64 * l, acc[l]);
+  }
+  if (i < len) {
+    const uint8_t *tail[64];
+    for (int r = 0; r < n; r++)
+      tail[r] = rows[r] + i;
+    xorRowsAvx2(out + i, tail, n, len - i);
+  }
+}
+
+#endif
+
+// Folds up to 64 correction-word rows into a leaf output (see xorRowsPortable)
+// with the widest kernel the CPU supports
+void xorRows(uint8_t *out, const uint8_t *const *rows, int n, size_t len) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx512f")) {
+    xorRowsAvx512(out, rows, n, len);
+    return;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    xorRowsAvx2(out, rows, n, len);
+    return;
+  }
+#endif
+  xorRowsPortable(out, rows, n, len);
+}
+
+// Per-thread AES-CTR DRBG behind getRandomBlock. Each thread keeps its own
+// key, counter and RAND_BUFFER_BLOCKS blocks of buffered output, so dealers
+// can generate keys on many threads without locking. The key is redrawn from
+// RAND_bytes every RAND_RESEED_BLOCKS blocks, on reseedRandom, and in a forked
+// child, which would otherwise replay the parent's buffered blocks.
+struct RandState {
+  struct AesKey aesKey;
+  uint8_t key[16];
+  AesEncryptFn encrypt; // native kernel, NULL for EVP
+  uint128_t counter;
+  uint64_t sinceReseed; // blocks produced under the current key
+  unsigned generation;  // fork generation the key was drawn in
+  int seeded;
+  int pos; // next unused block of buffer
+  uint128_t buffer[RAND_BUFFER_BLOCKS];
+};
+
+static __thread struct RandState randState;
+
+// Bumped in every forked child so that inherited DRBG state is discarded
+static volatile unsigned randForkGeneration = 0;
+static pthread_once_t randAtforkOnce = PTHREAD_ONCE_INIT;
+
+static void randAtforkChild(void) { randForkGeneration++; }
+
+static void randRegisterAtfork(void) {
+  pthread_atfork(NULL, NULL, randAtforkChild);
+}
 
+static void randSeed(struct RandState *st) {
+  pthread_once(&randAtforkOnce, randRegisterAtfork);
+  if (!RAND_bytes(st->key, 16)) {
+    printf("failed to seed randomness\n");
+  }
+  st->encrypt = aesEncryptKernel(aesDetectImpl());
+  if (st->encrypt)
+    aesniExpandKey(st->key, &st->aesKey);
+  st->counter = 0;
+  st->sinceReseed = 0;
+  st->generation = randForkGeneration;
+  st->seeded = 1;
+  st->pos = RAND_BUFFER_BLOCKS; // drop whatever is left of the old stream
+}
+
+// Refills the buffer with the next RAND_BUFFER_BLOCKS counter blocks
+static void randRefill(struct RandState *st) {
+  if (!st->seeded || st->sinceReseed >= RAND_RESEED_BLOCKS)
+    randSeed(st);
+
+  for (int i = 0; i < RAND_BUFFER_BLOCKS; i++)
+    st->buffer[i] = st->counter + i;
+  st->counter += RAND_BUFFER_BLOCKS;
+  st->sinceReseed += RAND_BUFFER_BLOCKS;
+
+  if (st->encrypt) {
+    st->encrypt(&st->aesKey, st->buffer, st->buffer, RAND_BUFFER_BLOCKS);
+  } else {
+    EVP_CIPHER_CTX *randCtx;
+    int len = 0;
     if (!(randCtx = EVP_CIPHER_CTX_new()))
       printf("errors ocurred in creating context\n");
-    if (!RAND_bytes(randKey, 16)) {
-      printf("failed to seed randomness\n");
-    }
     if (1 !=
-        EVP_EncryptInit_ex(randCtx, EVP_aes_128_ecb(), NULL, randKey, NULL))
+        EVP_EncryptInit_ex(randCtx, EVP_aes_128_ecb(), NULL, st->key, NULL))
       printf("errors ocurred in randomness init\n");
-
     EVP_CIPHER_CTX_set_padding(randCtx, 0);
+    if (1 != EVP_EncryptUpdate(randCtx, (uint8_t *)st->buffer, &len,
+                               (uint8_t *)st->buffer, sizeof(st->buffer)))
+      printf("errors ocurred in generating randomness\n");
+    EVP_CIPHER_CTX_free(randCtx);
   }
+  st->pos = 0;
+}
 
-  int len = 0;
-  uint128_t output = 0;
-  if (1 != EVP_EncryptUpdate(randCtx, (uint8_t *)&output, &len,
-                             (uint8_t *)&counter, 16))
-    printf("errors ocurred in generating randomness\n");
+void reseedRandom() {
+  struct RandState *st = &randState;
+  randSeed(st);
+  memset(st->buffer, 0, sizeof(st->buffer));
+}
 
-  counter++;
+uint128_t getRandomBlock() {
+  struct RandState *st = &randState;
+  if (st->generation != randForkGeneration)
+    randSeed(st);
+  if (st->pos == RAND_BUFFER_BLOCKS)
+    randRefill(st);
+  uint128_t output = st->buffer[st->pos];
+  st->buffer[st->pos++] = 0; // blocks handed out are not kept around
   return output;
 }
 
@@ -58,12 +582,8 @@ void dpfPRG(EVP_CIPHER_CTX *ctx, uint128_t input, uint128_t *output1,
   stashin[0] = input;
   stashin[1] = reverse_lsb(input);
 
-  int len = 0;
   uint128_t stash[2];
-
-  if (1 != EVP_EncryptUpdate(ctx, (uint8_t *)&stash[0], &len,
-                             (uint8_t *)&stashin[0], 32))
-    printf("errors occured in encrypt\n");
+  prgEncryptBlocks(ctx, stashin, stash, 2);
 
   stash[0] = stash[0] ^ input;
   stash[1] = stash[1] ^ input;
@@ -76,6 +596,539 @@ void dpfPRG(EVP_CIPHER_CTX *ctx, uint128_t input, uint128_t *output1,
   *output2 = set_lsb_zero(stash[1]);
 }
 
+// Expands n seeds at once with the DPF PRG. Equivalent to calling dpfPRG on
+// every seed, but the AES calls for a whole chunk are issued together so the
+// pipeline stays full. The outputs may alias seeds.
+void dpfPRGBatch(EVP_CIPHER_CTX *ctx, const uint128_t *seeds, uint64_t n,
+                 uint128_t *outL, uint128_t *outR, int *bitsL, int *bitsR) {
+  uint128_t stashin[2 * PRG_BATCH];
+  uint128_t stash[2 * PRG_BATCH];
+
+  for (uint64_t i = 0; i < n; i += PRG_BATCH) {
+    int m = n - i < PRG_BATCH ? n - i : PRG_BATCH;
+    for (int j = 0; j < m; j++) {
+      uint128_t input = set_lsb_zero(seeds[i + j]);
+      stashin[2 * j] = input;
+      stashin[2 * j + 1] = reverse_lsb(input);
+    }
+
+    prgEncryptBlocks(ctx, stashin, stash, 2 * m);
+
+    for (int j = 0; j < m; j++) {
+      uint128_t left = stash[2 * j] ^ stashin[2 * j];
+      uint128_t right = reverse_lsb(stash[2 * j + 1] ^ stashin[2 * j]);
+      bitsL[i + j] = lsb(left);
+      bitsR[i + j] = lsb(right);
+      outL[i + j] = set_lsb_zero(left);
+      outR[i + j] = set_lsb_zero(right);
+    }
+  }
+}
+
+// dpfPRGBatch for trees that keep each node's control bit in the free lsb of
+// its seed: the children come out with their control bit in place.
+void dpfPRGBatchPacked(EVP_CIPHER_CTX *ctx, const uint128_t *seeds, uint64_t n,
+                       uint128_t *outL, uint128_t *outR) {
+  uint128_t stashin[2 * PRG_BATCH];
+  uint128_t stash[2 * PRG_BATCH];
+
+  for (uint64_t i = 0; i < n; i += PRG_BATCH) {
+    int m = n - i < PRG_BATCH ? n - i : PRG_BATCH;
+    for (int j = 0; j < m; j++) {
+      uint128_t input = set_lsb_zero(seeds[i + j]);
+      stashin[2 * j] = input;
+      stashin[2 * j + 1] = reverse_lsb(input);
+    }
+
+    prgEncryptBlocks(ctx, stashin, stash, 2 * m);
+
+    for (int j = 0; j < m; j++) {
+      outL[i + j] = stash[2 * j] ^ stashin[2 * j];
+      outR[i + j] = reverse_lsb(stash[2 * j + 1] ^ stashin[2 * j]);
+    }
+  }
+}
+
+// Expands the children of a packed node and corrects them with the folded
+// CWs of their level (cwL = sCW ^ tCW0, cwR = sCW ^ tCW1)
+static inline void dpfExpandNode(EVP_CIPHER_CTX *ctx, uint128_t node,
+                                 uint128_t cwL, uint128_t cwR, uint128_t *left,
+                                 uint128_t *right) {
+  dpfPRGBatchPacked(ctx, &node, 1, left, right);
+  uint128_t mask = bitMask(lsb(node));
+  *left ^= cwL & mask;
+  *right ^= cwR & mask;
+}
+
+static void dpfWalkDescend(EVP_CIPHER_CTX *ctx, struct DPFWalk *walk,
+                           const uint128_t *cwL, const uint128_t *cwR,
+                           int from, uint64_t index) {
+  for (int d = from; d <= walk->depth; d++) {
+    uint128_t left;
+    dpfExpandNode(ctx, walk->path[d - 1], cwL[d - 1], cwR[d - 1], &left,
+                  &walk->right[d]);
+    walk->path[d] =
+        selectBlock((index >> (walk->depth - d)) & 1, left, walk->right[d]);
+  }
+}
+
+// Starts a walk at node first of the given depth below root; cwL and cwR
+// hold the folded CWs of levels 1..depth
+void dpfWalkStart(EVP_CIPHER_CTX *ctx, struct DPFWalk *walk, uint128_t root,
+                  const uint128_t *cwL, const uint128_t *cwR, int depth,
+                  uint64_t first) {
+  walk->depth = depth;
+  walk->path[0] = root;
+  dpfWalkDescend(ctx, walk, cwL, cwR, 1, first);
+}
+
+// Moves the walk from node next - 1 to node next of its depth
+void dpfWalkNext(EVP_CIPHER_CTX *ctx, struct DPFWalk *walk,
+                 const uint128_t *cwL, const uint128_t *cwR, uint64_t next) {
+  // going from next - 1 to next turns the level of the lowest set bit of
+  // next from the left child to the right one and restarts everything below
+  int d = walk->depth - __builtin_ctzll(next);
+  walk->path[d] = walk->right[d];
+  dpfWalkDescend(ctx, walk, cwL, cwR, d + 1, next);
+}
+
+// Expands levels levels below root breadth first through the batched PRG
+// (cwL/cwR are the folded CWs of those levels) and returns the 2^levels
+// leaves, in order, in buf0 or buf1, both of which must hold 2^levels seeds
+uint128_t *dpfExpandSubtree(EVP_CIPHER_CTX *ctx, uint128_t root,
+                            const uint128_t *cwL, const uint128_t *cwR,
+                            int levels, uint128_t *buf0, uint128_t *buf1) {
+  uint128_t sL[PRG_BATCH], sR[PRG_BATCH];
+  uint128_t *cur = buf0, *next = buf1;
+  cur[0] = root;
+  for (int d = 0; d < levels; d++) {
+    uint64_t width = 1ULL << d;
+    for (uint64_t j = 0; j < width; j += PRG_BATCH) {
+      int m = width - j < PRG_BATCH ? width - j : PRG_BATCH;
+      dpfPRGBatchPacked(ctx, &cur[j], m, sL, sR);
+      for (int l = 0; l < m; l++) {
+        uint128_t mask = bitMask(lsb(cur[j + l]));
+        next[2 * (j + l)] = sL[l] ^ (cwL[d] & mask);
+        next[2 * (j + l) + 1] = sR[l] ^ (cwR[d] & mask);
+      }
+    }
+    uint128_t *tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+  return cur;
+}
+
+// dpfExpandSubtree for n subtrees of the same height in lockstep: tree i
+// grows from roots[i] with the CWs cwL[i]/cwR[i], and its leaves come back
+// at i << levels. Node j of tree i at depth d sits at (i << d) + j, so the
+// children of the node at g are at 2g and 2g + 1 as in a single tree, and
+// each level of all trees is one dpfPRGBatchPacked call. buf0 and buf1 must
+// each hold n << levels seeds, sL and sR n << (levels - 1).
+uint128_t *dpfExpandSubtrees(EVP_CIPHER_CTX *ctx, int n,
+                             const uint128_t *roots,
+                             const uint128_t *const *cwL,
+                             const uint128_t *const *cwR, int levels,
+                             uint128_t *buf0, uint128_t *buf1, uint128_t *sL,
+                             uint128_t *sR) {
+  uint128_t *cur = buf0, *next = buf1;
+  memcpy(cur, roots, sizeof(uint128_t) * n);
+  for (int d = 0; d < levels; d++) {
+    uint64_t width = (uint64_t)n << d;
+    dpfPRGBatchPacked(ctx, cur, width, sL, sR);
+    for (uint64_t g = 0; g < width; g++) {
+      uint64_t tree = g >> d;
+      uint128_t mask = bitMask(lsb(cur[g]));
+      next[2 * g] = sL[g] ^ (cwL[tree][d] & mask);
+      next[2 * g + 1] = sR[g] ^ (cwR[tree][d] & mask);
+    }
+    uint128_t *tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+  return cur;
+}
+
+// Starts a stream of dataSize-byte shares for visit; returns 0 (after
+// printing an error) if chunkSize is 0 or the chunk buffer cannot be had
+int chunkStreamInit(struct DPFChunkStream *stream, int dataSize,
+                    uint64_t chunkSize, DPFChunkFn visit, void *user) {
+  if (chunkSize == 0) {
+    printf("invalid chunk size 0\n");
+    return 0;
+  }
+  stream->visit = visit;
+  stream->user = user;
+  stream->dataSize = dataSize;
+  stream->chunk = chunkSize;
+  stream->next = 0;
+  stream->end = UINT64_MAX;
+  stream->fill = 0;
+  stream->buf = malloc(chunkSize * dataSize);
+  if (!stream->buf) {
+    printf("errors occurred in memory allocation\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Appends the shares of the next count points
+void chunkStreamPush(struct DPFChunkStream *stream, const uint8_t *shares,
+                     uint64_t count) {
+  int dataSize = stream->dataSize;
+  // a truncated domain ends inside the last block
+  uint64_t pushed = stream->next + stream->fill;
+  if (count > stream->end - pushed)
+    count = pushed < stream->end ? stream->end - pushed : 0;
+  while (count > 0) {
+    // whole chunks are visited straight from the evaluator's buffer
+    if (stream->fill == 0 && count >= stream->chunk) {
+      stream->visit(stream->next, stream->chunk, shares, stream->user);
+      stream->next += stream->chunk;
+      shares += stream->chunk * dataSize;
+      count -= stream->chunk;
+      continue;
+    }
+
+    uint64_t m = stream->chunk - stream->fill;
+    if (m > count)
+      m = count;
+    memcpy(stream->buf + stream->fill * dataSize, shares, m * dataSize);
+    stream->fill += m;
+    shares += m * dataSize;
+    count -= m;
+    if (stream->fill == stream->chunk) {
+      stream->visit(stream->next, stream->chunk, stream->buf, stream->user);
+      stream->next += stream->chunk;
+      stream->fill = 0;
+    }
+  }
+}
+
+// Visits what is left as a last, shorter chunk and frees the buffer
+void chunkStreamFinish(struct DPFChunkStream *stream) {
+  if (stream->fill > 0)
+    stream->visit(stream->next, stream->fill, stream->buf, stream->user);
+  stream->next += stream->fill;
+  stream->fill = 0;
+  free(stream->buf);
+}
+
+// Chunk visitor that copies the part of a chunk inside the range of a
+// struct DPFRangeOut to its place in out
+void copyRangeChunk(uint64_t firstIndex, uint64_t count, const uint8_t *shares,
+                    void *user) {
+  struct DPFRangeOut *range = (struct DPFRangeOut *)user;
+  uint64_t from = firstIndex > range->lo ? firstIndex : range->lo;
+  uint64_t to = firstIndex + count < range->hi ? firstIndex + count : range->hi;
+  if (from < to)
+    memcpy(range->out + (from - range->lo) * range->dataSize,
+           shares + (from - firstIndex) * range->dataSize,
+           (to - from) * range->dataSize);
+}
+
+// Batched version of the big-state DMPF PRG (dmpfPRG in big_state.cc): each
+// expansion yields t control bits per child instead of one.
+void dmpfPRGBatch(EVP_CIPHER_CTX *ctx, int t, const uint128_t *seeds,
+                  uint64_t n, uint128_t *outL, uint128_t *outR, int *bitsL,
+                  int *bitsR) {
+  uint128_t stashin[2 * PRG_BATCH];
+  uint128_t stash[2 * PRG_BATCH];
+  int mask = (1 << t) - 1;
+
+  for (uint64_t i = 0; i < n; i += PRG_BATCH) {
+    int m = n - i < PRG_BATCH ? n - i : PRG_BATCH;
+    for (int j = 0; j < m; j++) {
+      uint128_t input = set_lsb_zero(seeds[i + j]);
+      stashin[2 * j] = input;
+      stashin[2 * j + 1] = reverse_lsb(input);
+    }
+
+    prgEncryptBlocks(ctx, stashin, stash, 2 * m);
+
+    for (int j = 0; j < m; j++) {
+      uint128_t left = stash[2 * j] ^ stashin[2 * j];
+      uint128_t right = reverse_lsb(stash[2 * j + 1] ^ stashin[2 * j]);
+      bitsL[i + j] = left & mask;
+      bitsR[i + j] = right & mask;
+      outL[i + j] = set_lsb_zero(left);
+      outR[i + j] = set_lsb_zero(right);
+    }
+  }
+}
+
+// PRG of the higher-arity trees: a seed expands into 2^levelBits children,
+// child c being MMO(s ^ c) with the low levelBits bits of s cleared, so all
+// children of a node come out of one AES batch. The low t bits of a child are
+// its control bits (t = 1 for DPF) and its seed has the lsb cleared. For
+// levelBits = 1 this is exactly dpfPRG/dmpfPRG.
+static inline void karySplit(uint128_t child, int t, uint128_t *seed,
+                             int *bits) {
+  *bits = child & ((1 << t) - 1);
+  *seed = set_lsb_zero(child);
+}
+
+// Computes only child number `child` of seed, one AES call
+void karyPRG(EVP_CIPHER_CTX *ctx, int levelBits, int t, uint128_t seed,
+             int child, uint128_t *output, int *bits) {
+  uint128_t mask = (1 << levelBits) - 1;
+  uint128_t stashin = (seed & ~mask) ^ (uint128_t)child;
+  uint128_t stash;
+  prgEncryptBlocks(ctx, &stashin, &stash, 1);
+  karySplit(stash ^ stashin, t, output, bits);
+}
+
+// Expands n seeds; the children of seeds[i] go to children[i << levelBits]
+// onwards. children must not alias seeds.
+void karyPRGBatch(EVP_CIPHER_CTX *ctx, int levelBits, int t,
+                  const uint128_t *seeds, uint64_t n, uint128_t *children,
+                  int *bits) {
+  int arity = 1 << levelBits;
+  uint128_t mask = arity - 1;
+  uint128_t stashin[2 * PRG_BATCH];
+  uint128_t stash[2 * PRG_BATCH];
+  uint64_t perBatch = 2 * PRG_BATCH / arity;
+
+  for (uint64_t i = 0; i < n; i += perBatch) {
+    int m = n - i < perBatch ? n - i : perBatch;
+    for (int j = 0; j < m; j++) {
+      uint128_t input = seeds[i + j] & ~mask;
+      for (int c = 0; c < arity; c++)
+        stashin[j * arity + c] = input ^ (uint128_t)c;
+    }
+
+    prgEncryptBlocks(ctx, stashin, stash, m * arity);
+
+    for (int l = 0; l < m * arity; l++)
+      karySplit(stash[l] ^ stashin[l], t, &children[i * arity + l],
+                &bits[i * arity + l]);
+  }
+}
+
+// A karyFullDomain run: the top levels of the tree are walked depth first
+// to the roots of subtrees of 2^blockBits leaves, which are expanded breadth
+// first and converted in order, as fullDomainDPF does for binary trees.
+// Workers claim blocks one at a time.
+struct KaryFullDomain {
+  EVP_CIPHER_CTX *ctx;
+  const struct KaryTree *tree;
+  int levels, topLevels, blockBits, dataSize;
+  uint8_t *out;                  // NULL when streaming
+  uint64_t outBytes;             // size of out, which may end mid-block
+  struct DPFChunkStream *stream; // receives the blocks in order if set
+  uint64_t next, last;           // next block to claim, end of the blocks
+};
+
+// The nodes above the current block of a karyFullDomain run: seed[l] and
+// bits[l] are its ancestor on depth l
+struct KaryWalk {
+  uint128_t seed[65];
+  int bits[65];
+};
+
+// Index bits of block that select the child on level l of the walk
+static inline int karyWalkDigit(const struct KaryFullDomain *run, int l,
+                                uint64_t block) {
+  int shift = run->tree->arityBits * (run->topLevels - 1 - l);
+  int levelBits = karyLevelBits(run->tree->size, run->tree->arityBits, l);
+  return (block >> shift) & ((1 << levelBits) - 1);
+}
+
+// Recomputes the walk from level from down to the root of block, one AES
+// call per level
+static void karyWalkDescend(EVP_CIPHER_CTX *ctx,
+                            const struct KaryFullDomain *run,
+                            struct KaryWalk *walk, int from, uint64_t block) {
+  const struct KaryTree *tree = run->tree;
+  for (int l = from; l < run->topLevels; l++) {
+    int levelBits = karyLevelBits(tree->size, tree->arityBits, l);
+    int digit = karyWalkDigit(run, l, block);
+    karyPRG(ctx, levelBits, tree->t, walk->seed[l], digit, &walk->seed[l + 1],
+            &walk->bits[l + 1]);
+    // a clear control state selects no CWs
+    int set = walk->bits[l] != 0;
+    uint128_t sCW[8];
+    int tCW[8];
+    tree->levelCW(tree, l, walk->bits[l], sCW, tCW);
+    walk->seed[l + 1] ^= sCW[digit] & bitMask(set);
+    walk->bits[l + 1] ^= tCW[digit] & -set;
+  }
+}
+
+// Expands the levels of a block below root breadth first through the
+// batched PRG; returns the seeds of its leaves, in order, in seeds0 or
+// seeds1 and their control bits in *leafBits
+static uint128_t *karyExpandBlock(EVP_CIPHER_CTX *ctx,
+                                  const struct KaryFullDomain *run,
+                                  uint128_t root, int rootBits,
+                                  uint128_t *seeds0, int *bits0,
+                                  uint128_t *seeds1, int *bits1,
+                                  int **leafBits) {
+  const struct KaryTree *tree = run->tree;
+  uint128_t *cur = seeds0, *next = seeds1;
+  int *curBits = bits0, *nextBits = bits1;
+  cur[0] = root;
+  curBits[0] = rootBits;
+  uint64_t n = 1;
+  for (int l = run->topLevels; l < run->levels; l++) {
+    int levelBits = karyLevelBits(tree->size, tree->arityBits, l);
+    int width = 1 << levelBits;
+    karyPRGBatch(ctx, levelBits, tree->t, cur, n, next, nextBits);
+
+    // a single control bit selects the same CWs for every parent
+    uint128_t sCW[8];
+    int tCW[8];
+    if (tree->t == 1)
+      tree->levelCW(tree, l, 1, sCW, tCW);
+    for (uint64_t j = 0; j < n; j++) {
+      int set = curBits[j] != 0;
+      uint128_t mask = bitMask(set);
+      if (tree->t > 1)
+        tree->levelCW(tree, l, curBits[j], sCW, tCW);
+      for (int c = 0; c < width; c++) {
+        next[j * width + c] ^= sCW[c] & mask;
+        nextBits[j * width + c] ^= tCW[c] & -set;
+      }
+    }
+
+    uint128_t *tmp = cur;
+    cur = next;
+    next = tmp;
+    int *tmpBits = curBits;
+    curBits = nextBits;
+    nextBits = tmpBits;
+    n *= width;
+  }
+  *leafBits = curBits;
+  return cur;
+}
+
+// Claims blocks of run until none are left and converts them with ctx
+static void karyFullDomainBlocks(EVP_CIPHER_CTX *ctx,
+                                 struct KaryFullDomain *run) {
+  const struct KaryTree *tree = run->tree;
+  int dataSize = run->dataSize;
+  uint64_t blockLeaves = 1ULL << run->blockBits;
+  uint64_t blockBytes = blockLeaves * dataSize;
+  uint128_t *seeds0 = malloc(sizeof(uint128_t) * blockLeaves);
+  uint128_t *seeds1 = malloc(sizeof(uint128_t) * blockLeaves);
+  int *bits0 = malloc(sizeof(int) * blockLeaves);
+  int *bits1 = malloc(sizeof(int) * blockLeaves);
+  // a stream gets every block, and out the block that overhangs its end,
+  // through the same buffer
+  uint8_t *blockBuf =
+      run->stream || run->outBytes % blockBytes ? malloc(blockBytes) : NULL;
+
+  uint64_t batch = LEAF_BLOCK_BYTES / dataSize;
+  if (batch < PRG_BATCH)
+    batch = PRG_BATCH;
+  if (batch > blockLeaves)
+    batch = blockLeaves;
+
+  // the walk only recomputes the levels below the first digit in which a
+  // block differs from the one before it
+  struct KaryWalk walk;
+  walk.seed[0] = tree->root;
+  walk.bits[0] = tree->rootBits;
+  uint64_t block, prev = 0;
+  int started = 0;
+  while ((block = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) <
+         run->last) {
+    int from = 0;
+    if (started)
+      while (from < run->topLevels &&
+             karyWalkDigit(run, from, block) == karyWalkDigit(run, from, prev))
+        from++;
+    karyWalkDescend(ctx, run, &walk, from, block);
+    started = 1;
+    prev = block;
+
+    int *leafBits;
+    uint128_t *leaves =
+        karyExpandBlock(ctx, run, walk.seed[run->topLevels],
+                        walk.bits[run->topLevels], seeds0, bits0, seeds1,
+                        bits1, &leafBits);
+    uint64_t offset = block * blockBytes;
+    uint8_t *blockOut = run->stream || offset + blockBytes > run->outBytes
+                            ? blockBuf
+                            : run->out + offset;
+
+    // convert a batch at a time and correct it while it is still in cache
+    for (uint64_t i = 0; i < blockLeaves; i += batch) {
+      uint64_t m = blockLeaves - i < batch ? blockLeaves - i : batch;
+      leafConvert(ctx, tree->flags, leaves + i, m, dataSize,
+                  blockOut + i * dataSize);
+      for (uint64_t l = i; l < i + m; l++)
+        for (int r = 0; r < tree->t; r++)
+          xorIfSet(blockOut + l * dataSize, tree->lastCWs + r * dataSize,
+                   dataSize, (leafBits[l] >> (tree->t - 1 - r)) & 1);
+    }
+
+    if (run->stream)
+      chunkStreamPush(run->stream, blockBuf, blockLeaves);
+    else if (blockOut == blockBuf)
+      memcpy(run->out + offset, blockBuf, run->outBytes - offset);
+  }
+
+  free(blockBuf);
+  free(seeds0);
+  free(seeds1);
+  free(bits0);
+  free(bits1);
+}
+
+// A worker of a parallel run, with a cipher context of its own
+static void karyFullDomainTask(void *arg, int worker) {
+  (void)worker;
+  struct KaryFullDomain *run = (struct KaryFullDomain *)arg;
+  EVP_CIPHER_CTX *workerCtx = cloneDPFContext(run->ctx);
+  karyFullDomainBlocks(workerCtx, run);
+  destroyContext(workerCtx);
+}
+
+// Evaluates points [0, hi) of a higher-arity tree into out, or, if out is
+// NULL, the blocks that cover points [lo, hi) into stream. Only O(size +
+// block) seeds are live at any time and blocks outside [lo, hi) are never
+// expanded; with several threads (setFullDomainThreads) the workers convert
+// whole blocks into their own slices of out.
+void karyFullDomain(EVP_CIPHER_CTX *ctx, const struct KaryTree *tree,
+                    int dataSize, uint8_t *out, struct DPFChunkStream *stream,
+                    uint64_t lo, uint64_t hi) {
+  struct KaryFullDomain run;
+  run.ctx = ctx;
+  run.tree = tree;
+  run.levels = karyLevels(tree->size, tree->arityBits);
+  run.dataSize = dataSize;
+
+  // blocks are whole levels, at most 2^DPF_BLOCK_LEVELS leaves and no larger
+  // than the range
+  int blockLevels = 0;
+  run.blockBits = 0;
+  while (blockLevels < run.levels) {
+    int bits = run.blockBits + karyLevelBits(tree->size, tree->arityBits,
+                                             run.levels - 1 - blockLevels);
+    if (bits > DPF_BLOCK_LEVELS || (1ULL << bits) > hi - lo)
+      break;
+    run.blockBits = bits;
+    blockLevels++;
+  }
+  run.topLevels = run.levels - blockLevels;
+
+  run.out = out;
+  run.outBytes = out ? hi * dataSize : 0;
+  run.stream = stream;
+  run.next = lo >> run.blockBits;
+  run.last = ((hi - 1) >> run.blockBits) + 1;
+  if (stream)
+    stream->next = run.next << run.blockBits;
+
+  // a stream is fed in order by the calling thread
+  if (getFullDomainThreads(ctx) > 1 && run.last - run.next > 1 && !stream)
+    runParallel(ctx, karyFullDomainTask, &run);
+  else
+    karyFullDomainBlocks(ctx, &run);
+}
+
 // Comparison function for uint64_t values (for qsort)
 int compareUint64(const void *a, const void *b) {
   uint64_t val_a = *(const uint64_t *)a;
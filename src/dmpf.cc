@@ -8,12 +8,35 @@ extern "C" {
 void genBigStateDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
                      int dataSize, uint8_t *data, uint8_t *k0, uint8_t *k1);
 
+void genKaryBigStateDMPF(EVP_CIPHER_CTX *ctx, int arity, int t, int size,
+                         uint64_t *index, int dataSize, uint8_t *data,
+                         uint8_t *k0, uint8_t *k1);
+
+int karyBigStateDMPFKeySize(int arity, int t, int size, int dataSize);
+
 void evalBigStateDMPF(EVP_CIPHER_CTX *ctx, uint64_t index, int dataSize,
                       uint8_t *dataShare, uint8_t *k);
 
 void fullDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k, int dataSize,
                             uint8_t *out);
 
+void fullDomainBigStateDMPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                  int dataSize, uint64_t chunkSize,
+                                  DPFChunkFn visit, void *user);
+
+void evalRangeBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                           int dataSize, uint64_t lo, uint64_t hi,
+                           uint8_t *out);
+
+void truncatedDomainBigStateDMPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                 int dataSize, uint64_t domainSize,
+                                 uint8_t *out);
+
+void truncatedDomainBigStateDMPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                       int dataSize, uint64_t domainSize,
+                                       uint64_t chunkSize, DPFChunkFn visit,
+                                       void *user);
+
 void BigStateCompress(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
                       int dataSize, uint8_t *data, uint8_t *key);
 
@@ -27,6 +50,18 @@ void genDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
   genBigStateDMPF(ctx, t, size, index, dataSize, data, k0, k1);
 }
 
+// Bridge function to generate higher-arity Big State DMPF keys
+void genKaryDMPF(EVP_CIPHER_CTX *ctx, int arity, int t, int size,
+                 uint64_t *index, int dataSize, uint8_t *data, uint8_t *k0,
+                 uint8_t *k1) {
+  genKaryBigStateDMPF(ctx, arity, t, size, index, dataSize, data, k0, k1);
+}
+
+// Bridge function for the higher-arity key size
+int karyDMPFKeySize(int arity, int t, int size, int dataSize) {
+  return karyBigStateDMPFKeySize(arity, t, size, dataSize);
+}
+
 // Bridge function to evaluate Big State DMPF
 void evalDMPF(EVP_CIPHER_CTX *ctx, uint64_t index, int dataSize,
               uint8_t *dataShare, uint8_t *k) {
@@ -39,6 +74,32 @@ void fullDomainDMPF(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
   fullDomainBigStateDMPF(ctx, k, dataSize, out);
 }
 
+// Bridge function for streaming full domain evaluation
+void fullDomainDMPFStream(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
+                          uint64_t chunkSize, DPFChunkFn visit, void *user) {
+  fullDomainBigStateDMPFStream(ctx, k, dataSize, chunkSize, visit, user);
+}
+
+// Bridge function for truncated domain evaluation
+void truncatedDomainDMPF(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
+                         uint64_t domainSize, uint8_t *out) {
+  truncatedDomainBigStateDMPF(ctx, k, dataSize, domainSize, out);
+}
+
+// Bridge function for streaming truncated domain evaluation
+void truncatedDomainDMPFStream(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize,
+                               uint64_t domainSize, uint64_t chunkSize,
+                               DPFChunkFn visit, void *user) {
+  truncatedDomainBigStateDMPFStream(ctx, k, dataSize, domainSize, chunkSize,
+                                    visit, user);
+}
+
+// Bridge function for range evaluation
+void evalRangeDMPF(EVP_CIPHER_CTX *ctx, uint8_t *k, int dataSize, uint64_t lo,
+                   uint64_t hi, uint8_t *out) {
+  evalRangeBigStateDMPF(ctx, k, dataSize, lo, hi, out);
+}
+
 // Bridge function for compressing Big State DMPF keys
 void compressDMPF(EVP_CIPHER_CTX *ctx, int t, int size, uint64_t *index,
                   int dataSize, uint8_t *data, uint8_t *key) {
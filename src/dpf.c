@@ -12,8 +12,16 @@
 #include "../include/dpf.h"
 #include "../include/common.h"
 #include "../include/mmo.h"
+#include <inttypes.h>
 #include <openssl/rand.h>
 
+static void evalKaryDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x,
+                        int dataSize, uint8_t *dataShare);
+static void fullDomainKaryDPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                              int dataSize, uint8_t *out,
+                              struct DPFChunkStream *stream, uint64_t lo,
+                              uint64_t hi);
+
 /**
   @brief Generates a DPF for a given bit
   @param ctx: the context for the PRG
@@ -27,6 +35,17 @@
 */
 void genDPF(EVP_CIPHER_CTX *ctx, int size, uint64_t index, int dataSize,
             uint8_t *data, unsigned char *k0, unsigned char *k1) {
+  // in packed-leaf mode the tree is depth levels deep and each leaf carries
+  // the outputs of 2^packBits adjacent points
+  uint8_t flags = getKeyFlags(ctx);
+  int packBits = 0;
+  if (flags & KEY_FLAG_PACKED_LEAVES)
+    packBits = packedLeafBits(size, dataSize);
+  if (packBits == 0)
+    flags &= ~KEY_FLAG_PACKED_LEAVES;
+  int depth = size - packBits;
+  int leafSize = dataSize << packBits;
+
   uint128_t seeds0[size + 1];
   uint128_t seeds1[size + 1];
   int bits0[size + 1];
@@ -44,7 +63,7 @@ void genDPF(EVP_CIPHER_CTX *ctx, int size, uint64_t index, int dataSize,
   uint128_t s0[2], s1[2]; // 0=L,1=R
   int t0[2], t1[2];
 
-  for (int i = 1; i <= size; i++) {
+  for (int i = 1; i <= depth; i++) {
     dpfPRG(ctx, seeds0[i - 1], &s0[LEFT], &s0[RIGHT], &t0[LEFT], &t0[RIGHT]);
     dpfPRG(ctx, seeds1[i - 1], &s1[LEFT], &s1[RIGHT], &t1[LEFT], &t1[RIGHT]);
 
@@ -86,65 +105,45 @@ void genDPF(EVP_CIPHER_CTX *ctx, int size, uint64_t index, int dataSize,
     }
   }
 
-  // Allocate memory for data conversion
-  uint8_t *lastCW = (uint8_t *)malloc(dataSize);
-  uint8_t *convert0 = (uint8_t *)malloc(dataSize + 16);
-  uint8_t *convert1 = (uint8_t *)malloc(dataSize + 16);
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  memset(zeros, 0, dataSize + 16);
-  memcpy(lastCW, data, dataSize);
-
-  // Use CTR mode encryption to generate PRG output
-  EVP_CIPHER_CTX *seedCtx0;
-  EVP_CIPHER_CTX *seedCtx1;
-  int len = 0;
-
-  if (!(seedCtx0 = EVP_CIPHER_CTX_new()))
-    printf("errors occurred in creating context\n");
-  if (!(seedCtx1 = EVP_CIPHER_CTX_new()))
-    printf("errors occurred in creating context\n");
-
-  if (1 != EVP_EncryptInit_ex(seedCtx0, EVP_aes_128_ctr(), NULL,
-                              (uint8_t *)&seeds0[size], NULL))
-    printf("errors occurred in init of dpf gen\n");
-  if (1 != EVP_EncryptInit_ex(seedCtx1, EVP_aes_128_ctr(), NULL,
-                              (uint8_t *)&seeds1[size], NULL))
-    printf("errors occurred in init of dpf gen\n");
-
-  if (1 != EVP_EncryptUpdate(seedCtx0, convert0, &len, zeros, dataSize))
-    printf("errors occurred in encrypt\n");
-  if (1 != EVP_EncryptUpdate(seedCtx1, convert1, &len, zeros, dataSize))
-    printf("errors occurred in encrypt\n");
+  // Allocate memory for data conversion; a packed leaf holds data at the
+  // slot of index and zeros elsewhere
+  uint8_t *lastCW = (uint8_t *)malloc(leafSize);
+  uint8_t *convert0 = (uint8_t *)malloc(leafSize + 16);
+  uint8_t *convert1 = (uint8_t *)malloc(leafSize + 16);
+  memset(lastCW, 0, leafSize);
+  memcpy(&lastCW[(index & ((1ULL << packBits) - 1)) * dataSize], data,
+         dataSize);
+
+  // Convert the final seeds in the key mode selected on the context
+  leafConvert(ctx, flags, &seeds0[depth], 1, leafSize, convert0);
+  leafConvert(ctx, flags, &seeds1[depth], 1, leafSize, convert1);
 
   // Calculate final lastCW
-  for (int i = 0; i < dataSize; i++) {
+  for (int i = 0; i < leafSize; i++) {
     lastCW[i] = lastCW[i] ^ ((uint8_t *)convert0)[i] ^ ((uint8_t *)convert1)[i];
   }
 
   // Modify key format to include data
   k0[0] = size;
   memcpy(&k0[1], seeds0, 16);
-  k0[CWSIZE - 1] = bits0[0];
-  for (int i = 1; i <= size; i++) {
+  k0[CWSIZE - 1] = bits0[0] | flags;
+  for (int i = 1; i <= depth; i++) {
     memcpy(&k0[CWSIZE * i], &sCW[i - 1], 16);
     k0[CWSIZE * i + CWSIZE - 2] = tCW0[i - 1];
     k0[CWSIZE * i + CWSIZE - 1] = tCW1[i - 1];
   }
-  memcpy(&k0[CWSIZE * size + CWSIZE], lastCW, dataSize);
+  memcpy(&k0[CWSIZE * depth + CWSIZE], lastCW, leafSize);
 
   // Copy k0 to k1 and modify necessary values
-  memcpy(k1, k0, CWSIZE * size + CWSIZE + dataSize);
+  memcpy(k1, k0, CWSIZE * depth + CWSIZE + leafSize);
   memcpy(&k1[1], seeds1, 16);
   k1[0] = size;
-  k1[17] = bits1[0];
+  k1[17] = bits1[0] | flags;
 
   // Cleanup
   free(lastCW);
   free(convert0);
   free(convert1);
-  free(zeros);
-  EVP_CIPHER_CTX_free(seedCtx0);
-  EVP_CIPHER_CTX_free(seedCtx1);
 }
 
 /**
@@ -164,8 +163,26 @@ void evalDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x, int dataSize,
 
   // dataShare is of size dataSize
 
+  if (IS_HALF_TREE_KEY(k[17])) {
+    printf("errors occurred in parsing key: Half-Tree keys are evaluated with "
+           "evalHalfTreeDPF\n");
+    memset(dataShare, 0, dataSize);
+    return;
+  }
+  if (!checkKeyPRG(ctx, k[17]))
+    return;
+  if (k[17] & KEY_ARITY_MASK) {
+    evalKaryDPF(ctx, k, x, dataSize, dataShare);
+    return;
+  }
+
   int n = k[0];
-  int maxLayer = n;
+  uint8_t flags = k[17] & ~KEY_CONTROL_BIT;
+  int packBits = 0;
+  if (flags & KEY_FLAG_PACKED_LEAVES)
+    packBits = packedLeafBits(n, dataSize);
+  int maxLayer = n - packBits;
+  int leafSize = dataSize << packBits;
 
   uint128_t s[maxLayer + 1];
   int t[maxLayer + 1];
@@ -173,7 +190,7 @@ void evalDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x, int dataSize,
   int tCW[maxLayer][2];
 
   memcpy(&s[0], &k[1], 16);
-  t[0] = k[17];
+  t[0] = k[17] & KEY_CONTROL_BIT;
 
   for (int i = 1; i <= maxLayer; i++) {
     memcpy(&sCW[i - 1], &k[18 * i], 16);
@@ -186,47 +203,246 @@ void evalDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x, int dataSize,
   for (int i = 1; i <= maxLayer; i++) {
     dpfPRG(ctx, s[i - 1], &sL, &sR, &tL, &tR);
 
-    if (t[i - 1] == 1) {
-      sL = sL ^ sCW[i - 1];
-      sR = sR ^ sCW[i - 1];
-      tL = tL ^ tCW[i - 1][0];
-      tR = tR ^ tCW[i - 1][1];
-    }
+    // correct and pick the child on the path to x with masks, not branches
+    uint128_t mask = bitMask(t[i - 1]);
+    sL = sL ^ (sCW[i - 1] & mask);
+    sR = sR ^ (sCW[i - 1] & mask);
+    tL = tL ^ (tCW[i - 1][0] & -t[i - 1]);
+    tR = tR ^ (tCW[i - 1][1] & -t[i - 1]);
 
     int xbit = getbit(x, n, i);
-    if (xbit == 0) {
-      s[i] = sL;
-      t[i] = tL;
-    } else {
-      s[i] = sR;
-      t[i] = tR;
-    }
+    s[i] = selectBlock(xbit, sL, sR);
+    t[i] = selectBit(xbit, tL, tR);
+  }
+
+  if (packBits > 0) {
+    // convert the whole packed leaf and keep the slot of x
+    uint8_t leaf[16];
+    int slot = (x & ((1ULL << packBits) - 1)) * dataSize;
+    leafConvert(ctx, flags, &s[maxLayer], 1, leafSize, leaf);
+    xorIfSet(leaf, &k[18 * maxLayer + 18], leafSize, t[maxLayer]);
+    memcpy(dataShare, &leaf[slot], dataSize);
+    return;
   }
 
   // Generate dataShare using PRG with the final seed
-  int len = 0;
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  memset(zeros, 0, dataSize + 16);
-
-  EVP_CIPHER_CTX *seedCtx;
-  if (!(seedCtx = EVP_CIPHER_CTX_new()))
-    printf("errors occurred in creating context\n");
-  if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                              (uint8_t *)&s[maxLayer], NULL))
-    printf("errors occurred in init of dpf eval\n");
-  if (1 != EVP_EncryptUpdate(seedCtx, dataShare, &len, zeros, dataSize))
-    printf("errors occurred in encrypt\n");
-
-  // If t[maxLayer] == 1, xor in the correction word (lastCW) from the key
-  if (t[maxLayer] == 1) {
-    // The correction word is at the end of the key: offset = 18 * n + 18
-    for (int i = 0; i < dataSize; i++) {
-      dataShare[i] ^= k[18 * n + 18 + i];
+  leafConvert(ctx, flags, &s[maxLayer], 1, dataSize, dataShare);
+
+  // If t[maxLayer] == 1, xor in the correction word (lastCW) from the key,
+  // which is at the end of the key: offset = 18 * n + 18
+  xorIfSet(dataShare, &k[18 * n + 18], dataSize, t[maxLayer]);
+}
+
+// A fullDomainDPF run: the parsed key, the output and the next subtree
+// block to convert, which workers claim one at a time
+struct DPFFullDomain {
+  EVP_CIPHER_CTX *ctx;
+  const uint128_t *cwL, *cwR;
+  uint128_t root, packedRoot;
+  int maxLayer, topLevels, blockLevels, leafSize;
+  uint8_t flags;
+  const uint8_t *lastCW;
+  uint8_t *out;                  // NULL when streaming
+  uint64_t outBytes;             // size of out, which may end mid-block
+  struct DPFChunkStream *stream; // receives the blocks in order if set
+  uint64_t next, last;           // next block to claim, end of the blocks
+};
+
+// Leaves converted per leafConvert call of a run
+static uint64_t dpfLeafBatch(const struct DPFFullDomain *run) {
+  uint64_t blockLeaves = 1ULL << run->blockLevels;
+  uint64_t batch = LEAF_BLOCK_BYTES / run->leafSize;
+  if (batch < PRG_BATCH)
+    batch = PRG_BATCH;
+  if (batch > blockLeaves)
+    batch = blockLeaves;
+  return batch;
+}
+
+// Converts the expanded leaves of a block of run into blockOut, batch at a
+// time through leafSeeds and leafBits
+static void dpfConvertBlock(EVP_CIPHER_CTX *ctx,
+                            const struct DPFFullDomain *run,
+                            const uint128_t *leaves, uint8_t *blockOut,
+                            uint64_t batch, uint128_t *leafSeeds,
+                            uint8_t *leafBits) {
+  int leafSize = run->leafSize;
+  uint64_t blockLeaves = 1ULL << run->blockLevels;
+
+  // split the leaves into seed and control bit a batch at a time
+  for (uint64_t i = 0; i < blockLeaves; i += batch) {
+    uint64_t m = blockLeaves - i < batch ? blockLeaves - i : batch;
+    for (uint64_t l = 0; l < m; l++) {
+      leafBits[l] = lsb(leaves[i + l]);
+      // a tree without levels converts the root exactly as stored in the key
+      leafSeeds[l] = run->maxLayer ? set_lsb_zero(leaves[i + l]) : run->root;
     }
+    leafConvert(ctx, run->flags, leafSeeds, m, leafSize,
+                blockOut + i * leafSize);
+
+    // Apply correction word if needed: the bit is the number of rows to fold
+    for (uint64_t l = 0; l < m; l++)
+      xorRows(blockOut + (i + l) * leafSize, &run->lastCW, leafBits[l],
+              leafSize);
+  }
+}
+
+// Claims blocks of run until none are left and converts them with ctx
+static void fullDomainDPFBlocks(EVP_CIPHER_CTX *ctx,
+                                struct DPFFullDomain *run) {
+  int leafSize = run->leafSize;
+  uint64_t blockLeaves = 1ULL << run->blockLevels;
+  uint128_t *buf0 = malloc(sizeof(uint128_t) * blockLeaves);
+  uint128_t *buf1 = malloc(sizeof(uint128_t) * blockLeaves);
+
+  uint64_t batch = dpfLeafBatch(run);
+  uint128_t *leafSeeds = malloc(sizeof(uint128_t) * batch);
+  uint8_t *leafBits = malloc(batch);
+  // a stream gets every block, and out the block that overhangs its end,
+  // through the same buffer
+  uint64_t blockBytes = blockLeaves * leafSize;
+  uint8_t *blockBuf =
+      run->stream || run->outBytes % blockBytes ? malloc(blockBytes) : NULL;
+
+  // the walk moves on from block to block and only restarts from the root
+  // when another worker took the blocks in between
+  struct DPFWalk walk;
+  uint64_t block, prev = 0;
+  int started = 0;
+  while ((block = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) <
+         run->last) {
+    if (started && block == prev + 1)
+      dpfWalkNext(ctx, &walk, run->cwL, run->cwR, block);
+    else
+      dpfWalkStart(ctx, &walk, run->packedRoot, run->cwL, run->cwR,
+                   run->topLevels, block);
+    started = 1;
+    prev = block;
+
+    uint128_t *leaves = dpfExpandSubtree(
+        ctx, walk.path[run->topLevels], run->cwL + run->topLevels,
+        run->cwR + run->topLevels, run->blockLevels, buf0, buf1);
+    uint64_t offset = block * blockBytes;
+    uint8_t *blockOut = run->stream || offset + blockBytes > run->outBytes
+                            ? blockBuf
+                            : run->out + offset;
+    dpfConvertBlock(ctx, run, leaves, blockOut, batch, leafSeeds, leafBits);
+    if (run->stream)
+      chunkStreamPush(run->stream, blockBuf,
+                      blockBytes / run->stream->dataSize);
+    else if (blockOut == blockBuf)
+      memcpy(run->out + offset, blockBuf, run->outBytes - offset);
+  }
+
+  free(leafSeeds);
+  free(leafBits);
+  free(blockBuf);
+  free(buf0);
+  free(buf1);
+}
+
+// A worker of a parallel run, with a cipher context of its own
+static void fullDomainDPFTask(void *arg, int worker) {
+  (void)worker;
+  struct DPFFullDomain *run = (struct DPFFullDomain *)arg;
+  EVP_CIPHER_CTX *workerCtx = cloneDPFContext(run->ctx);
+  fullDomainDPFBlocks(workerCtx, run);
+  destroyContext(workerCtx);
+}
+
+// Parses binary key k into run, for the blocks that cover points [lo, hi);
+// cwL and cwR receive the folded CWs and must hold size + 1 entries
+static void fullDomainDPFSetup(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                               int dataSize, uint64_t lo, uint64_t hi,
+                               uint128_t *cwL, uint128_t *cwR,
+                               struct DPFFullDomain *run) {
+  // with packed leaves there are 2^(size - packBits) leaves, each holding the
+  // outputs of 2^packBits consecutive points, so they convert straight to out
+  uint8_t flags = k[17] & ~KEY_CONTROL_BIT;
+  int packBits = 0;
+  if (flags & KEY_FLAG_PACKED_LEAVES)
+    packBits = packedLeafBits(size, dataSize);
+  int leafSize = dataSize << packBits;
+
+  int n = size - packBits;
+  int maxLayer = n;
+
+  // every node keeps its control bit in the lsb of its seed, which the PRG
+  // ignores, and seed CWs have a zero lsb, which carries the control bit CW
+  // of each child
+  for (int i = 1; i <= maxLayer; i++) {
+    uint128_t sCW;
+    memcpy(&sCW, &k[18 * i], 16);
+    cwL[i - 1] = sCW ^ k[18 * i + 16];
+    cwR[i - 1] = sCW ^ k[18 * i + 17];
+  }
+
+  uint128_t root;
+  memcpy(&root, &k[1], 16);
+
+  // walk the top levels depth first down to the roots of subtrees of
+  // 2^blockLevels leaves, which are expanded breadth first and converted in
+  // order; only O(size + block) seeds are live at any time. With several
+  // threads (setFullDomainThreads) every worker converts whole blocks into
+  // its own slice of out. A range only visits the blocks it intersects,
+  // which are no larger than the range itself.
+  uint64_t leafLo = lo >> packBits, leafHi = ((hi - 1) >> packBits) + 1;
+  int blockLevels = n < DPF_BLOCK_LEVELS ? n : DPF_BLOCK_LEVELS;
+  while ((1ULL << blockLevels) > leafHi - leafLo)
+    blockLevels--;
+
+  run->ctx = ctx;
+  run->cwL = cwL;
+  run->cwR = cwR;
+  run->root = root;
+  run->packedRoot = set_lsb_zero(root) | (k[17] & KEY_CONTROL_BIT);
+  run->maxLayer = maxLayer;
+  run->blockLevels = blockLevels;
+  run->topLevels = n - blockLevels;
+  run->leafSize = leafSize;
+  run->flags = flags;
+  run->lastCW = &k[18 * n + 18];
+  run->out = NULL;
+  run->outBytes = 0;
+  run->stream = NULL;
+  run->next = leafLo >> blockLevels;
+  run->last = ((leafHi - 1) >> blockLevels) + 1;
+}
+
+// Evaluates points [0, hi) of k into out, or, if out is NULL, the blocks
+// that cover points [lo, hi) into stream. Blocks past hi are never expanded.
+static void fullDomainDPFRun(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                             int dataSize, uint8_t *out,
+                             struct DPFChunkStream *stream, uint64_t lo,
+                             uint64_t hi) {
+  if (IS_HALF_TREE_KEY(k[17])) {
+    printf("errors occurred in parsing key: Half-Tree keys are evaluated with "
+           "fullDomainHalfTreeDPF\n");
+    if (out)
+      memset(out, 0, hi * dataSize);
+    return;
+  }
+  if (!checkKeyPRG(ctx, k[17]))
+    return;
+  if (k[17] & KEY_ARITY_MASK) {
+    fullDomainKaryDPF(ctx, k, dataSize, out, stream, lo, hi);
+    return;
   }
 
-  free(zeros);
-  EVP_CIPHER_CTX_free(seedCtx);
+  struct DPFFullDomain run;
+  uint128_t cwL[size + 1], cwR[size + 1];
+  fullDomainDPFSetup(ctx, size, k, dataSize, lo, hi, cwL, cwR, &run);
+  run.out = out;
+  run.outBytes = out ? hi * dataSize : 0;
+  run.stream = stream;
+  if (stream)
+    stream->next = (run.next << run.blockLevels) * (run.leafSize / dataSize);
+
+  // a stream is fed in order by the calling thread
+  if (getFullDomainThreads(ctx) > 1 && run.last - run.next > 1 && !stream)
+    runParallel(ctx, fullDomainDPFTask, &run);
+  else
+    fullDomainDPFBlocks(ctx, &run);
 }
 
 /**
@@ -242,88 +458,496 @@ void evalDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x, int dataSize,
 void fullDomainDPF(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
                    int dataSize, uint8_t *out) {
   // out must have at least (1 << size) * dataSize bytes
+  fullDomainDPFRun(ctx, size, k, dataSize, out, NULL, 0, 1ULL << size);
+}
 
-  int numLeaves = 1 << size;
-  int n = size;
-  int maxLayer = n;
+/**
+  @brief Full domain evaluation that streams the output instead of storing it
+  @param ctx: the context for the PRG
+  @param size: the size of the domain
+  @param k: the key for the DPF
+  @param dataSize: the size of the data to be evaluated
+  @param chunkSize: the number of points per call of visit
+  @param visit: called with the shares of each chunk, in order
+  @param user: passed to visit
+  @return: void
+*/
+void fullDomainDPFStream(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                         int dataSize, uint64_t chunkSize, DPFChunkFn visit,
+                         void *user) {
+  struct DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  fullDomainDPFRun(ctx, size, k, dataSize, NULL, &stream, 0, 1ULL << size);
+  chunkStreamFinish(&stream);
+}
 
-  int currLevel = 0;
-  int levelIndex = 0;
-  int numIndexesInLevel = 2;
+// A lockstep fullDomainDPFMulti run over keys of the same shape: block b of
+// every key is expanded at once
+struct DPFMultiFullDomain {
+  EVP_CIPHER_CTX *ctx;
+  struct DPFFullDomain *runs;
+  int numKeys;
+  uint64_t next, last; // next block to claim, end of the blocks
+};
+
+// Moves the walks of all keys of multi down from level `from` to node index
+// of their depth together: each level is one dpfPRGBatchPacked call over the
+// nodes of all keys
+static void dpfMultiWalkDescend(EVP_CIPHER_CTX *ctx,
+                                const struct DPFMultiFullDomain *multi,
+                                struct DPFWalk *walks, int from,
+                                uint64_t index, uint128_t *nodes,
+                                uint128_t *sL, uint128_t *sR) {
+  int depth = multi->runs[0].topLevels;
+  for (int d = from; d <= depth; d++) {
+    for (int i = 0; i < multi->numKeys; i++)
+      nodes[i] = walks[i].path[d - 1];
+    dpfPRGBatchPacked(ctx, nodes, multi->numKeys, sL, sR);
+
+    int bit = (index >> (depth - d)) & 1;
+    for (int i = 0; i < multi->numKeys; i++) {
+      const struct DPFFullDomain *run = &multi->runs[i];
+      uint128_t mask = bitMask(lsb(nodes[i]));
+      uint128_t left = sL[i] ^ (run->cwL[d - 1] & mask);
+      walks[i].right[d] = sR[i] ^ (run->cwR[d - 1] & mask);
+      walks[i].path[d] = selectBlock(bit, left, walks[i].right[d]);
+    }
+  }
+}
 
-  int treeSize = 2 * numLeaves - 1;
+// Claims blocks of multi until none are left. The keys' trees are walked
+// and expanded together: on every level, from the root down to the leaves
+// of a block, the seeds of all keys lie side by side ([level][key * width])
+// and go through one dpfPRGBatchPacked call, so each PRG batch is full
+// however narrow the level. Blocks are sized so that the seeds of all keys
+// together take one block of a single key.
+static void fullDomainDPFMultiBlocks(EVP_CIPHER_CTX *ctx,
+                                     struct DPFMultiFullDomain *multi) {
+  int numKeys = multi->numKeys;
+  const struct DPFFullDomain *runs = multi->runs;
+  int topLevels = runs[0].topLevels, blockLevels = runs[0].blockLevels;
+  uint64_t blockLeaves = 1ULL << blockLevels;
+  uint64_t blockBytes = blockLeaves * runs[0].leafSize;
+  uint64_t layer = (uint64_t)numKeys << blockLevels;
+  uint64_t keys = numKeys;
+  uint64_t half = layer / 2 > keys ? layer / 2 : keys;
+
+  uint128_t *buf0 = malloc(sizeof(uint128_t) * layer);
+  uint128_t *buf1 = malloc(sizeof(uint128_t) * layer);
+  uint128_t *sL = malloc(sizeof(uint128_t) * half);
+  uint128_t *sR = malloc(sizeof(uint128_t) * half);
+  struct DPFWalk *walks = malloc(sizeof(struct DPFWalk) * numKeys);
+  uint128_t roots[numKeys];
+  const uint128_t *cwL[numKeys], *cwR[numKeys];
+  for (int i = 0; i < numKeys; i++) {
+    walks[i].depth = topLevels;
+    walks[i].path[0] = runs[i].packedRoot;
+    cwL[i] = runs[i].cwL + topLevels;
+    cwR[i] = runs[i].cwR + topLevels;
+  }
 
-  uint128_t *s = malloc(sizeof(uint128_t) * treeSize);
-  int *t = malloc(sizeof(int) * treeSize);
-  uint128_t sCW[maxLayer + 1];
-  int tCW[maxLayer + 1][2];
+  uint64_t batch = dpfLeafBatch(&runs[0]);
+  uint128_t *leafSeeds = malloc(sizeof(uint128_t) * batch);
+  uint8_t *leafBits = malloc(batch);
+
+  uint64_t block, prev = 0;
+  int started = 0;
+  while ((block = __atomic_fetch_add(&multi->next, 1, __ATOMIC_RELAXED)) <
+         multi->last) {
+    // as dpfWalkNext: a step to the next block restarts the walks below the
+    // level of its lowest set bit, a jump restarts them from the root
+    int from = 1;
+    if (started && block == prev + 1) {
+      from = topLevels - __builtin_ctzll(block);
+      for (int i = 0; i < numKeys; i++)
+        walks[i].path[from] = walks[i].right[from];
+      from++;
+    }
+    dpfMultiWalkDescend(ctx, multi, walks, from, block, roots, sL, sR);
+    for (int i = 0; i < numKeys; i++)
+      roots[i] = walks[i].path[topLevels];
+    started = 1;
+    prev = block;
+
+    // the leaves of key i come back at i * blockLeaves
+    uint128_t *leaves = dpfExpandSubtrees(ctx, numKeys, roots, cwL, cwR,
+                                          blockLevels, buf0, buf1, sL, sR);
+    for (int i = 0; i < numKeys; i++)
+      dpfConvertBlock(ctx, &runs[i], leaves + i * blockLeaves,
+                      runs[i].out + block * blockBytes, batch, leafSeeds,
+                      leafBits);
+  }
 
-  memcpy(&s[0], &k[1], 16);
-  t[0] = k[17];
+  free(leafSeeds);
+  free(leafBits);
+  free(walks);
+  free(buf0);
+  free(buf1);
+  free(sL);
+  free(sR);
+}
 
-  for (int i = 1; i <= maxLayer; i++) {
-    memcpy(&sCW[i - 1], &k[18 * i], 16);
-    tCW[i - 1][0] = k[18 * i + 16];
-    tCW[i - 1][1] = k[18 * i + 17];
+// A worker of a parallel lockstep run, with a cipher context of its own
+static void fullDomainDPFMultiTask(void *arg, int worker) {
+  (void)worker;
+  struct DPFMultiFullDomain *multi = (struct DPFMultiFullDomain *)arg;
+  EVP_CIPHER_CTX *workerCtx = cloneDPFContext(multi->ctx);
+  fullDomainDPFMultiBlocks(workerCtx, multi);
+  destroyContext(workerCtx);
+}
+
+/**
+  @brief Full domain evaluation of several keys over the same domain in
+  lockstep: the keys' trees are walked together and every layer interleaves
+  their seeds, so each PRG batch is filled from all of them
+  @param ctx: the context for the PRG
+  @param size: the size of the domain
+  @param keys: the numKeys keys, made with the same flags and dataSize
+  @param numKeys: the number of keys
+  @param dataSize: the size of the data to be evaluated
+  @param outs: the outputs, (1 << size) * dataSize bytes for each key
+  @return: void
+*/
+void fullDomainDPFMulti(EVP_CIPHER_CTX *ctx, int size, unsigned char **keys,
+                        int numKeys, int dataSize, uint8_t **outs) {
+  for (int i = 0; i < numKeys; i++)
+    if (!checkKeyPRG(ctx, keys[i][17]))
+      return;
+
+  // keys of another shape or arity have trees of their own
+  int lockstep = 1;
+  for (int i = 0; i < numKeys; i++)
+    if ((keys[i][17] & KEY_ARITY_MASK) ||
+        ((keys[i][17] ^ keys[0][17]) & ~KEY_CONTROL_BIT))
+      lockstep = 0;
+  if (!lockstep) {
+    for (int i = 0; i < numKeys; i++)
+      fullDomainDPF(ctx, size, keys[i], dataSize, outs[i]);
+    return;
   }
 
-  uint128_t sL, sR;
-  int tL, tR;
-  for (int i = 1; i < treeSize; i += 2) {
-    int parentIndex = 0;
-    if (i > 1) {
-      parentIndex = i - levelIndex - ((numIndexesInLevel - levelIndex) / 2);
+  // groups of DPF_LOCKSTEP_KEYS bound the seeds live per block
+  for (int first = 0; first < numKeys; first += DPF_LOCKSTEP_KEYS) {
+    int n = numKeys - first < DPF_LOCKSTEP_KEYS ? numKeys - first
+                                                : DPF_LOCKSTEP_KEYS;
+    struct DPFFullDomain runs[n];
+    uint128_t *cws = malloc(sizeof(uint128_t) * 2 * n * (size + 1));
+    // blocks of 2^blockLevels leaves per key keep the n layers of a block
+    // within the 2^DPF_BLOCK_LEVELS seeds of one fullDomainDPF block
+    int keyBits = 0;
+    while ((1 << keyBits) < n)
+      keyBits++;
+    for (int i = 0; i < n; i++) {
+      uint128_t *cwL = cws + 2 * i * (size + 1), *cwR = cwL + size + 1;
+      fullDomainDPFSetup(ctx, size, keys[first + i], dataSize, 0, 1ULL << size,
+                         cwL, cwR, &runs[i]);
+      int blockLevels = DPF_BLOCK_LEVELS - keyBits;
+      if (blockLevels > runs[i].maxLayer)
+        blockLevels = runs[i].maxLayer;
+      runs[i].blockLevels = blockLevels;
+      runs[i].topLevels = runs[i].maxLayer - blockLevels;
+      runs[i].next = 0;
+      runs[i].last = 1ULL << runs[i].topLevels;
+      runs[i].out = outs[first + i];
     }
 
-    dpfPRG(ctx, s[parentIndex], &sL, &sR, &tL, &tR);
+    struct DPFMultiFullDomain multi = {ctx, runs, n, runs[0].next,
+                                       runs[0].last};
+    if (getFullDomainThreads(ctx) > 1 && multi.last > 1)
+      runParallel(ctx, fullDomainDPFMultiTask, &multi);
+    else
+      fullDomainDPFMultiBlocks(ctx, &multi);
+    free(cws);
+  }
+}
 
-    if (t[parentIndex] == 1) {
-      sL = sL ^ sCW[currLevel];
-      sR = sR ^ sCW[currLevel];
-      tL = tL ^ tCW[currLevel][0];
-      tR = tR ^ tCW[currLevel][1];
-    }
+/**
+  @brief Full domain evaluation of the first domainSize points only, for
+  tables whose size is not a power of two; subtrees past the bound are not
+  expanded
+  @param ctx: the context for the PRG
+  @param size: the size of the domain
+  @param k: the key for the DPF
+  @param dataSize: the size of the data to be evaluated
+  @param domainSize: the number of points, at most 1 << size
+  @param out: the output, domainSize * dataSize bytes
+  @return: void
+*/
+void truncatedDomainDPF(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                        int dataSize, uint64_t domainSize, uint8_t *out) {
+  if (domainSize == 0 || domainSize > (1ULL << size)) {
+    printf("invalid domain size %" PRIu64 "\n", domainSize);
+    return;
+  }
+  fullDomainDPFRun(ctx, size, k, dataSize, out, NULL, 0, domainSize);
+}
 
-    int lIndex = i;
-    int rIndex = i + 1;
-    s[lIndex] = sL;
-    t[lIndex] = tL;
-    s[rIndex] = sR;
-    t[rIndex] = tR;
-
-    levelIndex += 2;
-    if (levelIndex == numIndexesInLevel) {
-      currLevel++;
-      numIndexesInLevel *= 2;
-      levelIndex = 0;
-    }
+/**
+  @brief truncatedDomainDPF that streams the output instead of storing it
+  @param ctx: the context for the PRG
+  @param size: the size of the domain
+  @param k: the key for the DPF
+  @param dataSize: the size of the data to be evaluated
+  @param domainSize: the number of points, at most 1 << size
+  @param chunkSize: the number of points per call of visit
+  @param visit: called with the shares of each chunk, in order
+  @param user: passed to visit
+  @return: void
+*/
+void truncatedDomainDPFStream(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                              int dataSize, uint64_t domainSize,
+                              uint64_t chunkSize, DPFChunkFn visit,
+                              void *user) {
+  if (domainSize == 0 || domainSize > (1ULL << size)) {
+    printf("invalid domain size %" PRIu64 "\n", domainSize);
+    return;
   }
+  struct DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  stream.end = domainSize;
+  fullDomainDPFRun(ctx, size, k, dataSize, NULL, &stream, 0, domainSize);
+  chunkStreamFinish(&stream);
+}
 
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  memset(zeros, 0, dataSize + 16);
-
-  EVP_CIPHER_CTX *seedCtx;
-  if (!(seedCtx = EVP_CIPHER_CTX_new()))
-    printf("errors occurred in creating context\n");
-
-  for (int i = 0; i < numLeaves; i++) {
-    int len = 0;
-    int index = treeSize - numLeaves + i;
-
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&s[index], NULL))
-      printf("errors occurred in init of dpf eval\n");
-    if (1 !=
-        EVP_EncryptUpdate(seedCtx, out + i * dataSize, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
-    // Apply correction word if needed
-    if (t[index] == 1) {
-      for (int j = 0; j < dataSize; j++) {
-        out[i * dataSize + j] ^= k[18 * n + 18 + j];
+/**
+  @brief Evaluates the points [lo, hi) only, walking just the subtrees that
+  cover them
+  @param ctx: the context for the PRG
+  @param size: the size of the domain
+  @param k: the key for the DPF
+  @param dataSize: the size of the data to be evaluated
+  @param lo: the first point
+  @param hi: the end of the range, at most 1 << size
+  @param out: the output, (hi - lo) * dataSize bytes for points lo..hi-1
+  @return: void
+*/
+void evalRangeDPF(EVP_CIPHER_CTX *ctx, int size, unsigned char *k,
+                  int dataSize, uint64_t lo, uint64_t hi, uint8_t *out) {
+  if (lo >= hi || hi > (1ULL << size)) {
+    printf("invalid range [%" PRIu64 ", %" PRIu64 ")\n", lo, hi);
+    return;
+  }
+
+  // every block comes through the stream whole and the visitor keeps the
+  // part inside the range
+  struct DPFRangeOut range = {out, lo, hi, dataSize};
+  struct DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, 1ULL << DPF_BLOCK_LEVELS,
+                       copyRangeChunk, &range))
+    return;
+  fullDomainDPFRun(ctx, size, k, dataSize, NULL, &stream, lo, hi);
+  chunkStreamFinish(&stream);
+}
+
+/**
+  @brief Returns the size in bytes of each key made by genKaryDPF
+  @param arity: the tree arity (2, 4 or 8)
+  @param size: the size of the domain
+  @param dataSize: the size of the data
+  @return: the key size, or -1 for an unsupported arity
+*/
+int karyDPFKeySize(int arity, int size, int dataSize) {
+  int arityBits = karyArityBits(arity);
+  if (arityBits == 0)
+    return -1;
+  if (arityBits == 1)
+    return CWSIZE * size + CWSIZE + dataSize;
+
+  int cws = 0;
+  for (int l = 0; l < karyLevels(size, arityBits); l++)
+    cws += 1 << karyLevelBits(size, arityBits, l);
+  return CWSIZE + KARY_CW_SIZE * cws + dataSize;
+}
+
+/**
+  @brief Generates DPF keys on a tree of arity 4 or 8
+  Every level consumes log2(arity) bits of the index (the top level takes the
+  remainder), so evaluating a point takes size / log2(arity) sequential AES
+  calls. Each level carries one correction word per child. Arity 2 produces
+  regular genDPF keys.
+  @param ctx: the context for the PRG
+  @param arity: the tree arity (2, 4 or 8)
+  @param size: the size of the domain
+  @param index: the index to be evaluated
+  @param dataSize: the size of the data to be evaluated
+  @param data: the data to be evaluated
+  @param k0: the key for the server A (karyDPFKeySize bytes)
+  @param k1: the key for the server B (karyDPFKeySize bytes)
+  @return: void
+*/
+void genKaryDPF(EVP_CIPHER_CTX *ctx, int arity, int size, uint64_t index,
+                int dataSize, uint8_t *data, unsigned char *k0,
+                unsigned char *k1) {
+  int arityBits = karyArityBits(arity);
+  if (arityBits == 0) {
+    printf("errors occurred in genKaryDPF: unsupported arity %d\n", arity);
+    return;
+  }
+  if (arityBits == 1) {
+    genDPF(ctx, size, index, dataSize, data, k0, k1);
+    return;
+  }
+
+  uint128_t seeds[2];
+  int bits[2];
+  seeds[0] = getRandomBlock();
+  seeds[1] = getRandomBlock();
+  bits[0] = 0;
+  bits[1] = 1;
+  uint128_t root1 = seeds[1];
+
+  uint8_t flags = (getKeyFlags(ctx) & ~KEY_FLAG_PACKED_LEAVES) |
+                  ((arityBits - 1) << KEY_ARITY_SHIFT);
+  k0[0] = size;
+  memcpy(&k0[1], &seeds[0], 16);
+  k0[CWSIZE - 1] = bits[0] | flags;
+
+  uint128_t children[16];
+  int childBits[16];
+  unsigned char *cw = &k0[CWSIZE];
+  int remaining = size;
+  for (int l = 0; l < karyLevels(size, arityBits); l++) {
+    int levelBits = karyLevelBits(size, arityBits, l);
+    int width = 1 << levelBits;
+    remaining -= levelBits;
+    int digit = (index >> remaining) & (width - 1);
+
+    // children of party 0 in [0, width), of party 1 in [width, 2 * width)
+    karyPRGBatch(ctx, levelBits, 1, seeds, 2, children, childBits);
+
+    uint128_t keepCW = 0;
+    int keepTCW = 0;
+    for (int c = 0; c < width; c++) {
+      uint128_t sCW;
+      int tCW = childBits[c] ^ childBits[width + c];
+      if (c == digit) {
+        sCW = set_lsb_zero(getRandomBlock());
+        tCW ^= 1;
+        keepCW = sCW;
+        keepTCW = tCW;
+      } else {
+        sCW = children[c] ^ children[width + c];
       }
+      memcpy(cw, &sCW, 16);
+      cw[16] = tCW;
+      cw += KARY_CW_SIZE;
     }
+
+    for (int b = 0; b < 2; b++) {
+      uint128_t seed = children[b * width + digit];
+      int bit = childBits[b * width + digit];
+      if (bits[b] == 1) {
+        seed ^= keepCW;
+        bit ^= keepTCW;
+      }
+      seeds[b] = seed;
+      bits[b] = bit;
+    }
+  }
+
+  uint8_t *convert0 = (uint8_t *)malloc(dataSize + 16);
+  uint8_t *convert1 = (uint8_t *)malloc(dataSize + 16);
+  leafConvert(ctx, flags, &seeds[0], 1, dataSize, convert0);
+  leafConvert(ctx, flags, &seeds[1], 1, dataSize, convert1);
+  for (int i = 0; i < dataSize; i++)
+    cw[i] = data[i] ^ convert0[i] ^ convert1[i];
+
+  int keySize = karyDPFKeySize(arity, size, dataSize);
+  memcpy(k1, k0, keySize);
+  memcpy(&k1[1], &root1, 16);
+  k1[CWSIZE - 1] = 1 | flags;
+
+  free(convert0);
+  free(convert1);
+}
+
+// Parses the arity of a genKaryDPF key and returns the offset of its last CW
+static int karyDPFLastCW(unsigned char *k, int *arityBits) {
+  *arityBits = ((k[CWSIZE - 1] & KEY_ARITY_MASK) >> KEY_ARITY_SHIFT) + 1;
+  return karyDPFKeySize(1 << *arityBits, k[0], 0);
+}
+
+/**
+  @brief Evaluates a higher-arity DPF key at one point; only the child on the
+  path is computed, so this costs one AES call per level
+*/
+static void evalKaryDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x,
+                        int dataSize, uint8_t *dataShare) {
+  int size = k[0];
+  int arityBits;
+  int lastCW = karyDPFLastCW(k, &arityBits);
+  uint8_t flags = k[CWSIZE - 1] & ~KEY_CONTROL_BIT;
+
+  uint128_t seed;
+  memcpy(&seed, &k[1], 16);
+  int bit = k[CWSIZE - 1] & KEY_CONTROL_BIT;
+
+  unsigned char *cw = &k[CWSIZE];
+  int remaining = size;
+  for (int l = 0; l < karyLevels(size, arityBits); l++) {
+    int levelBits = karyLevelBits(size, arityBits, l);
+    remaining -= levelBits;
+    int digit = (x >> remaining) & ((1 << levelBits) - 1);
+
+    int childBit;
+    karyPRG(ctx, levelBits, 1, seed, digit, &seed, &childBit);
+    uint128_t sCW;
+    memcpy(&sCW, &cw[digit * KARY_CW_SIZE], 16);
+    seed ^= sCW & bitMask(bit);
+    childBit ^= cw[digit * KARY_CW_SIZE + 16] & -bit;
+    bit = childBit;
+    cw += KARY_CW_SIZE << levelBits;
+  }
+
+  leafConvert(ctx, flags, &seed, 1, dataSize, dataShare);
+  xorIfSet(dataShare, &k[lastCW], dataSize, bit);
+}
+
+// Per-child CWs of one level of a genKaryDPF key. A DPF node has a single
+// control bit, so every parent with it set gets the same ones.
+static void karyDPFLevelCW(const struct KaryTree *tree, int level, int bits,
+                           uint128_t *sCW, int *tCW) {
+  (void)bits;
+  const unsigned char *cw = tree->levelCWs[level];
+  int arity = 1 << karyLevelBits(tree->size, tree->arityBits, level);
+  for (int c = 0; c < arity; c++) {
+    memcpy(&sCW[c], &cw[c * KARY_CW_SIZE], 16);
+    tCW[c] = cw[c * KARY_CW_SIZE + 16];
   }
+}
 
-  free(zeros);
-  EVP_CIPHER_CTX_free(seedCtx);
+// Parses a genKaryDPF key for karyFullDomain
+static void karyDPFTree(unsigned char *k, struct KaryTree *tree) {
+  int arityBits;
+  int lastCW = karyDPFLastCW(k, &arityBits);
+  tree->size = k[0];
+  tree->arityBits = arityBits;
+  tree->t = 1;
+  memcpy(&tree->root, &k[1], 16);
+  tree->rootBits = k[CWSIZE - 1] & KEY_CONTROL_BIT;
+  tree->flags = k[CWSIZE - 1] & ~KEY_CONTROL_BIT;
+  tree->lastCWs = &k[lastCW];
+  tree->levelCW = karyDPFLevelCW;
+
+  const unsigned char *cw = &k[CWSIZE];
+  for (int l = 0; l < karyLevels(tree->size, arityBits); l++) {
+    tree->levelCWs[l] = cw;
+    cw += KARY_CW_SIZE << karyLevelBits(tree->size, arityBits, l);
+  }
+}
+
+/**
+  @brief Full domain evaluation of a higher-arity DPF key, in blocks of
+  whole levels like the binary tree (karyFullDomain): points [0, hi) into
+  out, or the blocks that cover points [lo, hi) into stream if out is NULL
+*/
+static void fullDomainKaryDPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                              int dataSize, uint8_t *out,
+                              struct DPFChunkStream *stream, uint64_t lo,
+                              uint64_t hi) {
+  struct KaryTree tree;
+  karyDPFTree(k, &tree);
+  karyFullDomain(ctx, &tree, dataSize, out, stream, lo, hi);
 }
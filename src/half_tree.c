@@ -0,0 +1,226 @@
+// Half-Tree DPF from:
+// "Half-Tree: Halving the Cost of Tree Expansion in COT and DPF"
+// by Xiaojie Guo, Kang Yang, Xiao Wang, Wenhao Zhang, Xiang Xie, Jiang Zhang
+// and Zheli Liu. EUROCRYPT 2023.
+//
+// The parties' seeds differ by a global offset Delta (lsb(Delta) = 1) on the
+// path to the special index and agree everywhere else. A node s expands to
+//   left  = H(s) ^ t * CW
+//   right = H(s) ^ s ^ t * CW
+// where H is the fixed-key correlation-robust hash and t = lsb(s) is the
+// control bit, so every node costs a single AES call.
+
+#include "../include/common.h"
+#include "../include/dpf.h"
+
+// Returns the size stored in a Half-Tree key, or -1 if k is not one
+static int halfTreeKeySize(unsigned char *k) {
+  if (!IS_HALF_TREE_KEY(k[HALF_TREE_HEAD_SIZE - 1])) {
+    printf("errors occurred in parsing key: not a Half-Tree DPF key\n");
+    return -1;
+  }
+  return k[0];
+}
+
+/**
+  @brief Generates Half-Tree DPF keys for a point function
+  @param ctx: the context for the PRG
+  @param size: the size of the domain
+  @param index: the special index
+  @param dataSize: the size of the data
+  @param data: the value at the special index
+  @param k0: the key for the server A (HALF_TREE_KEY_SIZE bytes)
+  @param k1: the key for the server B (HALF_TREE_KEY_SIZE bytes)
+  @return: void
+*/
+void genHalfTreeDPF(EVP_CIPHER_CTX *ctx, int size, uint64_t index,
+                    int dataSize, uint8_t *data, unsigned char *k0,
+                    unsigned char *k1) {
+  uint128_t delta = getRandomBlock() | 1;
+  uint128_t s[2], h[2];
+  s[0] = getRandomBlock();
+  s[1] = s[0] ^ delta;
+
+  uint8_t flags = getKeyFlags(ctx) & ~KEY_FLAG_PACKED_LEAVES;
+  k0[0] = size;
+  memcpy(&k0[1], &s[0], 16);
+  k0[HALF_TREE_HEAD_SIZE - 1] = flags | KEY_TYPE_HALF_TREE;
+  memcpy(k1, k0, HALF_TREE_HEAD_SIZE);
+  memcpy(&k1[1], &s[1], 16);
+
+  for (int i = 1; i <= size; i++) {
+    int indexBit = getbit(index, size, i);
+    ccrHashBatch(ctx, s, h, 2);
+
+    // the off-path child must cancel and the on-path child keep Delta
+    uint128_t cw = h[0] ^ h[1] ^ (delta & bitMask(!indexBit));
+
+    for (int b = 0; b < 2; b++)
+      s[b] = h[b] ^ (s[b] & bitMask(indexBit)) ^ (cw & bitMask(lsb(s[b])));
+    memcpy(&k0[HALF_TREE_HEAD_SIZE + 16 * (i - 1)], &cw, 16);
+  }
+
+  uint8_t *convert0 = (uint8_t *)malloc(dataSize + 16);
+  uint8_t *convert1 = (uint8_t *)malloc(dataSize + 16);
+  leafConvert(ctx, flags, &s[0], 1, dataSize, convert0);
+  leafConvert(ctx, flags, &s[1], 1, dataSize, convert1);
+
+  uint8_t *lastCW = &k0[HALF_TREE_HEAD_SIZE + 16 * size];
+  for (int i = 0; i < dataSize; i++)
+    lastCW[i] = data[i] ^ convert0[i] ^ convert1[i];
+
+  memcpy(&k1[HALF_TREE_HEAD_SIZE], &k0[HALF_TREE_HEAD_SIZE],
+         16 * size + dataSize);
+
+  free(convert0);
+  free(convert1);
+}
+
+// Seed of node `prefix` on level `levels` of a Half-Tree key: the root
+// walked down the path of prefix
+static uint128_t halfTreeNode(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                              uint64_t prefix, int levels) {
+  uint128_t s, h, cw;
+  memcpy(&s, &k[1], 16);
+
+  for (int i = 1; i <= levels; i++) {
+    ccrHashBatch(ctx, &s, &h, 1);
+    memcpy(&cw, &k[HALF_TREE_HEAD_SIZE + 16 * (i - 1)], 16);
+    h ^= s & bitMask(getbit(prefix, levels, i));
+    h ^= cw & bitMask(lsb(s));
+    s = h;
+  }
+  return s;
+}
+
+/**
+  @brief Evaluates a Half-Tree DPF key at one point
+  @param ctx: the context for the PRG
+  @param k: the key
+  @param x: the point to evaluate
+  @param dataSize: the size of the data
+  @param dataShare: the output share (dataSize bytes), zeroed if k is not a
+  Half-Tree key
+  @return: void
+*/
+void evalHalfTreeDPF(EVP_CIPHER_CTX *ctx, unsigned char *k, uint64_t x,
+                     int dataSize, uint8_t *dataShare) {
+  int size = halfTreeKeySize(k);
+  if (size < 0) {
+    memset(dataShare, 0, dataSize);
+    return;
+  }
+  if (!checkKeyPRG(ctx, k[HALF_TREE_HEAD_SIZE - 1]))
+    return;
+
+  uint8_t flags = k[HALF_TREE_HEAD_SIZE - 1] & ~KEY_ARITY_MASK;
+  uint128_t s = halfTreeNode(ctx, k, x, size);
+
+  leafConvert(ctx, flags, &s, 1, dataSize, dataShare);
+  xorIfSet(dataShare, &k[HALF_TREE_HEAD_SIZE + 16 * size], dataSize, lsb(s));
+}
+
+// Expands the node in s[0] on level firstLevel by `levels` levels, in place:
+// level l of the subtree fills the first 2^l slots of s. Chunks are
+// processed from the back, so children never overwrite a parent not yet
+// expanded.
+static void halfTreeExpandBlock(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                uint128_t *s, int firstLevel, int levels) {
+  uint128_t parents[PRG_BATCH], h[PRG_BATCH];
+  for (int level = 0; level < levels; level++) {
+    uint128_t cw;
+    memcpy(&cw, &k[HALF_TREE_HEAD_SIZE + 16 * (firstLevel + level)], 16);
+
+    uint64_t end = 1ULL << level;
+    while (end > 0) {
+      uint64_t first = end > PRG_BATCH ? end - PRG_BATCH : 0;
+      int m = end - first;
+      memcpy(parents, &s[first], sizeof(uint128_t) * m);
+      ccrHashBatch(ctx, parents, h, m);
+
+      for (int j = m - 1; j >= 0; j--) {
+        uint128_t left = h[j] ^ (cw & bitMask(lsb(parents[j])));
+        s[2 * (first + j)] = left;
+        s[2 * (first + j) + 1] = left ^ parents[j];
+      }
+      end = first;
+    }
+  }
+}
+
+// Evaluates every point of a Half-Tree key of the given size into out, or,
+// if out is NULL, into stream. The control bit lives in the seed, so a layer
+// is just its seeds: the top levels are walked to each block of
+// 2^DPF_BLOCK_LEVELS leaves, which is expanded in place, and only one block
+// of seeds is live whatever the domain.
+static void fullDomainHalfTreeRun(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                  int size, int dataSize, uint8_t *out,
+                                  struct DPFChunkStream *stream) {
+  uint8_t flags = k[HALF_TREE_HEAD_SIZE - 1] & ~KEY_ARITY_MASK;
+  uint8_t *lastCW = &k[HALF_TREE_HEAD_SIZE + 16 * size];
+  int blockLevels = size < DPF_BLOCK_LEVELS ? size : DPF_BLOCK_LEVELS;
+  int topLevels = size - blockLevels;
+  uint64_t blockLeaves = 1ULL << blockLevels;
+
+  uint128_t *s = malloc(sizeof(uint128_t) * blockLeaves);
+  uint8_t *blockBuf = stream ? malloc(blockLeaves * dataSize) : NULL;
+  for (uint64_t b = 0; b < 1ULL << topLevels; b++) {
+    s[0] = halfTreeNode(ctx, k, b, topLevels);
+    halfTreeExpandBlock(ctx, k, s, topLevels, blockLevels);
+
+    uint8_t *blockOut =
+        stream ? blockBuf : out + (b << blockLevels) * dataSize;
+    leafConvert(ctx, flags, s, blockLeaves, dataSize, blockOut);
+    for (uint64_t i = 0; i < blockLeaves; i++)
+      xorIfSet(blockOut + i * dataSize, lastCW, dataSize, lsb(s[i]));
+    if (stream)
+      chunkStreamPush(stream, blockBuf, blockLeaves);
+  }
+  free(s);
+  free(blockBuf);
+}
+
+/**
+  @brief Evaluates a Half-Tree DPF key on the whole domain
+  @param ctx: the context for the PRG
+  @param k: the key
+  @param dataSize: the size of the data
+  @param out: the output shares, (1 << size) * dataSize bytes, zeroed if k is
+  not a Half-Tree key
+  @return: void
+*/
+void fullDomainHalfTreeDPF(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                           int dataSize, uint8_t *out) {
+  int size = halfTreeKeySize(k);
+  if (size < 0) {
+    memset(out, 0, (1ULL << k[0]) * dataSize);
+    return;
+  }
+  if (!checkKeyPRG(ctx, k[HALF_TREE_HEAD_SIZE - 1]))
+    return;
+  fullDomainHalfTreeRun(ctx, k, size, dataSize, out, NULL);
+}
+
+/**
+  @brief fullDomainHalfTreeDPF that streams the output instead of storing it
+  @param ctx: the context for the PRG
+  @param k: the key
+  @param dataSize: the size of the data
+  @param chunkSize: the number of points per call of visit
+  @param visit: called with the shares of each chunk, in order; never called
+  if k is not a Half-Tree key
+  @param user: passed to visit
+  @return: void
+*/
+void fullDomainHalfTreeDPFStream(EVP_CIPHER_CTX *ctx, unsigned char *k,
+                                 int dataSize, uint64_t chunkSize,
+                                 DPFChunkFn visit, void *user) {
+  int size = halfTreeKeySize(k);
+  if (size < 0 || !checkKeyPRG(ctx, k[HALF_TREE_HEAD_SIZE - 1]))
+    return;
+  struct DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  fullDomainHalfTreeRun(ctx, k, size, dataSize, NULL, &stream);
+  chunkStreamFinish(&stream);
+}
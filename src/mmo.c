@@ -36,13 +36,13 @@ uint128_t *prg(uint128_t seed, uint64_t outblocks) {
 }
 
 struct Hash *initMMOHash(uint8_t *seed, uint64_t outblocks) {
-  EVP_CIPHER_CTX *mmoCtx = malloc(sizeof(EVP_CIPHER_CTX *));
+  EVP_CIPHER_CTX *mmoCtx;
   struct Hash *hash = malloc(sizeof(struct Hash));
 
   if (!(mmoCtx = EVP_CIPHER_CTX_new()))
     printf("errors occured in creating context\n");
 
-  if (1 != EVP_EncryptInit_ex(mmoCtx, EVP_aes_128_ctr(), NULL, (uint8_t *)seed,
+  if (1 != EVP_EncryptInit_ex(mmoCtx, EVP_aes_128_ecb(), NULL, (uint8_t *)seed,
                               NULL))
     printf("errors occurred in randomness init\n");
 
@@ -50,6 +50,9 @@ struct Hash *initMMOHash(uint8_t *seed, uint64_t outblocks) {
 
   hash->mmoCtx = mmoCtx;
   hash->outblocks = outblocks;
+  hash->encrypt = aesEncryptKernel(aesDetectImpl());
+  if (hash->encrypt)
+    aesniExpandKey(seed, &hash->aesKey);
   return hash;
 }
 
@@ -58,41 +61,73 @@ void destroyMMOHash(struct Hash *hash) {
   free(hash);
 }
 
-// Matyas-Meyer-Oseas technique for instantiating a one-way compression function
-// takes 2 blocks and outputs 4 blocks
-void mmoHash2to4(struct Hash *hash, uint8_t *input, uint8_t *output) {
-  uint128_t *outputblocks = (uint128_t *)output;
-  uint128_t *inputblocks = (uint128_t *)input;
+struct Hash *cloneMMOHash(struct Hash *hash) {
+  struct Hash *clone = malloc(sizeof(struct Hash));
+  memcpy(clone, hash, sizeof(struct Hash));
+  if (!(clone->mmoCtx = EVP_CIPHER_CTX_new()) ||
+      1 != EVP_CIPHER_CTX_copy(clone->mmoCtx, hash->mmoCtx))
+    printf("errors occured in copying context\n");
+  return clone;
+}
 
+// Encrypts n blocks under the hash key in one kernel call (or one
+// EVP_EncryptUpdate); in and out may alias
+static inline void mmoEncrypt(struct Hash *hash, const uint128_t *in,
+                              uint128_t *out, int n) {
+  if (hash->encrypt) {
+    hash->encrypt(&hash->aesKey, in, out, n);
+    return;
+  }
   int len = 0;
-  if (1 != EVP_EncryptUpdate(hash->mmoCtx, (uint8_t *)&outputblocks[0], &len,
-                             (uint8_t *)input, 16 * 2))
-    printf("errors occurred when hashing\n");
-
-  outputblocks[0] ^= inputblocks[0];
-  outputblocks[1] ^= inputblocks[1];
-
-  if (1 != EVP_EncryptUpdate(hash->mmoCtx, (uint8_t *)&outputblocks[2], &len,
-                             (uint8_t *)outputblocks, 16 * 2))
+  if (1 != EVP_EncryptUpdate(hash->mmoCtx, (uint8_t *)out, &len,
+                             (const uint8_t *)in, 16 * n))
     printf("errors occurred when hashing\n");
+}
 
-  outputblocks[2] ^= outputblocks[0];
-  outputblocks[3] ^= outputblocks[1];
+// Matyas-Meyer-Oseas technique for instantiating a one-way compression function
+// takes 2 blocks and outputs 4 blocks
+void mmoHash2to4(struct Hash *hash, uint8_t *input, uint8_t *output) {
+  mmoHash2to4Batch(hash, input, 1, output);
 }
 
 // Matyas-Meyer-Oseas technique for instantiating a one-way compression function
 // takes 4 blocks and outputs 4 blocks
 void mmoHash4to4(struct Hash *hash, uint8_t *input, uint8_t *output) {
-  uint128_t *outputblocks = (uint128_t *)output;
-  uint128_t *inputblocks = (uint128_t *)input;
+  mmoHash4to4Batch(hash, input, 1, output);
+}
 
-  int len = 0;
-  if (1 != EVP_EncryptUpdate(hash->mmoCtx, (uint8_t *)&outputblocks[0], &len,
-                             (uint8_t *)input, 16 * 4))
-    printf("errors occurred in generating AES hash\n");
-
-  outputblocks[0] ^= inputblocks[0];
-  outputblocks[1] ^= inputblocks[1];
-  outputblocks[2] ^= inputblocks[2];
-  outputblocks[3] ^= inputblocks[3];
-}
\ No newline at end of file
+void mmoHash2to4Batch(struct Hash *hash, const uint8_t *inputs, uint64_t n,
+                      uint8_t *outputs) {
+  uint128_t in[2 * MMO_BATCH], mid[2 * MMO_BATCH], enc[2 * MMO_BATCH];
+  for (uint64_t i = 0; i < n; i += MMO_BATCH) {
+    int m = n - i < MMO_BATCH ? n - i : MMO_BATCH;
+    memcpy(in, inputs + 32 * i, 32 * m);
+
+    // out0,1 = E(in0,1) ^ in0,1, then out2,3 = E(out0,1) ^ out0,1
+    mmoEncrypt(hash, in, enc, 2 * m);
+    for (int j = 0; j < 2 * m; j++)
+      mid[j] = enc[j] ^ in[j];
+    mmoEncrypt(hash, mid, enc, 2 * m);
+
+    uint128_t *out = (uint128_t *)(outputs + 64 * i);
+    for (int j = 0; j < m; j++) {
+      uint128_t blocks[4] = {mid[2 * j], mid[2 * j + 1],
+                             enc[2 * j] ^ mid[2 * j],
+                             enc[2 * j + 1] ^ mid[2 * j + 1]};
+      memcpy(&out[4 * j], blocks, sizeof(blocks));
+    }
+  }
+}
+
+void mmoHash4to4Batch(struct Hash *hash, const uint8_t *inputs, uint64_t n,
+                      uint8_t *outputs) {
+  uint128_t in[4 * MMO_BATCH], enc[4 * MMO_BATCH];
+  for (uint64_t i = 0; i < n; i += MMO_BATCH) {
+    int m = n - i < MMO_BATCH ? n - i : MMO_BATCH;
+    memcpy(in, inputs + 64 * i, 64 * m);
+    mmoEncrypt(hash, in, enc, 4 * m);
+    for (int j = 0; j < 4 * m; j++)
+      enc[j] ^= in[j];
+    memcpy(outputs + 64 * i, enc, 64 * m);
+  }
+}
@@ -2,16 +2,46 @@
 
 #include "../include/sha256.h"
 
-struct Sha_256 sha_256;
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define TOTAL_LEN_LEN 8
 
+/*
+ * @brief Whether the CPU has the SHA extensions. Detected once at load time so
+ * that sha_256_init stays free of shared mutable state.
+ */
+static int sha_256_shani_available;
+
 /*
  * Comments from pseudo-code at https://en.wikipedia.org/wiki/SHA-2 are
  * reproduced here. When useful for clarification, portions of the pseudo-code
  * are reproduced here too.
  */
 
+/*
+ * Initialize array of round constants:
+ * (first 32 bits of the fractional parts of the cube roots of the first
+ * 64 primes 2..311):
+ */
+static const uint32_t k[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
+    0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+    0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+    0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
+    0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+    0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+    0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+    0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
 /*
  * @brief Rotate a 32-bit value by a number of bits to the right.
  * @param value The value to be rotated.
@@ -78,25 +108,6 @@ static inline void consume_chunk(uint32_t *h, const uint8_t *p) {
           right_rot(ah[4], 6) ^ right_rot(ah[4], 11) ^ right_rot(ah[4], 25);
       const uint32_t ch = (ah[4] & ah[5]) ^ (~ah[4] & ah[6]);
 
-      /*
-       * Initialize array of round constants:
-       * (first 32 bits of the fractional parts of the cube roots of the first
-       * 64 primes 2..311):
-       */
-      static const uint32_t k[] = {
-          0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
-          0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
-          0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
-          0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-          0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
-          0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
-          0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
-          0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-          0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
-          0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
-          0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
-          0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-          0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
 
       const uint32_t temp1 = ah[7] + s1 + ch + k[i << 4 | j] + w[j];
       const uint32_t s0 =
@@ -120,6 +131,91 @@ static inline void consume_chunk(uint32_t *h, const uint8_t *p) {
     h[i] += ah[i];
 }
 
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * @brief consume_chunk on the x86 SHA extensions. Each group of four rounds
+ * runs as two sha256rnds2 instructions and the message schedule is extended
+ * with sha256msg1/sha256msg2.
+ */
+__attribute__((target("sha,sse4.1"))) static void
+consume_chunk_shani(uint32_t *h, const uint8_t *p) {
+  const __m128i mask =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, msg, tmp, abef_save, cdgh_save;
+  __m128i w[4];
+  unsigned i;
+
+  /* Reorder the hash value into the ABEF/CDGH layout sha256rnds2 expects */
+  tmp = _mm_loadu_si128((const __m128i *)&h[0]);
+  state1 = _mm_loadu_si128((const __m128i *)&h[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);
+  state1 = _mm_shuffle_epi32(state1, 0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+  abef_save = state0;
+  cdgh_save = state1;
+
+  for (i = 0; i < 4; i++)
+    w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)),
+                            mask);
+
+  /* w[i & 3] holds words 4i..4i+3 of the message schedule */
+  for (i = 0; i < 16; i++) {
+    msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&k[4 * i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+    if (i < 12) {
+      tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+      tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3],
+                                               w[(i + 2) & 3], 4));
+      w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+    }
+  }
+
+  state0 = _mm_add_epi32(state0, abef_save);
+  state1 = _mm_add_epi32(state1, cdgh_save);
+
+  /* Back to the h[0..7] = A..H layout */
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i *)&h[0], state0);
+  _mm_storeu_si128((__m128i *)&h[4], state1);
+}
+
+#endif
+
+/*
+ * @brief Runs the compression function selected in sha_256_init.
+ */
+static inline void sha_256_consume(struct Sha_256 *sha_256, const uint8_t *p) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (sha_256->shani) {
+    consume_chunk_shani(sha_256->h, p);
+    return;
+  }
+#endif
+  consume_chunk(sha_256->h, p);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * @brief Detects the SHA extensions. DPF_SHA_IMPL=0 forces the portable code.
+ * Other targets always use the portable code.
+ */
+__attribute__((constructor)) static void sha_256_detect(void) {
+  const char *cap = getenv("DPF_SHA_IMPL");
+  __builtin_cpu_init();
+  sha_256_shani_available = __builtin_cpu_supports("sha") &&
+                            __builtin_cpu_supports("sse4.1") &&
+                            !(cap && atoi(cap) == 0);
+}
+#endif
+
 /*
  * Public functions. See header file for documentation.
  */
@@ -129,6 +225,7 @@ void sha_256_init(struct Sha_256 *sha_256, uint8_t hash[SIZE_OF_SHA_256_HASH]) {
   sha_256->chunk_pos = sha_256->chunk;
   sha_256->space_left = SIZE_OF_SHA_256_CHUNK;
   sha_256->total_len = 0;
+  sha_256->shani = sha_256_shani_available;
   /*
    * Initialize hash values (first 32 bits of the fractional parts of the square
    * roots of the first 8 primes 2..19):
@@ -156,7 +253,7 @@ void sha_256_write(struct Sha_256 *sha_256, const void *data, size_t len) {
      */
     if (sha_256->space_left == SIZE_OF_SHA_256_CHUNK &&
         len >= SIZE_OF_SHA_256_CHUNK) {
-      consume_chunk(sha_256->h, p);
+      sha_256_consume(sha_256, p);
       len -= SIZE_OF_SHA_256_CHUNK;
       p += SIZE_OF_SHA_256_CHUNK;
       continue;
@@ -169,7 +266,7 @@ void sha_256_write(struct Sha_256 *sha_256, const void *data, size_t len) {
     len -= consumed_len;
     p += consumed_len;
     if (sha_256->space_left == 0) {
-      consume_chunk(sha_256->h, sha_256->chunk);
+      sha_256_consume(sha_256, sha_256->chunk);
       sha_256->chunk_pos = sha_256->chunk;
       sha_256->space_left = SIZE_OF_SHA_256_CHUNK;
     } else {
@@ -199,7 +296,7 @@ uint8_t *sha_256_close(struct Sha_256 *sha_256) {
    */
   if (space_left < TOTAL_LEN_LEN) {
     memset(pos, 0x00, space_left);
-    consume_chunk(h, sha_256->chunk);
+    sha_256_consume(sha_256, sha_256->chunk);
     pos = sha_256->chunk;
     space_left = SIZE_OF_SHA_256_CHUNK;
   }
@@ -214,7 +311,7 @@ uint8_t *sha_256_close(struct Sha_256 *sha_256) {
     pos[i] = (uint8_t)len;
     len >>= 8;
   }
-  consume_chunk(h, sha_256->chunk);
+  sha_256_consume(sha_256, sha_256->chunk);
   /* Produce the final hash value (big-endian): */
   int j;
   uint8_t *const hash = sha_256->hash;
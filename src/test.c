@@ -1,15 +1,22 @@
+#include "../include/aes.h"
+#include "../include/chacha.h"
+#include "../include/common.h"
 #include "../include/dmpf.h"
 #include "../include/dpf.h"
 #include "../include/mmo.h"
+#include "../include/sha256.h"
 #include "../include/vdmpf.h"
 #include "../include/vdpf.h"
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <openssl/sha.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
 #define SIZE (4)      // 域大小（比特数）
 #define DATASIZE (16) // 每个点的数据字节数
@@ -17,6 +24,34 @@
 // gcc -g test_dpf.c vdpf.c dpf.c sha256.c common.c mmo.c -I../include -lcrypto
 // -o test_dpf
 
+// A thread pool for Test[25] that runs every task on the calling thread
+static void runTasksInline(void *pool, int n, void (*task)(void *arg, int i),
+                           void *arg) {
+  (void)pool;
+  for (int i = 0; i < n; i++)
+    task(arg, i);
+}
+
+// Visitor for Test[26] and Test[28]: copies each chunk to its place in a full-domain
+// buffer and checks that the chunks arrive in order
+struct StreamCheck {
+  uint8_t *out;
+  int dataSize;
+  uint64_t chunk, next, calls;
+  int ok;
+};
+
+static void collectChunk(uint64_t firstIndex, uint64_t count,
+                         const uint8_t *shares, void *user) {
+  struct StreamCheck *check = (struct StreamCheck *)user;
+  if (firstIndex != check->next || count > check->chunk)
+    check->ok = 0;
+  memcpy(check->out + firstIndex * check->dataSize, shares,
+         count * check->dataSize);
+  check->next = firstIndex + count;
+  check->calls++;
+}
+
 int main(int argc, char *argv[]) {
   unsigned char aeskey[16];
   if (!RAND_bytes(aeskey, sizeof(aeskey))) {
@@ -100,7 +135,7 @@ int main(int argc, char *argv[]) {
     }
   }
   printf("Test[2] passed.\n");
-  EVP_CIPHER_CTX_free(ctx);
+  destroyContext(ctx);
 
   // Test VDPF
   // Test genVDPF
@@ -220,6 +255,27 @@ int main(int argc, char *argv[]) {
       }
     }
   }
+
+  // keys without KEY_FLAG_MMO_HASH predate the MMO hash and are rejected
+  unsigned char legacy_vdpf[keySize];
+  memcpy(legacy_vdpf, k0_vdpf, keySize);
+  legacy_vdpf[17] &= ~KEY_FLAG_MMO_HASH;
+  mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+  mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+  fullDomainVDPF(ctx_vdpf, mmo_hash1, mmo_hash2, DATASIZE, legacy_vdpf,
+                 out0_vdpf, pi0);
+  destroyMMOHash(mmo_hash1);
+  destroyMMOHash(mmo_hash2);
+  for (int i = 0; i < domainSize * DATASIZE; i++) {
+    if (out0_vdpf[i] != 0) {
+      printf("Test[4] failed: legacy key produced output!\n");
+      return 1;
+    }
+  }
+  if (memcmp(pi0, pi1, 32) == 0) {
+    printf("Test[4] failed: legacy key passed verification!\n");
+    return 1;
+  }
   printf("Test[4] passed.\n");
 
   // Test evalVDPF
@@ -513,6 +569,1302 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // keys without KEY_FLAG_MMO_HASH predate the MMO hash and are rejected
+  unsigned char legacy_vdmpf[keySize_vdmpf];
+  memcpy(legacy_vdmpf, k0_vdmpf, keySize_vdmpf);
+  legacy_vdmpf[18] &= ~KEY_FLAG_MMO_HASH;
+  mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+  mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+  fullDomainVDMPF(ctx_vdmpf, mmo_hash1, mmo_hash2, DATASIZE, legacy_vdmpf,
+                  out0_vdmpf, pi0);
+  destroyMMOHash(mmo_hash1);
+  destroyMMOHash(mmo_hash2);
+  for (int i = 0; i < domainSize * DATASIZE; i++) {
+    if (out0_vdmpf[i] != 0) {
+      printf("Test[10] failed: legacy key produced output!\n");
+      return 1;
+    }
+  }
+  if (memcmp(pi0, pi1, 32) == 0) {
+    printf("Test[10] failed: legacy key passed verification!\n");
+    return 1;
+  }
+  printf("Test[10] passed.\n");
+
+  // Test fixed-key leaf conversion mode, with a payload that is not a
+  // multiple of the block size
+  printf("Test[11]: fixed-key leaf conversion...\n");
+  EVP_CIPHER_CTX *ctx_fk = getDPFContext(aeskey);
+  setKeyFlags(ctx_fk, KEY_FLAG_FIXED_KEY_LEAF);
+  int ds_fk = 37;
+  uint8_t data_fk[2 * 37];
+  for (int i = 0; i < 2 * ds_fk; i++)
+    data_fk[i] = (uint8_t)(rand() & 0xFF);
+  uint8_t zero_fk[37];
+  memset(zero_fk, 0, ds_fk);
+
+  unsigned char k0_fk[18 * SIZE + 18 + 37];
+  unsigned char k1_fk[18 * SIZE + 18 + 37];
+  genDPF(ctx_fk, SIZE, index, ds_fk, data_fk, k0_fk, k1_fk);
+  if (!(k0_fk[17] & KEY_FLAG_FIXED_KEY_LEAF) ||
+      !(k1_fk[17] & KEY_FLAG_FIXED_KEY_LEAF)) {
+    printf("Test[11] failed: key mode not recorded!\n");
+    return 1;
+  }
+
+  uint8_t *out0_fk = (uint8_t *)malloc(domainSize * ds_fk);
+  uint8_t *out1_fk = (uint8_t *)malloc(domainSize * ds_fk);
+  fullDomainDPF(ctx_dmpf, SIZE, k0_fk, ds_fk, out0_fk);
+  fullDomainDPF(ctx_fk, SIZE, k1_fk, ds_fk, out1_fk);
+  for (uint64_t i = 0; i < (1ULL << SIZE); i++) {
+    uint8_t share0[37], share1[37], res[37];
+    evalDPF(ctx_fk, k0_fk, i, ds_fk, share0);
+    evalDPF(ctx_fk, k1_fk, i, ds_fk, share1);
+    for (int j = 0; j < ds_fk; j++)
+      res[j] = share0[j] ^ share1[j];
+    uint8_t *expected = i == index ? data_fk : zero_fk;
+    if (memcmp(res, expected, ds_fk) != 0 ||
+        memcmp(share0, &out0_fk[i * ds_fk], ds_fk) != 0 ||
+        memcmp(share1, &out1_fk[i * ds_fk], ds_fk) != 0) {
+      printf("Test[11] failed at DPF index %lu: output mismatch!\n", i);
+      return 1;
+    }
+  }
+
+  uint64_t index_fk[2] = {3, 12};
+  unsigned char k0_fkm[19 + SIZE * 2 * 24 + 2 * 37];
+  unsigned char k1_fkm[19 + SIZE * 2 * 24 + 2 * 37];
+  genDMPF(ctx_fk, 2, SIZE, index_fk, ds_fk, data_fk, k0_fkm, k1_fkm);
+  fullDomainDMPF(ctx_fk, k0_fkm, ds_fk, out0_fk);
+  fullDomainDMPF(ctx_fk, k1_fkm, ds_fk, out1_fk);
+  uint8_t *compressed_fk =
+      (uint8_t *)malloc(34 + SIZE * 2 * 24 + 2 * ds_fk);
+  uint8_t *decompressed_fk = (uint8_t *)malloc(domainSize * ds_fk);
+  compressDMPF(ctx_fk, 2, SIZE, index_fk, ds_fk, data_fk, compressed_fk);
+  decompressDMPF(ctx_fk, compressed_fk, ds_fk, decompressed_fk);
+  for (uint64_t i = 0; i < (1ULL << SIZE); i++) {
+    uint8_t share0[37], share1[37], res[37];
+    evalDMPF(ctx_fk, i, ds_fk, share0, k0_fkm);
+    evalDMPF(ctx_fk, i, ds_fk, share1, k1_fkm);
+    for (int j = 0; j < ds_fk; j++)
+      res[j] = share0[j] ^ share1[j];
+    uint8_t *expected = i == index_fk[0]   ? &data_fk[0]
+                        : i == index_fk[1] ? &data_fk[ds_fk]
+                                           : zero_fk;
+    if (memcmp(res, expected, ds_fk) != 0 ||
+        memcmp(share0, &out0_fk[i * ds_fk], ds_fk) != 0 ||
+        memcmp(share1, &out1_fk[i * ds_fk], ds_fk) != 0 ||
+        memcmp(&decompressed_fk[i * ds_fk], expected, ds_fk) != 0) {
+      printf("Test[11] failed at DMPF index %lu: output mismatch!\n", i);
+      return 1;
+    }
+  }
+  free(out0_fk);
+  free(out1_fk);
+  free(compressed_fk);
+  free(decompressed_fk);
+  destroyContext(ctx_fk);
+  printf("Test[11] passed.\n");
+
+  // Test[12]: every native AES kernel the CPU supports, and the MMO hash on
+  // top of it, must match OpenSSL
+  printf("Test[12]: AES kernel dispatch...\n");
+  uint8_t aesKeyBytes[16];
+  RAND_bytes(aesKeyBytes, 16);
+  EVP_CIPHER_CTX *ctx_evp = getDPFContext(aesKeyBytes);
+  struct AesKey aesKey;
+  aesniExpandKey(aesKeyBytes, &aesKey);
+  uint128_t blocksIn[37], blocksRef[37], blocksOut[37];
+  RAND_bytes((uint8_t *)blocksIn, sizeof(blocksIn));
+  int evpLen = 0;
+  EVP_EncryptUpdate(ctx_evp, (uint8_t *)blocksRef, &evpLen,
+                    (uint8_t *)blocksIn, sizeof(blocksIn));
+  for (int impl = AES_IMPL_AESNI; impl <= aesDetectImpl(); impl++) {
+    for (int n = 0; n <= 37; n++) {
+      memset(blocksOut, 0, sizeof(blocksOut));
+      aesEncryptKernel(impl)(&aesKey, blocksIn, blocksOut, n);
+      if (memcmp(blocksOut, blocksRef, 16 * n) != 0) {
+        printf("Test[12] failed: kernel %d mismatch for %d blocks!\n", impl,
+               n);
+        return 1;
+      }
+    }
+  }
+  destroyContext(ctx_evp);
+
+  struct Hash *h_native = initMMOHash(aesKeyBytes, 4);
+  struct Hash *h_evp = initMMOHash(aesKeyBytes, 4);
+  h_evp->encrypt = NULL;
+  for (int i = 0; i < 5; i++) {
+    uint8_t out_native[64], out_evp[64];
+    if (i % 2 == 0) {
+      mmoHash2to4(h_native, (uint8_t *)&blocksIn[4 * i], out_native);
+      mmoHash2to4(h_evp, (uint8_t *)&blocksIn[4 * i], out_evp);
+    } else {
+      mmoHash4to4(h_native, (uint8_t *)&blocksIn[4 * i], out_native);
+      mmoHash4to4(h_evp, (uint8_t *)&blocksIn[4 * i], out_evp);
+    }
+    if (memcmp(out_native, out_evp, 64) != 0) {
+      printf("Test[12] failed: MMO hash mismatch at call %d!\n", i);
+      return 1;
+    }
+  }
+
+  // MMO is AES_k(x) ^ x blockwise; 2to4 hashes its first two output blocks
+  // once more for the other two
+  uint128_t mmoOut[4], mmoNext[4];
+  mmoHash4to4(h_native, (uint8_t *)blocksIn, (uint8_t *)mmoOut);
+  for (int j = 0; j < 4; j++) {
+    if (mmoOut[j] != (blocksRef[j] ^ blocksIn[j])) {
+      printf("Test[12] failed: mmoHash4to4 is not AES(x) ^ x!\n");
+      return 1;
+    }
+  }
+  mmoHash2to4(h_evp, (uint8_t *)blocksIn, (uint8_t *)mmoOut);
+  uint128_t mmoMid[4] = {mmoOut[0], mmoOut[1], 0, 0};
+  mmoHash4to4(h_native, (uint8_t *)mmoMid, (uint8_t *)mmoNext);
+  if (mmoOut[0] != (blocksRef[0] ^ blocksIn[0]) ||
+      mmoOut[1] != (blocksRef[1] ^ blocksIn[1]) || mmoOut[2] != mmoNext[0] ||
+      mmoOut[3] != mmoNext[1]) {
+    printf("Test[12] failed: mmoHash2to4 is not MMO!\n");
+    return 1;
+  }
+  destroyMMOHash(h_native);
+  destroyMMOHash(h_evp);
+  printf("Test[12] passed.\n");
+
+  // Test[13]: Half-Tree DPF, in both leaf conversion modes
+  printf("Test[13]: Half-Tree DPF...\n");
+  for (int mode = 0; mode < 2; mode++) {
+    EVP_CIPHER_CTX *ctx_ht = getDPFContext(aeskey);
+    setKeyFlags(ctx_ht, mode ? KEY_FLAG_FIXED_KEY_LEAF : 0);
+    int ds_ht = 37;
+    uint64_t index_ht = rand() % (1ULL << SIZE);
+    unsigned char k0_ht[HALF_TREE_KEY_SIZE(SIZE, 37)];
+    unsigned char k1_ht[HALF_TREE_KEY_SIZE(SIZE, 37)];
+    genHalfTreeDPF(ctx_ht, SIZE, index_ht, ds_ht, data_fk, k0_ht, k1_ht);
+    destroyContext(ctx_ht);
+
+    // evaluate with a fresh context to make sure the key is self-contained
+    ctx_ht = getDPFContext(aeskey);
+    uint8_t *out0_ht = (uint8_t *)malloc((1ULL << SIZE) * ds_ht);
+    uint8_t *out1_ht = (uint8_t *)malloc((1ULL << SIZE) * ds_ht);
+    fullDomainHalfTreeDPF(ctx_ht, k0_ht, ds_ht, out0_ht);
+    fullDomainHalfTreeDPF(ctx_ht, k1_ht, ds_ht, out1_ht);
+    for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+      uint8_t share0[37], share1[37], res[37];
+      evalHalfTreeDPF(ctx_ht, k0_ht, x, ds_ht, share0);
+      evalHalfTreeDPF(ctx_ht, k1_ht, x, ds_ht, share1);
+      for (int j = 0; j < ds_ht; j++)
+        res[j] = share0[j] ^ share1[j];
+      uint8_t *expected = x == index_ht ? data_fk : zero_fk;
+      if (memcmp(res, expected, ds_ht) != 0 ||
+          memcmp(share0, &out0_ht[x * ds_ht], ds_ht) != 0 ||
+          memcmp(share1, &out1_ht[x * ds_ht], ds_ht) != 0) {
+        printf("Test[13] failed at index %lu: output mismatch!\n", x);
+        return 1;
+      }
+    }
+    free(out0_ht);
+    free(out1_ht);
+
+    // neither key type is accepted by the other's evaluators
+    uint8_t share_ht[37];
+    memset(share_ht, 0xff, ds_ht);
+    evalDPF(ctx_ht, k0_ht, index_ht, ds_ht, share_ht);
+    if (memcmp(share_ht, zero_fk, ds_ht) != 0) {
+      printf("Test[13] failed: evalDPF accepted a Half-Tree key!\n");
+      return 1;
+    }
+    k0_ht[HALF_TREE_HEAD_SIZE - 1] &= ~KEY_ARITY_MASK;
+    memset(share_ht, 0xff, ds_ht);
+    evalHalfTreeDPF(ctx_ht, k0_ht, index_ht, ds_ht, share_ht);
+    if (memcmp(share_ht, zero_fk, ds_ht) != 0) {
+      printf("Test[13] failed: evalHalfTreeDPF accepted a DPF key!\n");
+      return 1;
+    }
+    destroyContext(ctx_ht);
+  }
+  printf("Test[13] passed.\n");
+
+  // Test[14]: 4-ary and 8-ary DPF and DMPF keys through the regular evaluators
+  printf("Test[14]: higher-arity trees...\n");
+  EVP_CIPHER_CTX *ctx_ary = getDPFContext(aeskey);
+  for (int arity = 4; arity <= 8; arity *= 2) {
+    int ds_ary = 37;
+    uint64_t index_ary = rand() % (1ULL << SIZE);
+    int dpfKeySize = karyDPFKeySize(arity, SIZE, ds_ary);
+    int dmpfKeySize = karyDMPFKeySize(arity, 2, SIZE, ds_ary);
+    unsigned char *k0_ary = (unsigned char *)malloc(dmpfKeySize + dpfKeySize);
+    unsigned char *k1_ary = (unsigned char *)malloc(dmpfKeySize + dpfKeySize);
+    uint8_t *out0_ary = (uint8_t *)malloc((1ULL << SIZE) * ds_ary);
+    uint8_t *out1_ary = (uint8_t *)malloc((1ULL << SIZE) * ds_ary);
+
+    genKaryDPF(ctx_ary, arity, SIZE, index_ary, ds_ary, data_fk, k0_ary,
+               k1_ary);
+    fullDomainDPF(ctx_ary, SIZE, k0_ary, ds_ary, out0_ary);
+    fullDomainDPF(ctx_ary, SIZE, k1_ary, ds_ary, out1_ary);
+    for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+      uint8_t share0[37], share1[37], res[37];
+      evalDPF(ctx_ary, k0_ary, x, ds_ary, share0);
+      evalDPF(ctx_ary, k1_ary, x, ds_ary, share1);
+      for (int j = 0; j < ds_ary; j++)
+        res[j] = share0[j] ^ share1[j];
+      uint8_t *expected = x == index_ary ? data_fk : zero_fk;
+      if (memcmp(res, expected, ds_ary) != 0 ||
+          memcmp(share0, &out0_ary[x * ds_ary], ds_ary) != 0 ||
+          memcmp(share1, &out1_ary[x * ds_ary], ds_ary) != 0) {
+        printf("Test[14] failed at DPF index %lu (arity %d)!\n", x, arity);
+        return 1;
+      }
+    }
+
+    genKaryDMPF(ctx_ary, arity, 2, SIZE, index_fk, ds_ary, data_fk, k0_ary,
+                k1_ary);
+    fullDomainDMPF(ctx_ary, k0_ary, ds_ary, out0_ary);
+    fullDomainDMPF(ctx_ary, k1_ary, ds_ary, out1_ary);
+    for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+      uint8_t share0[37], share1[37], res[37];
+      evalDMPF(ctx_ary, x, ds_ary, share0, k0_ary);
+      evalDMPF(ctx_ary, x, ds_ary, share1, k1_ary);
+      for (int j = 0; j < ds_ary; j++)
+        res[j] = share0[j] ^ share1[j];
+      uint8_t *expected = x == index_fk[0]   ? &data_fk[0]
+                          : x == index_fk[1] ? &data_fk[ds_ary]
+                                             : zero_fk;
+      if (memcmp(res, expected, ds_ary) != 0 ||
+          memcmp(share0, &out0_ary[x * ds_ary], ds_ary) != 0 ||
+          memcmp(share1, &out1_ary[x * ds_ary], ds_ary) != 0) {
+        printf("Test[14] failed at DMPF index %lu (arity %d)!\n", x, arity);
+        return 1;
+      }
+    }
+
+    free(k0_ary);
+    free(k1_ary);
+    free(out0_ary);
+    free(out1_ary);
+  }
+
+  // domains of many blocks, split between two workers
+  setFullDomainThreads(ctx_ary, 2);
+  for (int arity = 4; arity <= 8; arity *= 2) {
+    int size_ary = 15, ds_ary = 5;
+    uint64_t index_ary = rand() % (1ULL << size_ary);
+    uint64_t indices_ary[2] = {index_ary / 2, index_ary / 2 + 1000};
+    int keySize = karyDMPFKeySize(arity, 2, size_ary, ds_ary);
+    unsigned char *k0_ary = (unsigned char *)malloc(keySize);
+    unsigned char *k1_ary = (unsigned char *)malloc(keySize);
+    uint8_t *out0_ary = (uint8_t *)malloc((1ULL << size_ary) * ds_ary);
+    uint8_t *out1_ary = (uint8_t *)malloc((1ULL << size_ary) * ds_ary);
+    for (int dmpf = 0; dmpf < 2; dmpf++) {
+      if (dmpf) {
+        genKaryDMPF(ctx_ary, arity, 2, size_ary, indices_ary, ds_ary, data_fk,
+                    k0_ary, k1_ary);
+        fullDomainDMPF(ctx_ary, k0_ary, ds_ary, out0_ary);
+        fullDomainDMPF(ctx_ary, k1_ary, ds_ary, out1_ary);
+      } else {
+        genKaryDPF(ctx_ary, arity, size_ary, index_ary, ds_ary, data_fk,
+                   k0_ary, k1_ary);
+        fullDomainDPF(ctx_ary, size_ary, k0_ary, ds_ary, out0_ary);
+        fullDomainDPF(ctx_ary, size_ary, k1_ary, ds_ary, out1_ary);
+      }
+      for (uint64_t x = 0; x < (1ULL << size_ary); x++) {
+        uint8_t res[5];
+        for (int j = 0; j < ds_ary; j++)
+          res[j] = out0_ary[x * ds_ary + j] ^ out1_ary[x * ds_ary + j];
+        uint8_t *expected = zero_fk;
+        if (dmpf ? x == indices_ary[0] : x == index_ary)
+          expected = data_fk;
+        else if (dmpf && x == indices_ary[1])
+          expected = &data_fk[ds_ary];
+        if (memcmp(res, expected, ds_ary) != 0) {
+          printf("Test[14] failed at index %lu (arity %d, %s, 2 threads)!\n",
+                 x, arity, dmpf ? "DMPF" : "DPF");
+          return 1;
+        }
+      }
+    }
+    free(k0_ary);
+    free(k1_ary);
+    free(out0_ary);
+    free(out1_ary);
+  }
+  destroyContext(ctx_ary);
+  printf("Test[14] passed.\n");
+
+  // Test[15]: packed leaves for small payloads, DPF with 2-byte and DMPF with
+  // 1-byte outputs
+  printf("Test[15]: packed leaves...\n");
+  EVP_CIPHER_CTX *ctx_pk = getDPFContext(aeskey);
+  setKeyFlags(ctx_pk, KEY_FLAG_PACKED_LEAVES);
+  for (int ds_pk = 1; ds_pk <= 2; ds_pk++) {
+    uint64_t index_pk = rand() % (1ULL << SIZE);
+    unsigned char k0_pk[19 + SIZE * 2 * 24 + 2 * 16];
+    unsigned char k1_pk[19 + SIZE * 2 * 24 + 2 * 16];
+    uint8_t out0_pk[(1 << SIZE) * 2], out1_pk[(1 << SIZE) * 2];
+    uint8_t share0[16], share1[16];
+
+    genDPF(ctx_pk, SIZE, index_pk, ds_pk, data_fk, k0_pk, k1_pk);
+    if (!(k0_pk[17] & KEY_FLAG_PACKED_LEAVES)) {
+      printf("Test[15] failed: key mode not recorded!\n");
+      return 1;
+    }
+    fullDomainDPF(ctx_pk, SIZE, k0_pk, ds_pk, out0_pk);
+    fullDomainDPF(ctx_pk, SIZE, k1_pk, ds_pk, out1_pk);
+    for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+      evalDPF(ctx_pk, k0_pk, x, ds_pk, share0);
+      evalDPF(ctx_pk, k1_pk, x, ds_pk, share1);
+      for (int j = 0; j < ds_pk; j++) {
+        uint8_t expected = x == index_pk ? data_fk[j] : 0;
+        if ((share0[j] ^ share1[j]) != expected ||
+            share0[j] != out0_pk[x * ds_pk + j] ||
+            share1[j] != out1_pk[x * ds_pk + j]) {
+          printf("Test[15] failed at DPF index %lu!\n", x);
+          return 1;
+        }
+      }
+    }
+
+    genDMPF(ctx_pk, 2, SIZE, index_fk, ds_pk, data_fk, k0_pk, k1_pk);
+    fullDomainDMPF(ctx_pk, k0_pk, ds_pk, out0_pk);
+    fullDomainDMPF(ctx_pk, k1_pk, ds_pk, out1_pk);
+    for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+      evalDMPF(ctx_pk, x, ds_pk, share0, k0_pk);
+      evalDMPF(ctx_pk, x, ds_pk, share1, k1_pk);
+      for (int j = 0; j < ds_pk; j++) {
+        uint8_t expected = x == index_fk[0]   ? data_fk[j]
+                           : x == index_fk[1] ? data_fk[ds_pk + j]
+                                              : 0;
+        if ((share0[j] ^ share1[j]) != expected ||
+            share0[j] != out0_pk[x * ds_pk + j] ||
+            share1[j] != out1_pk[x * ds_pk + j]) {
+          printf("Test[15] failed at DMPF index %lu!\n", x);
+          return 1;
+        }
+      }
+    }
+  }
+  destroyContext(ctx_pk);
+  printf("Test[15] passed.\n");
+
+  // Test[16]: the batched MMO hashes must match sequential calls, across
+  // more than one MMO_BATCH and on both the native and EVP paths
+  printf("Test[16]: batched MMO hash...\n");
+  for (int native = 0; native < 2; native++) {
+    uint8_t mmoKey[16];
+    RAND_bytes(mmoKey, 16);
+    uint128_t batchIn[4 * 41];
+    uint8_t seqOut[64 * 41], batchOut[64 * 41];
+    RAND_bytes((uint8_t *)batchIn, sizeof(batchIn));
+    for (int arity = 2; arity <= 4; arity += 2) {
+      struct Hash *h_seq = initMMOHash(mmoKey, 4);
+      struct Hash *h_batch = initMMOHash(mmoKey, 4);
+      if (!native) {
+        h_seq->encrypt = NULL;
+        h_batch->encrypt = NULL;
+      }
+      for (int i = 0; i < 41; i++) {
+        if (arity == 2)
+          mmoHash2to4(h_seq, (uint8_t *)&batchIn[2 * i], &seqOut[64 * i]);
+        else
+          mmoHash4to4(h_seq, (uint8_t *)&batchIn[4 * i], &seqOut[64 * i]);
+      }
+      // split the batch so the second call spans two kernel batches
+      if (arity == 2) {
+        mmoHash2to4Batch(h_batch, (uint8_t *)batchIn, 3, batchOut);
+        mmoHash2to4Batch(h_batch, (uint8_t *)&batchIn[6], 38, &batchOut[192]);
+      } else {
+        mmoHash4to4Batch(h_batch, (uint8_t *)batchIn, 3, batchOut);
+        mmoHash4to4Batch(h_batch, (uint8_t *)&batchIn[12], 38, &batchOut[192]);
+      }
+      if (memcmp(seqOut, batchOut, sizeof(seqOut)) != 0) {
+        printf("Test[16] failed: %dto4 batch mismatch!\n", arity);
+        return 1;
+      }
+      destroyMMOHash(h_seq);
+      destroyMMOHash(h_batch);
+    }
+  }
+  printf("Test[16] passed.\n");
+
+  // Test[17]: SHA-256 must match OpenSSL on both compression functions, for
+  // lengths around the chunk and padding boundaries
+  printf("Test[17]: SHA-256...\n");
+  uint8_t shaIn[200];
+  RAND_bytes(shaIn, sizeof(shaIn));
+  for (int shani = 0; shani < 2; shani++) {
+    for (int len = 0; len <= 200; len++) {
+      struct Sha_256 sha;
+      uint8_t digest[32], digestRef[32];
+      sha_256_init(&sha, digest);
+      if (!shani)
+        sha.shani = 0;
+      else if (!sha.shani)
+        break; // no SHA extensions on this CPU
+      sha_256_write(&sha, shaIn, len / 3);
+      sha_256_write(&sha, shaIn + len / 3, len - len / 3);
+      sha_256_close(&sha);
+      SHA256(shaIn, len, digestRef);
+      if (memcmp(digest, digestRef, 32) != 0) {
+        printf("Test[17] failed: %s digest mismatch for %d bytes!\n",
+               shani ? "SHA-NI" : "portable", len);
+        return 1;
+      }
+    }
+  }
+  printf("Test[17] passed.\n");
+
+  // Test[18]: the buffered DRBG must not repeat blocks across refills, after
+  // reseedRandom, or between a forked child and its parent
+  printf("Test[18]: random blocks...\n");
+  uint128_t *drawn = (uint128_t *)malloc(sizeof(uint128_t) * 3 * 300);
+  for (int i = 0; i < 3 * 300; i++) {
+    if (i == 300)
+      reseedRandom();
+    drawn[i] = getRandomBlock();
+    for (int j = 0; j < i; j++) {
+      if (drawn[j] == drawn[i]) {
+        printf("Test[18] failed: block %d repeats block %d!\n", i, j);
+        return 1;
+      }
+    }
+  }
+  free(drawn);
+  int forkPipe[2];
+  if (pipe(forkPipe) != 0) {
+    printf("Test[18] failed: pipe!\n");
+    return 1;
+  }
+  pid_t child = fork();
+  uint128_t forkBlock = getRandomBlock();
+  if (child == 0) {
+    write(forkPipe[1], &forkBlock, sizeof(forkBlock));
+    _exit(0);
+  }
+  uint128_t childBlock = 0;
+  read(forkPipe[0], &childBlock, sizeof(childBlock));
+  waitpid(child, NULL, 0);
+  close(forkPipe[0]);
+  close(forkPipe[1]);
+  if (childBlock == forkBlock) {
+    printf("Test[18] failed: forked child repeats the parent's stream!\n");
+    return 1;
+  }
+  printf("Test[18] passed.\n");
+
+  // Test[19]: ChaCha PRG backends. The AVX2 kernels must match the portable
+  // ones, and DPF/DMPF keys must evaluate correctly in both leaf modes
+  printf("Test[19]: ChaCha PRG backends...\n");
+  struct ChachaKey chachaKey;
+  chachaExpandKey(aesKeyBytes, &chachaKey);
+  for (int rounds = 8; rounds <= 12; rounds += 4) {
+    uint128_t chachaRef[37], chachaOut[37];
+    uint8_t streamRef[37 * 70], streamOut[37 * 70];
+    chachaBlocks(&chachaKey, rounds, blocksIn, chachaRef, 37);
+    chachaStream(blocksIn, 37, rounds, streamRef, 70);
+    if (chachaAvx2Supported()) {
+      chachaBlocksAvx2(&chachaKey, rounds, blocksIn, chachaOut, 37);
+      chachaStreamAvx2(blocksIn, 37, rounds, streamOut, 70);
+      if (memcmp(chachaOut, chachaRef, sizeof(chachaRef)) != 0 ||
+          memcmp(streamOut, streamRef, sizeof(streamRef)) != 0) {
+        printf("Test[19] failed: ChaCha%d AVX2 kernel mismatch!\n", rounds);
+        return 1;
+      }
+    }
+  }
+  for (int backend = KEY_PRG_CHACHA8; backend <= KEY_PRG_CHACHA12; backend++) {
+    for (int mode = 0; mode < 2; mode++) {
+      EVP_CIPHER_CTX *ctx_cc = getDPFContext(aeskey);
+      setPRGBackend(ctx_cc, backend);
+      setKeyFlags(ctx_cc, mode ? KEY_FLAG_FIXED_KEY_LEAF : 0);
+      uint64_t index_cc = rand() % (1ULL << SIZE);
+      unsigned char k0_cc[18 * SIZE + 18 + 37], k1_cc[18 * SIZE + 18 + 37];
+      uint8_t out0_cc[(1 << SIZE) * 37], out1_cc[(1 << SIZE) * 37];
+      genDPF(ctx_cc, SIZE, index_cc, 37, data_fk, k0_cc, k1_cc);
+      if (((k0_cc[17] & KEY_PRG_MASK) >> KEY_PRG_SHIFT) != backend) {
+        printf("Test[19] failed: backend not recorded!\n");
+        return 1;
+      }
+      fullDomainDPF(ctx_cc, SIZE, k0_cc, 37, out0_cc);
+      fullDomainDPF(ctx_cc, SIZE, k1_cc, 37, out1_cc);
+      for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+        uint8_t share0[37];
+        evalDPF(ctx_cc, k0_cc, x, 37, share0);
+        for (int j = 0; j < 37; j++) {
+          uint8_t expected = x == index_cc ? data_fk[j] : 0;
+          if ((out0_cc[x * 37 + j] ^ out1_cc[x * 37 + j]) != expected ||
+              share0[j] != out0_cc[x * 37 + j]) {
+            printf("Test[19] failed at DPF index %lu!\n", x);
+            return 1;
+          }
+        }
+      }
+
+      uint8_t *k0_ccm = (uint8_t *)malloc(19 + SIZE * 2 * 24 + 2 * 37);
+      uint8_t *k1_ccm = (uint8_t *)malloc(19 + SIZE * 2 * 24 + 2 * 37);
+      genDMPF(ctx_cc, 2, SIZE, index_fk, 37, data_fk, k0_ccm, k1_ccm);
+      fullDomainDMPF(ctx_cc, k0_ccm, 37, out0_cc);
+      fullDomainDMPF(ctx_cc, k1_ccm, 37, out1_cc);
+      for (uint64_t x = 0; x < (1ULL << SIZE); x++) {
+        for (int j = 0; j < 37; j++) {
+          uint8_t expected = x == index_fk[0]   ? data_fk[j]
+                             : x == index_fk[1] ? data_fk[37 + j]
+                                                : 0;
+          if ((out0_cc[x * 37 + j] ^ out1_cc[x * 37 + j]) != expected) {
+            printf("Test[19] failed at DMPF index %lu!\n", x);
+            return 1;
+          }
+        }
+      }
+
+      // an AES context rejects ChaCha keys up front and leaves the output
+      EVP_CIPHER_CTX *ctx_aes = getDPFContext(aeskey);
+      memset(out0_cc, 0xAA, sizeof(out0_cc));
+      fullDomainDPF(ctx_aes, SIZE, k0_cc, 37, out0_cc);
+      evalDPF(ctx_aes, k0_cc, index_cc, 37, out0_cc);
+      fullDomainDMPF(ctx_aes, k0_ccm, 37, out0_cc);
+      evalDMPF(ctx_aes, index_fk[0], 37, out0_cc, k0_ccm);
+      for (size_t i = 0; i < sizeof(out0_cc); i++) {
+        if (out0_cc[i] != 0xAA) {
+          printf("Test[19] failed: key of another backend was evaluated!\n");
+          return 1;
+        }
+      }
+      destroyContext(ctx_aes);
+      free(k0_ccm);
+      free(k1_ccm);
+      destroyContext(ctx_cc);
+    }
+  }
+  printf("Test[19] passed.\n");
+
+  // Test[20]: DMPF with more than 8 points over a domain wide enough for the
+  // per-level correction tables
+  printf("Test[20]: DMPF with many points...\n");
+  EVP_CIPHER_CTX *ctx_tab = getDPFContext(aeskey);
+  const int t_tab = 20, size_tab = 9, ds_tab = 4;
+  uint64_t index_tab[t_tab];
+  uint8_t data_tab[t_tab * ds_tab];
+  for (int i = 0; i < t_tab; i++)
+    index_tab[i] = 25 * i + rand() % 25;
+  for (int i = 0; i < t_tab * ds_tab; i++)
+    data_tab[i] = rand() % 255 + 1;
+  size_t key_tab = 19 + size_tab * t_tab * 24 + t_tab * ds_tab;
+  uint8_t *k0_tab = (uint8_t *)malloc(key_tab);
+  uint8_t *k1_tab = (uint8_t *)malloc(key_tab);
+  uint8_t *out0_tab = (uint8_t *)malloc((1 << size_tab) * ds_tab);
+  uint8_t *out1_tab = (uint8_t *)malloc((1 << size_tab) * ds_tab);
+  genDMPF(ctx_tab, t_tab, size_tab, index_tab, ds_tab, data_tab, k0_tab,
+          k1_tab);
+  fullDomainDMPF(ctx_tab, k0_tab, ds_tab, out0_tab);
+  fullDomainDMPF(ctx_tab, k1_tab, ds_tab, out1_tab);
+  int point_tab = 0;
+  for (uint64_t x = 0; x < (1ULL << size_tab); x++) {
+    uint8_t share0[ds_tab];
+    evalDMPF(ctx_tab, x, ds_tab, share0, k0_tab);
+    int hit = point_tab < t_tab && index_tab[point_tab] == x;
+    for (int j = 0; j < ds_tab; j++) {
+      uint8_t expected = hit ? data_tab[point_tab * ds_tab + j] : 0;
+      if ((out0_tab[x * ds_tab + j] ^ out1_tab[x * ds_tab + j]) != expected ||
+          share0[j] != out0_tab[x * ds_tab + j]) {
+        printf("Test[20] failed at index %lu!\n", x);
+        return 1;
+      }
+    }
+    point_tab += hit;
+  }
+  free(k0_tab);
+  free(k1_tab);
+  free(out0_tab);
+  free(out1_tab);
+  destroyContext(ctx_tab);
+  printf("Test[20] passed.\n");
+
+  // Test[21]: the single-pass correction kernel matches a byte-wise XOR for
+  // every tail length, and full-domain DMPF with a multi-block payload
+  printf("Test[21]: multi-row XOR kernel...\n");
+  uint8_t rows_x[33][700], out_x[700], ref_x[700];
+  const uint8_t *rowPtrs_x[33];
+  for (int r = 0; r < 33; r++) {
+    rowPtrs_x[r] = rows_x[r];
+    for (int i = 0; i < 700; i++)
+      rows_x[r][i] = rand();
+  }
+  for (int len = 0; len <= 700; len += len < 300 ? 1 : 97) {
+    for (int n = 0; n <= 33; n += 11) {
+      for (int i = 0; i < len; i++)
+        out_x[i] = ref_x[i] = rand();
+      for (int r = 0; r < n; r++)
+        for (int i = 0; i < len; i++)
+          ref_x[i] ^= rows_x[r][i];
+      xorRows(out_x, rowPtrs_x, n, len);
+      if (memcmp(out_x, ref_x, len) != 0) {
+        printf("Test[21] failed: xorRows with %d rows of %d bytes!\n", n, len);
+        return 1;
+      }
+    }
+  }
+
+  const int ds_x = 1000;
+  uint8_t *data_x = (uint8_t *)malloc(3 * ds_x);
+  for (int i = 0; i < 3 * ds_x; i++)
+    data_x[i] = rand();
+  uint64_t index_x[3] = {3, 17, 30};
+  uint8_t *k0_x = (uint8_t *)malloc(19 + 5 * 3 * 24 + 3 * ds_x);
+  uint8_t *k1_x = (uint8_t *)malloc(19 + 5 * 3 * 24 + 3 * ds_x);
+  uint8_t *out0_x = (uint8_t *)malloc(32 * ds_x);
+  uint8_t *out1_x = (uint8_t *)malloc(32 * ds_x);
+  EVP_CIPHER_CTX *ctx_x = getDPFContext(aeskey);
+  genDMPF(ctx_x, 3, 5, index_x, ds_x, data_x, k0_x, k1_x);
+  fullDomainDMPF(ctx_x, k0_x, ds_x, out0_x);
+  fullDomainDMPF(ctx_x, k1_x, ds_x, out1_x);
+  for (uint64_t x = 0; x < 32; x++) {
+    int point = x == 3 ? 0 : x == 17 ? 1 : x == 30 ? 2 : -1;
+    for (int j = 0; j < ds_x; j++) {
+      uint8_t expected = point >= 0 ? data_x[point * ds_x + j] : 0;
+      if ((out0_x[x * ds_x + j] ^ out1_x[x * ds_x + j]) != expected) {
+        printf("Test[21] failed at DMPF index %lu!\n", x);
+        return 1;
+      }
+    }
+  }
+  free(data_x);
+  free(k0_x);
+  free(k1_x);
+  free(out0_x);
+  free(out1_x);
+  destroyContext(ctx_x);
+  printf("Test[21] passed.\n");
+
+  // Test[22]: full-domain DMPF with and without the subset-XOR table of last
+  // correction words gives the same shares
+  printf("Test[22]: last-CW subset table...\n");
+  EVP_CIPHER_CTX *ctx_st = getDPFContext(aeskey);
+  uint64_t index_st[5] = {2, 40, 41, 100, 250};
+  uint8_t data_st[5 * 64];
+  for (int i = 0; i < 5 * 64; i++)
+    data_st[i] = rand();
+  uint8_t *k0_st = (uint8_t *)malloc(19 + 8 * 5 * 24 + 5 * 64);
+  uint8_t *k1_st = (uint8_t *)malloc(19 + 8 * 5 * 24 + 5 * 64);
+  uint8_t *out_st = (uint8_t *)malloc(256 * 64);
+  uint8_t *ref_st = (uint8_t *)malloc(256 * 64);
+  genDMPF(ctx_st, 5, 8, index_st, 64, data_st, k0_st, k1_st);
+  for (int party = 0; party < 2; party++) {
+    uint8_t *k_st = party ? k1_st : k0_st;
+    setLastCWTableBudget(ctx_st, 0);
+    fullDomainDMPF(ctx_st, k_st, 64, ref_st);
+    setLastCWTableBudget(ctx_st, LASTCW_TABLE_BYTES);
+    fullDomainDMPF(ctx_st, k_st, 64, out_st);
+    if (memcmp(out_st, ref_st, 256 * 64) != 0) {
+      printf("Test[22] failed: subset-XOR table changed the shares!\n");
+      return 1;
+    }
+  }
+  free(k0_st);
+  free(k1_st);
+  free(out_st);
+  free(ref_st);
+  destroyContext(ctx_st);
+  printf("Test[22] passed.\n");
+
+  // Test[23]: DPF and VDPF full domain over several depth-first subtrees
+  printf("Test[23]: depth-first subtrees...\n");
+  const int size_df = DPF_BLOCK_LEVELS + 3, ds_df = 16;
+  const uint64_t n_df = 1ULL << size_df;
+  EVP_CIPHER_CTX *ctx_df = getDPFContext(aeskey);
+  uint64_t index_df = rand() % n_df;
+  uint8_t *k0_df = (uint8_t *)malloc(CWSIZE * (size_df + 1) + 64 + ds_df);
+  uint8_t *k1_df = (uint8_t *)malloc(CWSIZE * (size_df + 1) + 64 + ds_df);
+  uint8_t *out0_df = (uint8_t *)malloc(n_df * ds_df);
+  uint8_t *out1_df = (uint8_t *)malloc(n_df * ds_df);
+  uint8_t share_df[ds_df], pi0_df[32], pi1_df[32];
+
+  genDPF(ctx_df, size_df, index_df, ds_df, data_fk, k0_df, k1_df);
+  fullDomainDPF(ctx_df, size_df, k0_df, ds_df, out0_df);
+  fullDomainDPF(ctx_df, size_df, k1_df, ds_df, out1_df);
+  for (uint64_t x = 0; x < n_df; x++) {
+    for (int j = 0; j < ds_df; j++) {
+      uint8_t expected = x == index_df ? data_fk[j] : 0;
+      if ((out0_df[x * ds_df + j] ^ out1_df[x * ds_df + j]) != expected) {
+        printf("Test[23] failed at DPF index %lu!\n", x);
+        return 1;
+      }
+    }
+  }
+  for (uint64_t x = 0; x < n_df; x += 1013) {
+    evalDPF(ctx_df, k0_df, x, ds_df, share_df);
+    if (memcmp(share_df, out0_df + x * ds_df, ds_df) != 0) {
+      printf("Test[23] failed: evalDPF differs at index %lu!\n", x);
+      return 1;
+    }
+  }
+
+  mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+  genVDPF(ctx_df, mmo_hash1, size_df, index_df, data_fk, ds_df, k0_df, k1_df);
+  destroyMMOHash(mmo_hash1);
+  for (int party = 0; party < 2; party++) {
+    mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+    mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+    fullDomainVDPF(ctx_df, mmo_hash1, mmo_hash2, ds_df,
+                   party ? k1_df : k0_df, party ? out1_df : out0_df,
+                   party ? pi1_df : pi0_df);
+    destroyMMOHash(mmo_hash1);
+    destroyMMOHash(mmo_hash2);
+  }
+  if (memcmp(pi0_df, pi1_df, 32) != 0) {
+    printf("Test[23] failed: VDPF proofs differ!\n");
+    return 1;
+  }
+  for (uint64_t x = 0; x < n_df; x++) {
+    for (int j = 0; j < ds_df; j++) {
+      uint8_t expected = x == index_df ? data_fk[j] : 0;
+      if ((out0_df[x * ds_df + j] ^ out1_df[x * ds_df + j]) != expected) {
+        printf("Test[23] failed at VDPF index %lu!\n", x);
+        return 1;
+      }
+    }
+  }
+  free(k0_df);
+  free(k1_df);
+  free(out0_df);
+  free(out1_df);
+  destroyContext(ctx_df);
+  printf("Test[23] passed.\n");
+
+  // Test[24]: big-state full domain walked in small breadth-first blocks
+  // matches the default traversal (DMPF, VDMPF proof and decompression)
+  printf("Test[24]: big-state block traversal...\n");
+  EVP_CIPHER_CTX *ctx_bl = getDPFContext(aeskey);
+  const int t_bl = 3, size_bl = 9, ds_bl = 8;
+  uint64_t index_bl[3] = {5, 200, 511};
+  uint8_t data_bl[3 * 8];
+  for (int i = 0; i < 3 * ds_bl; i++)
+    data_bl[i] = rand();
+  int dks_bl = 19 + size_bl * t_bl * 24 + t_bl * ds_bl;
+  uint8_t *k_bl = (uint8_t *)malloc(dks_bl + 64 * t_bl);
+  uint8_t *k1_bl = (uint8_t *)malloc(dks_bl + 64 * t_bl);
+  uint8_t *c_bl = (uint8_t *)malloc(34 + size_bl * t_bl * 24 + t_bl * ds_bl);
+  uint8_t *ref_bl = (uint8_t *)malloc((1 << size_bl) * ds_bl);
+  uint8_t *out_bl = (uint8_t *)malloc((1 << size_bl) * ds_bl);
+  uint8_t pi_ref_bl[32], pi_bl[32];
+
+  genDMPF(ctx_bl, t_bl, size_bl, index_bl, ds_bl, data_bl, k_bl, k1_bl);
+  compressDMPF(ctx_bl, t_bl, size_bl, index_bl, ds_bl, data_bl, c_bl);
+  for (int levels = 0; levels <= 5; levels += 5) {
+    setBigStateBlockLevels(ctx_bl, BIGSTATE_BLOCK_LEVELS);
+    fullDomainDMPF(ctx_bl, k_bl, ds_bl, ref_bl);
+    setBigStateBlockLevels(ctx_bl, levels);
+    fullDomainDMPF(ctx_bl, k_bl, ds_bl, out_bl);
+    if (memcmp(ref_bl, out_bl, (1 << size_bl) * ds_bl) != 0) {
+      printf("Test[24] failed: DMPF with %d block levels!\n", levels);
+      return 1;
+    }
+
+    setBigStateBlockLevels(ctx_bl, BIGSTATE_BLOCK_LEVELS);
+    decompressDMPF(ctx_bl, c_bl, ds_bl, ref_bl);
+    setBigStateBlockLevels(ctx_bl, levels);
+    decompressDMPF(ctx_bl, c_bl, ds_bl, out_bl);
+    if (memcmp(ref_bl, out_bl, (1 << size_bl) * ds_bl) != 0) {
+      printf("Test[24] failed: decompression with %d block levels!\n",
+             levels);
+      return 1;
+    }
+  }
+
+  mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+  genVDMPF(ctx_bl, mmo_hash1, t_bl, size_bl, index_bl, ds_bl, data_bl, k_bl,
+           k1_bl);
+  destroyMMOHash(mmo_hash1);
+  for (int pass = 0; pass < 2; pass++) {
+    setBigStateBlockLevels(ctx_bl, pass ? 4 : BIGSTATE_BLOCK_LEVELS);
+    mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+    mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+    fullDomainVDMPF(ctx_bl, mmo_hash1, mmo_hash2, ds_bl, k_bl,
+                    pass ? out_bl : ref_bl, pass ? pi_bl : pi_ref_bl);
+    destroyMMOHash(mmo_hash1);
+    destroyMMOHash(mmo_hash2);
+  }
+  if (memcmp(ref_bl, out_bl, (1 << size_bl) * ds_bl) != 0 ||
+      memcmp(pi_ref_bl, pi_bl, 32) != 0) {
+    printf("Test[24] failed: VDMPF with 4 block levels!\n");
+    return 1;
+  }
+  free(k_bl);
+  free(k1_bl);
+  free(c_bl);
+  free(ref_bl);
+  free(out_bl);
+  destroyContext(ctx_bl);
+  printf("Test[24] passed.\n");
+
+  // Test[25]: parallel full-domain evaluation (pthreads and an external
+  // pool) matches one thread, proofs included, and the other server's
+  // parallel proof matches
+  printf("Test[25]: parallel full domain...\n");
+  EVP_CIPHER_CTX *ctx_mt = getDPFContext(aeskey);
+  const int size_mt = DPF_BLOCK_LEVELS + 4, ds_mt = 8, t_mt = 5;
+  const uint64_t n_mt = 1ULL << size_mt;
+  uint64_t index_mt[5] = {0, 77, 1000, 9000, n_mt - 1};
+  uint8_t data_mt[5 * 8];
+  for (int i = 0; i < t_mt * ds_mt; i++)
+    data_mt[i] = rand();
+  int dks_mt = 19 + size_mt * t_mt * 24 + t_mt * ds_mt;
+  uint8_t *k_mt = (uint8_t *)malloc(dks_mt + 64 * t_mt);
+  uint8_t *k1_mt = (uint8_t *)malloc(dks_mt + 64 * t_mt);
+  uint8_t *c_mt = (uint8_t *)malloc(34 + size_mt * t_mt * 24 + t_mt * ds_mt);
+  uint8_t *ref_mt = (uint8_t *)malloc(n_mt * ds_mt);
+  uint8_t *out_mt = (uint8_t *)malloc(n_mt * ds_mt);
+  uint8_t pi_mt[2][32];
+
+  for (int mode = 1; mode <= 2; mode++) {
+    // mode 1: pthreads, mode 2: the inline pool below
+    setThreadPool(ctx_mt, mode == 2 ? runTasksInline : NULL, NULL);
+    genDPF(ctx_mt, size_mt, index_mt[2], ds_mt, data_mt, k_mt, k1_mt);
+    for (int threads = 1; threads <= 4; threads += 3) {
+      setFullDomainThreads(ctx_mt, threads);
+      fullDomainDPF(ctx_mt, size_mt, k_mt, ds_mt,
+                    threads == 1 ? ref_mt : out_mt);
+    }
+    if (memcmp(ref_mt, out_mt, n_mt * ds_mt) != 0) {
+      printf("Test[25] failed: DPF in mode %d!\n", mode);
+      return 1;
+    }
+
+    mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+    genVDPF(ctx_mt, mmo_hash1, size_mt, index_mt[2], data_mt, ds_mt, k_mt,
+            k1_mt);
+    destroyMMOHash(mmo_hash1);
+    for (int threads = 1; threads <= 4; threads += 3) {
+      setFullDomainThreads(ctx_mt, threads);
+      mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+      mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+      fullDomainVDPF(ctx_mt, mmo_hash1, mmo_hash2, ds_mt, k_mt,
+                     threads == 1 ? ref_mt : out_mt, pi_mt[threads > 1]);
+      destroyMMOHash(mmo_hash1);
+      destroyMMOHash(mmo_hash2);
+    }
+    if (memcmp(ref_mt, out_mt, n_mt * ds_mt) != 0 ||
+        memcmp(pi_mt[0], pi_mt[1], 32) != 0) {
+      printf("Test[25] failed: VDPF in mode %d!\n", mode);
+      return 1;
+    }
+    mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+    mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+    fullDomainVDPF(ctx_mt, mmo_hash1, mmo_hash2, ds_mt, k1_mt, out_mt,
+                   pi_mt[1]);
+    destroyMMOHash(mmo_hash1);
+    destroyMMOHash(mmo_hash2);
+    if (memcmp(pi_mt[0], pi_mt[1], 32) != 0) {
+      printf("Test[25] failed: VDPF proofs differ across servers!\n");
+      return 1;
+    }
+
+    genDMPF(ctx_mt, t_mt, size_mt, index_mt, ds_mt, data_mt, k_mt, k1_mt);
+    compressDMPF(ctx_mt, t_mt, size_mt, index_mt, ds_mt, data_mt, c_mt);
+    for (int threads = 1; threads <= 4; threads += 3) {
+      setFullDomainThreads(ctx_mt, threads);
+      fullDomainDMPF(ctx_mt, k_mt, ds_mt, threads == 1 ? ref_mt : out_mt);
+    }
+    if (memcmp(ref_mt, out_mt, n_mt * ds_mt) != 0) {
+      printf("Test[25] failed: DMPF in mode %d!\n", mode);
+      return 1;
+    }
+    for (int threads = 1; threads <= 4; threads += 3) {
+      setFullDomainThreads(ctx_mt, threads);
+      decompressDMPF(ctx_mt, c_mt, ds_mt, threads == 1 ? ref_mt : out_mt);
+    }
+    if (memcmp(ref_mt, out_mt, n_mt * ds_mt) != 0) {
+      printf("Test[25] failed: decompression in mode %d!\n", mode);
+      return 1;
+    }
+
+    mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+    genVDMPF(ctx_mt, mmo_hash1, t_mt, size_mt, index_mt, ds_mt, data_mt, k_mt,
+             k1_mt);
+    destroyMMOHash(mmo_hash1);
+    for (int threads = 1; threads <= 4; threads += 3) {
+      setFullDomainThreads(ctx_mt, threads);
+      mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+      mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+      fullDomainVDMPF(ctx_mt, mmo_hash1, mmo_hash2, ds_mt, k_mt,
+                      threads == 1 ? ref_mt : out_mt, pi_mt[threads > 1]);
+      destroyMMOHash(mmo_hash1);
+      destroyMMOHash(mmo_hash2);
+    }
+    if (memcmp(ref_mt, out_mt, n_mt * ds_mt) != 0 ||
+        memcmp(pi_mt[0], pi_mt[1], 32) != 0) {
+      printf("Test[25] failed: VDMPF in mode %d!\n", mode);
+      return 1;
+    }
+    mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+    mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+    fullDomainVDMPF(ctx_mt, mmo_hash1, mmo_hash2, ds_mt, k1_mt, out_mt,
+                    pi_mt[1]);
+    destroyMMOHash(mmo_hash1);
+    destroyMMOHash(mmo_hash2);
+    if (memcmp(pi_mt[0], pi_mt[1], 32) != 0) {
+      printf("Test[25] failed: VDMPF proofs differ across servers!\n");
+      return 1;
+    }
+  }
+  free(k_mt);
+  free(k1_mt);
+  free(c_mt);
+  free(ref_mt);
+  free(out_mt);
+  destroyContext(ctx_mt);
+  printf("Test[25] passed.\n");
+
+  // Test[26]: streaming full-domain evaluation delivers the same shares as
+  // the buffered one, in order and in chunks of the requested size, for DPF,
+  // DMPF, VDMPF, Half-Tree and VDPF keys
+  printf("Test[26]: streaming full domain...\n");
+  EVP_CIPHER_CTX *ctx_sm = getDPFContext(aeskey);
+  const int size_sm = DPF_BLOCK_LEVELS + 2, ds_sm = 4, t_sm = 3;
+  const uint64_t n_sm = 1ULL << size_sm;
+  uint64_t index_sm[3] = {1, 1500, n_sm - 2};
+  uint8_t data_sm[3 * 4];
+  for (int i = 0; i < t_sm * ds_sm; i++)
+    data_sm[i] = rand();
+  int dks_sm = 19 + size_sm * t_sm * 24 + t_sm * ds_sm;
+  uint8_t *k_sm = (uint8_t *)malloc(dks_sm + 64 * t_sm);
+  uint8_t *k1_sm = (uint8_t *)malloc(dks_sm + 64 * t_sm);
+  uint8_t *ref_sm = (uint8_t *)malloc(n_sm * ds_sm);
+  uint8_t *out_sm = (uint8_t *)malloc(n_sm * ds_sm);
+  uint8_t pi_sm[2][32];
+  const uint64_t chunks_sm[3] = {1, 1000, n_sm + 5};
+  struct StreamCheck check_sm;
+
+  for (int c = 0; c < 3; c++) {
+    uint64_t chunk = chunks_sm[c];
+    uint64_t calls = (n_sm + chunk - 1) / chunk;
+    for (int kind = 0; kind < 5; kind++) {
+      memset(out_sm, 0, n_sm * ds_sm);
+      check_sm = (struct StreamCheck){out_sm, ds_sm, chunk, 0, 0, 1};
+      if (kind == 0) {
+        setKeyFlags(ctx_sm, KEY_FLAG_PACKED_LEAVES);
+        genDPF(ctx_sm, size_sm, index_sm[1], ds_sm, data_sm, k_sm, k1_sm);
+        fullDomainDPF(ctx_sm, size_sm, k_sm, ds_sm, ref_sm);
+        fullDomainDPFStream(ctx_sm, size_sm, k_sm, ds_sm, chunk, collectChunk,
+                            &check_sm);
+      } else if (kind == 1) {
+        setKeyFlags(ctx_sm, 0);
+        genDMPF(ctx_sm, t_sm, size_sm, index_sm, ds_sm, data_sm, k_sm, k1_sm);
+        fullDomainDMPF(ctx_sm, k_sm, ds_sm, ref_sm);
+        fullDomainDMPFStream(ctx_sm, k_sm, ds_sm, chunk, collectChunk,
+                             &check_sm);
+      } else if (kind == 3) {
+        setKeyFlags(ctx_sm, 0);
+        genHalfTreeDPF(ctx_sm, size_sm, index_sm[2], ds_sm, data_sm, k_sm,
+                       k1_sm);
+        fullDomainHalfTreeDPF(ctx_sm, k_sm, ds_sm, ref_sm);
+        fullDomainHalfTreeDPFStream(ctx_sm, k_sm, ds_sm, chunk, collectChunk,
+                                    &check_sm);
+      } else if (kind == 4) {
+        mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+        genVDPF(ctx_sm, mmo_hash1, size_sm, index_sm[0], data_sm, ds_sm, k_sm,
+                k1_sm);
+        destroyMMOHash(mmo_hash1);
+        for (int pass = 0; pass < 2; pass++) {
+          mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+          mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+          if (pass == 0)
+            fullDomainVDPF(ctx_sm, mmo_hash1, mmo_hash2, ds_sm, k_sm, ref_sm,
+                           pi_sm[0]);
+          else
+            fullDomainVDPFStream(ctx_sm, mmo_hash1, mmo_hash2, ds_sm, k_sm,
+                                 chunk, collectChunk, &check_sm, pi_sm[1]);
+          destroyMMOHash(mmo_hash1);
+          destroyMMOHash(mmo_hash2);
+        }
+      } else {
+        mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+        genVDMPF(ctx_sm, mmo_hash1, t_sm, size_sm, index_sm, ds_sm, data_sm,
+                 k_sm, k1_sm);
+        destroyMMOHash(mmo_hash1);
+        for (int pass = 0; pass < 2; pass++) {
+          mmo_hash1 = initMMOHash((uint8_t *)&hashkey1, outblocks);
+          mmo_hash2 = initMMOHash((uint8_t *)&hashkey2, outblocks);
+          if (pass == 0)
+            fullDomainVDMPF(ctx_sm, mmo_hash1, mmo_hash2, ds_sm, k_sm, ref_sm,
+                            pi_sm[0]);
+          else
+            fullDomainVDMPFStream(ctx_sm, mmo_hash1, mmo_hash2, ds_sm, k_sm,
+                                  chunk, collectChunk, &check_sm, pi_sm[1]);
+          destroyMMOHash(mmo_hash1);
+          destroyMMOHash(mmo_hash2);
+        }
+      }
+      if (!check_sm.ok || check_sm.next != n_sm || check_sm.calls != calls ||
+          memcmp(ref_sm, out_sm, n_sm * ds_sm) != 0 ||
+          ((kind == 2 || kind == 4) && memcmp(pi_sm[0], pi_sm[1], 32) != 0)) {
+        printf("Test[26] failed: kind %d with chunks of %lu!\n", kind, chunk);
+        return 1;
+      }
+    }
+  }
+  free(k_sm);
+  free(k1_sm);
+  free(ref_sm);
+  free(out_sm);
+  destroyContext(ctx_sm);
+  printf("Test[26] passed.\n");
+
+  // Test[27]: range evaluation returns the matching slice of the full domain
+  // for aligned, unaligned and single-point ranges, on binary and
+  // higher-arity trees
+  printf("Test[27]: range evaluation...\n");
+  EVP_CIPHER_CTX *ctx_rg = getDPFContext(aeskey);
+  const int size_rg = DPF_BLOCK_LEVELS + 2, ds_rg = 4, t_rg = 3;
+  const uint64_t n_rg = 1ULL << size_rg;
+  uint64_t index_rg[3] = {2, 1500, n_rg - 3};
+  uint8_t data_rg[3 * 4];
+  for (int i = 0; i < t_rg * ds_rg; i++)
+    data_rg[i] = rand();
+  int dks_rg = karyDMPFKeySize(8, t_rg, size_rg, ds_rg);
+  uint8_t *k_rg = (uint8_t *)malloc(dks_rg);
+  uint8_t *k1_rg = (uint8_t *)malloc(dks_rg);
+  uint8_t *ref_rg = (uint8_t *)malloc(n_rg * ds_rg);
+  uint8_t *out_rg = (uint8_t *)malloc(n_rg * ds_rg);
+  const uint64_t ranges_rg[6][2] = {{0, n_rg},     {1, 2},
+                                    {3, 1029},     {1024, 2048},
+                                    {1500, 1501},  {n_rg - 7, n_rg}};
+
+  // kinds 3 and 4 are 4-ary DPF and 8-ary DMPF keys
+  for (int kind = 0; kind < 5; kind++) {
+    setKeyFlags(ctx_rg, kind == 1 ? KEY_FLAG_PACKED_LEAVES : 0);
+    if (kind < 2) {
+      genDPF(ctx_rg, size_rg, index_rg[1], ds_rg, data_rg, k_rg, k1_rg);
+      fullDomainDPF(ctx_rg, size_rg, k_rg, ds_rg, ref_rg);
+    } else if (kind == 3) {
+      genKaryDPF(ctx_rg, 4, size_rg, index_rg[1], ds_rg, data_rg, k_rg,
+                 k1_rg);
+      fullDomainDPF(ctx_rg, size_rg, k_rg, ds_rg, ref_rg);
+    } else {
+      if (kind == 2)
+        genDMPF(ctx_rg, t_rg, size_rg, index_rg, ds_rg, data_rg, k_rg, k1_rg);
+      else
+        genKaryDMPF(ctx_rg, 8, t_rg, size_rg, index_rg, ds_rg, data_rg, k_rg,
+                    k1_rg);
+      fullDomainDMPF(ctx_rg, k_rg, ds_rg, ref_rg);
+    }
+    for (int r = 0; r < 6; r++) {
+      uint64_t lo = ranges_rg[r][0], hi = ranges_rg[r][1];
+      memset(out_rg, 0, n_rg * ds_rg);
+      if (kind < 2 || kind == 3)
+        evalRangeDPF(ctx_rg, size_rg, k_rg, ds_rg, lo, hi, out_rg);
+      else
+        evalRangeDMPF(ctx_rg, k_rg, ds_rg, lo, hi, out_rg);
+      if (memcmp(ref_rg + lo * ds_rg, out_rg, (hi - lo) * ds_rg) != 0) {
+        printf("Test[27] failed: kind %d on [%lu, %lu)!\n", kind, lo, hi);
+        return 1;
+      }
+    }
+  }
+  free(k_rg);
+  free(k1_rg);
+  free(ref_rg);
+  free(out_rg);
+  destroyContext(ctx_rg);
+  printf("Test[27] passed.\n");
+
+  // Test[28]: truncated domains match the prefix of the full domain, buffered
+  // and streamed, with one and several threads, on binary and higher-arity
+  // trees
+  printf("Test[28]: truncated domains...\n");
+  EVP_CIPHER_CTX *ctx_tr = getDPFContext(aeskey);
+  const int size_tr = DPF_BLOCK_LEVELS + 3, ds_tr = 4, t_tr = 3;
+  const uint64_t n_tr = 1ULL << size_tr;
+  uint64_t index_tr[3] = {5, 4097, n_tr - 1};
+  uint8_t data_tr[3 * 4];
+  for (int i = 0; i < t_tr * ds_tr; i++)
+    data_tr[i] = rand();
+  int dks_tr = karyDMPFKeySize(8, t_tr, size_tr, ds_tr);
+  uint8_t *k_tr = (uint8_t *)malloc(dks_tr);
+  uint8_t *k1_tr = (uint8_t *)malloc(dks_tr);
+  uint8_t *ref_tr = (uint8_t *)malloc(n_tr * ds_tr);
+  uint8_t *out_tr = (uint8_t *)malloc(n_tr * ds_tr);
+  const uint64_t domains_tr[4] = {1, n_tr / 2 + 1, 5000, n_tr};
+  struct StreamCheck check_tr;
+
+  // kinds 3 and 4 are 4-ary DPF and 8-ary DMPF keys
+  for (int kind = 0; kind < 5; kind++) {
+    int dpf_tr = kind < 2 || kind == 3;
+    setKeyFlags(ctx_tr, kind == 1 ? KEY_FLAG_PACKED_LEAVES : 0);
+    setFullDomainThreads(ctx_tr, 1);
+    if (kind < 2)
+      genDPF(ctx_tr, size_tr, index_tr[1], ds_tr, data_tr, k_tr, k1_tr);
+    else if (kind == 2)
+      genDMPF(ctx_tr, t_tr, size_tr, index_tr, ds_tr, data_tr, k_tr, k1_tr);
+    else if (kind == 3)
+      genKaryDPF(ctx_tr, 4, size_tr, index_tr[1], ds_tr, data_tr, k_tr,
+                 k1_tr);
+    else
+      genKaryDMPF(ctx_tr, 8, t_tr, size_tr, index_tr, ds_tr, data_tr, k_tr,
+                  k1_tr);
+    if (dpf_tr)
+      fullDomainDPF(ctx_tr, size_tr, k_tr, ds_tr, ref_tr);
+    else
+      fullDomainDMPF(ctx_tr, k_tr, ds_tr, ref_tr);
+    for (int d = 0; d < 4; d++) {
+      uint64_t domain = domains_tr[d];
+      for (int threads = 1; threads <= 4; threads += 3) {
+        setFullDomainThreads(ctx_tr, threads);
+        // the byte after the domain must stay untouched
+        memset(out_tr, 0xa5, n_tr * ds_tr);
+        if (dpf_tr)
+          truncatedDomainDPF(ctx_tr, size_tr, k_tr, ds_tr, domain, out_tr);
+        else
+          truncatedDomainDMPF(ctx_tr, k_tr, ds_tr, domain, out_tr);
+        if (memcmp(ref_tr, out_tr, domain * ds_tr) != 0 ||
+            (domain < n_tr && out_tr[domain * ds_tr] != 0xa5)) {
+          printf("Test[28] failed: kind %d, domain %lu, %d threads!\n", kind,
+                 domain, threads);
+          return 1;
+        }
+      }
+
+      memset(out_tr, 0, n_tr * ds_tr);
+      check_tr = (struct StreamCheck){out_tr, ds_tr, 1000, 0, 0, 1};
+      if (dpf_tr)
+        truncatedDomainDPFStream(ctx_tr, size_tr, k_tr, ds_tr, domain, 1000,
+                                 collectChunk, &check_tr);
+      else
+        truncatedDomainDMPFStream(ctx_tr, k_tr, ds_tr, domain, 1000,
+                                  collectChunk, &check_tr);
+      if (!check_tr.ok || check_tr.next != domain ||
+          memcmp(ref_tr, out_tr, domain * ds_tr) != 0) {
+        printf("Test[28] failed: kind %d streamed to %lu!\n", kind, domain);
+        return 1;
+      }
+    }
+  }
+  free(k_tr);
+  free(k1_tr);
+  free(ref_tr);
+  free(out_tr);
+  destroyContext(ctx_tr);
+  printf("Test[28] passed.\n");
+
+  // Test[29]: 2^40 domains: ranges near the top of the domain and truncated
+  // prefixes agree with point evaluation, so every index and offset is 64-bit
+  printf("Test[29]: 2^40 domains...\n");
+  EVP_CIPHER_CTX *ctx_40 = getDPFContext(aeskey);
+  const int size_40 = 40, ds_40 = 4, t_40 = 2;
+  const uint64_t n_40 = 1ULL << size_40, span_40 = 3000;
+  uint64_t index_40[2] = {7, n_40 - 1000};
+  uint8_t data_40[2 * 4];
+  for (int i = 0; i < t_40 * ds_40; i++)
+    data_40[i] = rand();
+  int dks_40 = 19 + size_40 * t_40 * 24 + t_40 * ds_40;
+  uint8_t *k_40 = (uint8_t *)malloc(dks_40);
+  uint8_t *k1_40 = (uint8_t *)malloc(dks_40);
+  uint8_t *out_40 = (uint8_t *)malloc(span_40 * ds_40);
+  uint8_t *out1_40 = (uint8_t *)malloc(span_40 * ds_40);
+  uint8_t share_40[4], share1_40[4];
+
+  for (int kind = 0; kind < 2; kind++) {
+    if (kind == 0)
+      genDPF(ctx_40, size_40, index_40[1], ds_40, data_40 + ds_40,
+             k_40, k1_40);
+    else
+      genDMPF(ctx_40, t_40, size_40, index_40, ds_40, data_40, k_40,
+              k1_40);
+    for (int part = 0; part < 2; part++) {
+      uint64_t lo = part ? n_40 - span_40 : 0;
+      if (kind == 0 && part == 0) {
+        truncatedDomainDPF(ctx_40, size_40, k_40, ds_40, span_40,
+                           out_40);
+        truncatedDomainDPF(ctx_40, size_40, k1_40, ds_40, span_40,
+                           out1_40);
+      } else if (kind == 0) {
+        evalRangeDPF(ctx_40, size_40, k_40, ds_40, lo, n_40, out_40);
+        evalRangeDPF(ctx_40, size_40, k1_40, ds_40, lo, n_40, out1_40);
+      } else if (part == 0) {
+        truncatedDomainDMPF(ctx_40, k_40, ds_40, span_40, out_40);
+        truncatedDomainDMPF(ctx_40, k1_40, ds_40, span_40, out1_40);
+      } else {
+        evalRangeDMPF(ctx_40, k_40, ds_40, lo, n_40, out_40);
+        evalRangeDMPF(ctx_40, k1_40, ds_40, lo, n_40, out1_40);
+      }
+      for (uint64_t i = 0; i < span_40; i++) {
+        uint64_t x = lo + i;
+        if (kind == 0) {
+          evalDPF(ctx_40, k_40, x, ds_40, share_40);
+          evalDPF(ctx_40, k1_40, x, ds_40, share1_40);
+        } else {
+          evalDMPF(ctx_40, x, ds_40, share_40, k_40);
+          evalDMPF(ctx_40, x, ds_40, share1_40, k1_40);
+        }
+        int point = -1;
+        for (int j = kind ? 0 : 1; j < t_40; j++)
+          if (index_40[j] == x)
+            point = j;
+        for (int j = 0; j < ds_40; j++) {
+          uint8_t want = point >= 0 ? data_40[point * ds_40 + j] : 0;
+          if (out_40[i * ds_40 + j] != share_40[j] ||
+              out1_40[i * ds_40 + j] != share1_40[j] ||
+              (share_40[j] ^ share1_40[j]) != want) {
+            printf("Test[29] failed: kind %d at %lu!\n", kind, x);
+            return 1;
+          }
+        }
+      }
+    }
+  }
+  free(k_40);
+  free(k1_40);
+  free(out_40);
+  free(out1_40);
+  destroyContext(ctx_40);
+  printf("Test[29] passed.\n");
+
+  // Test[30]: lockstep evaluation of many keys matches one fullDomainDPF per
+  // key, across key groups, domain sizes, packed leaves and threads
+  printf("Test[30]: lockstep multi-key evaluation...\n");
+  EVP_CIPHER_CTX *ctx_ls = getDPFContext(aeskey);
+  const int keys_ls = DPF_LOCKSTEP_KEYS + 4, ds_ls = 4;
+  const int sizes_ls[2] = {3, DPF_BLOCK_LEVELS + 2};
+  uint8_t data_ls[4] = {1, 2, 3, 4};
+  uint8_t *k_ls[DPF_LOCKSTEP_KEYS + 4], *out_ls[DPF_LOCKSTEP_KEYS + 4];
+  uint8_t *k1_ls = (uint8_t *)malloc(18 * sizes_ls[1] + 18 + ds_ls);
+  uint8_t *ref_ls = (uint8_t *)malloc((1ULL << sizes_ls[1]) * ds_ls);
+  for (int i = 0; i < keys_ls; i++) {
+    k_ls[i] = (uint8_t *)malloc(18 * sizes_ls[1] + 18 + ds_ls);
+    out_ls[i] = (uint8_t *)malloc((1ULL << sizes_ls[1]) * ds_ls);
+  }
+
+  for (int c = 0; c < 2 * 2 * 2; c++) {
+    int size = sizes_ls[c & 1], threads = c & 2 ? 4 : 1;
+    uint64_t n = 1ULL << size;
+    setKeyFlags(ctx_ls, c & 4 ? KEY_FLAG_PACKED_LEAVES : 0);
+    setFullDomainThreads(ctx_ls, threads);
+    for (int i = 0; i < keys_ls; i++)
+      genDPF(ctx_ls, size, (i * 7919) % n, ds_ls, data_ls, k_ls[i], k1_ls);
+    // a key of another shape makes every key go on its own
+    if (c == 7) {
+      setKeyFlags(ctx_ls, 0);
+      genDPF(ctx_ls, size, 1, ds_ls, data_ls, k_ls[keys_ls - 1], k1_ls);
+    }
+    fullDomainDPFMulti(ctx_ls, size, k_ls, keys_ls, ds_ls, out_ls);
+    for (int i = 0; i < keys_ls; i++) {
+      fullDomainDPF(ctx_ls, size, k_ls[i], ds_ls, ref_ls);
+      if (memcmp(ref_ls, out_ls[i], n * ds_ls) != 0) {
+        printf("Test[30] failed: key %d, case %d!\n", i, c);
+        return 1;
+      }
+    }
+  }
+  for (int i = 0; i < keys_ls; i++) {
+    free(k_ls[i]);
+    free(out_ls[i]);
+  }
+  free(k1_ls);
+  free(ref_ls);
+  destroyContext(ctx_ls);
+  printf("Test[30] passed.\n");
+
   printf("All tests passed :)\n");
   return 0;
 }
\ No newline at end of file
@@ -14,6 +14,11 @@ void evalBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
 void fullDomainBigStateVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
                              struct Hash *mmo_hash2, int dataSize, uint8_t *k,
                              uint8_t *out, uint8_t *proof);
+void fullDomainBigStateVDMPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                                   struct Hash *mmo_hash2, int dataSize,
+                                   uint8_t *k, uint64_t chunkSize,
+                                   DPFChunkFn visit, void *user,
+                                   uint8_t *proof);
 }
 
 void genVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int t, int size,
@@ -33,4 +38,12 @@ void fullDomainVDMPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
                      struct Hash *mmo_hash2, int dataSize, uint8_t *k,
                      uint8_t *out, uint8_t *proof) {
   fullDomainBigStateVDMPF(ctx, mmo_hash1, mmo_hash2, dataSize, k, out, proof);
-}
\ No newline at end of file
+}
+
+void fullDomainVDMPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                           struct Hash *mmo_hash2, int dataSize, uint8_t *k,
+                           uint64_t chunkSize, DPFChunkFn visit, void *user,
+                           uint8_t *proof) {
+  fullDomainBigStateVDMPFStream(ctx, mmo_hash1, mmo_hash2, dataSize, k,
+                                chunkSize, visit, user, proof);
+}
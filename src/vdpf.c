@@ -12,8 +12,6 @@
 #include <openssl/rand.h>
 #include <stdint.h>
 
-extern struct Sha_256 sha_256;
-
 void genVDPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int size, uint64_t index,
              uint8_t *data, int dataSize, unsigned char *k0,
              unsigned char *k1) {
@@ -115,31 +113,13 @@ void genVDPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int size, uint64_t index,
     uint8_t *lastCW = (uint8_t *)malloc(dataSize);
     uint8_t *convert0 = (uint8_t *)malloc(dataSize + 16);
     uint8_t *convert1 = (uint8_t *)malloc(dataSize + 16);
-    uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-    memset(zeros, 0, dataSize + 16);
     memcpy(lastCW, data, dataSize);
-    // printf("lastCW: %s\n", lastCW);
-    //  Use CTR mode encryption to generate PRG output
-    EVP_CIPHER_CTX *seedCtx0;
-    EVP_CIPHER_CTX *seedCtx1;
-    int len = 0;
-
-    if (!(seedCtx0 = EVP_CIPHER_CTX_new()))
-      printf("errors occurred in creating context\n");
-    if (!(seedCtx1 = EVP_CIPHER_CTX_new()))
-      printf("errors occurred in creating context\n");
-
-    if (1 != EVP_EncryptInit_ex(seedCtx0, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds0[size], NULL))
-      printf("errors occurred in init of dpf gen\n");
-    if (1 != EVP_EncryptInit_ex(seedCtx1, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds1[size], NULL))
-      printf("errors occurred in init of dpf gen\n");
-
-    if (1 != EVP_EncryptUpdate(seedCtx0, convert0, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
-    if (1 != EVP_EncryptUpdate(seedCtx1, convert1, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
+
+    // Convert the final seeds in the key mode selected on the context
+    uint8_t flags =
+        (getKeyFlags(ctx) & ~KEY_FLAG_PACKED_LEAVES) | KEY_FLAG_MMO_HASH;
+    leafConvert(ctx, flags, &seeds0[size], 1, dataSize, convert0);
+    leafConvert(ctx, flags, &seeds1[size], 1, dataSize, convert1);
 
     // Calculate final lastCW
     for (int i = 0; i < dataSize; i++) {
@@ -150,7 +130,7 @@ void genVDPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int size, uint64_t index,
     // Modify key format to include data
     k0[0] = size;
     memcpy(&k0[1], seeds0, 16);
-    k0[CWSIZE - 1] = bits0[0];
+    k0[CWSIZE - 1] = bits0[0] | flags;
     for (int i = 1; i <= size; i++) {
       memcpy(&k0[18 * i], &sCW[i - 1], 16);
       k0[CWSIZE * i + CWSIZE - 2] = tCW0[i - 1];
@@ -162,15 +142,12 @@ void genVDPF(EVP_CIPHER_CTX *ctx, struct Hash *hash, int size, uint64_t index,
     memcpy(k1, k0, INDEX_LASTCW + dataSize + 16 * (hash->outblocks));
     memcpy(&k1[1], seeds1, 16); // only value that is different from k0
     k1[0] = size;
-    k1[CWSIZE - 1] = bits1[0];
+    k1[CWSIZE - 1] = bits1[0] | flags;
 
     // Cleanup
     free(lastCW);
     free(convert0);
     free(convert1);
-    free(zeros);
-    EVP_CIPHER_CTX_free(seedCtx0);
-    EVP_CIPHER_CTX_free(seedCtx1);
   }
 }
 
@@ -192,7 +169,10 @@ void batchEvalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
   uint128_t pi[4];
 
   memcpy(&seeds[0], &k[1], 16);
-  bits[0] = k[CWSIZE - 1];
+  bits[0] = k[CWSIZE - 1] & KEY_CONTROL_BIT;
+  uint8_t flags = k[CWSIZE - 1] & ~KEY_CONTROL_BIT;
+  if (!checkVerifiableKey(ctx, flags, out, inl * dataSize, proof))
+    return;
 
   for (int i = 1; i <= size; i++) {
     memcpy(&sCW[i - 1], &k[18 * i], 16);
@@ -211,21 +191,20 @@ void batchEvalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
   int tL, tR;
 
   // outter loop: iterate over all evaluation points
-  for (int l = 0; l < inl; l++) {
+  for (uint64_t l = 0; l < inl; l++) {
     for (int i = 1; i <= size; i++) {
       dpfPRG(ctx, seeds[i - 1], &sL, &sR, &tL, &tR);
 
-      if (bits[i - 1] == 1) {
-        sL = sL ^ sCW[i - 1];
-        sR = sR ^ sCW[i - 1];
-        tL = tL ^ tCW0[i - 1];
-        tR = tR ^ tCW1[i - 1];
-      }
+      uint128_t mask = bitMask(bits[i - 1]);
+      sL = sL ^ (sCW[i - 1] & mask);
+      sR = sR ^ (sCW[i - 1] & mask);
+      tL = tL ^ (tCW0[i - 1] & -bits[i - 1]);
+      tR = tR ^ (tCW1[i - 1] & -bits[i - 1]);
 
       int xbit = getbit(in[l], size, i);
 
-      seeds[i] = (1 - xbit) * sL + xbit * sR;
-      bits[i] = (1 - xbit) * tL + xbit * tR;
+      seeds[i] = selectBlock(xbit, sL, sR);
+      bits[i] = selectBit(xbit, tL, tR);
     }
 
     // *********************************
@@ -256,171 +235,302 @@ void batchEvalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
     // END: DPF verification code
     // *********************************
     // Generate dataShare using PRG with the final seed
-    int len = 0;
-    uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-    memset(zeros, 0, dataSize + 16);
-
-    EVP_CIPHER_CTX *seedCtx;
-    if (!(seedCtx = EVP_CIPHER_CTX_new()))
-      printf("errors occurred in creating context\n");
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds[size], NULL))
-      printf("errors occurred in init of dpf eval\n");
-    if (1 !=
-        EVP_EncryptUpdate(seedCtx, out + l * dataSize, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
-
-    // If bits[size] == 1, xor in the correction word (lastCW) from the key
-    if (bits[size] == 1) {
-      // The correction word is at the end of the key: offset = 18 * n + 18
-      for (int i = 0; i < dataSize; i++) {
-        out[l * dataSize + i] ^= k[18 * size + 18 + i];
-      }
-    }
+    leafConvert(ctx, flags, &seeds[size], 1, dataSize, out + l * dataSize);
+
+    // If bits[size] == 1, xor in the correction word (lastCW) from the key,
+    // which is at the end of the key: offset = 18 * n + 18
+    xorIfSet(out + l * dataSize, &k[18 * size + 18], dataSize, bits[size]);
   }
 
   // VDPF output hash (just SHA256 of pi)
   uint8_t hash[32];
-  sha_256_init(&sha_256, hash);
-  sha_256_write(&sha_256, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
-  sha_256_close(&sha_256);
+  calc_sha_256(hash, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
   memcpy(proof, hash, 32);
 }
 
-void fullDomainVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
-                    struct Hash *mmo_hash2, int dataSize, unsigned char *k,
-                    uint8_t *out, uint8_t *proof) {
+// A parallel fullDomainVDPF run. Workers expand and convert whole subtree
+// blocks of the current round and run step 1 of the proof on clones of
+// mmo_hash1; for every leaf they leave the corrected tpi, which the caller
+// then chains into pi with mmo_hash2 in leaf order.
+struct VDPFFullDomain {
+  EVP_CIPHER_CTX *ctx;
+  struct Hash *hash1, *hash2;
+  const uint128_t *cwL, *cwR, *cs;
+  uint128_t root;
+  int size, topLevels, blockLevels, dataSize;
+  uint8_t flags;
+  const uint8_t *lastCW;
+  uint8_t *out;
+  uint128_t *tpi;       // 4 blocks per leaf of the round
+  uint64_t first, last; // blocks of the round
+  uint64_t next;        // next block to claim
+};
+
+static void fullDomainVDPFTask(void *arg, int worker) {
+  (void)worker;
+  struct VDPFFullDomain *run = (struct VDPFFullDomain *)arg;
+  EVP_CIPHER_CTX *ctx = cloneDPFContext(run->ctx);
+  struct Hash *hash1 = cloneMMOHash(run->hash1);
+
+  uint64_t blockLeaves = 1ULL << run->blockLevels;
+  uint64_t roundLeaf = run->first << run->blockLevels;
+  uint128_t *buf0 = malloc(sizeof(uint128_t) * blockLeaves);
+  uint128_t *buf1 = malloc(sizeof(uint128_t) * blockLeaves);
+
+  uint128_t leafSeeds[PRG_BATCH];
+  uint8_t leafBits[PRG_BATCH];
+  uint128_t tpiBatch[PRG_BATCH * 4];
+  uint128_t inputBatch[PRG_BATCH * 2];
+
+  struct DPFWalk walk;
+  uint64_t block, prev = 0;
+  int started = 0;
+  while ((block = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) <
+         run->last) {
+    if (started && block == prev + 1)
+      dpfWalkNext(ctx, &walk, run->cwL, run->cwR, block);
+    else
+      dpfWalkStart(ctx, &walk, run->root, run->cwL, run->cwR, run->topLevels,
+                   block);
+    started = 1;
+    prev = block;
+
+    uint128_t *leaves = dpfExpandSubtree(
+        ctx, walk.path[run->topLevels], run->cwL + run->topLevels,
+        run->cwR + run->topLevels, run->blockLevels, buf0, buf1);
+
+    uint64_t base = block << run->blockLevels;
+    for (uint64_t c = 0; c < blockLeaves; c += PRG_BATCH) {
+      int m = blockLeaves - c < PRG_BATCH ? blockLeaves - c : PRG_BATCH;
+      for (int l = 0; l < m; l++) {
+        leafBits[l] = lsb(leaves[c + l]);
+        leafSeeds[l] = set_lsb_zero(leaves[c + l]);
+        inputBatch[2 * l] = base + c + l;
+        inputBatch[2 * l + 1] = leafSeeds[l];
+      }
+      uint8_t *chunkOut = run->out + (base + c) * run->dataSize;
+      leafConvert(ctx, run->flags, leafSeeds, m, run->dataSize, chunkOut);
+      mmoHash2to4Batch(hash1, (uint8_t *)inputBatch, m, (uint8_t *)tpiBatch);
+
+      for (int l = 0; l < m; l++) {
+        xorIfSet(chunkOut + l * run->dataSize, run->lastCW, run->dataSize,
+                 leafBits[l]);
+        int bit = seed_lsb(leafSeeds[l]);
+        uint128_t *tpi = &run->tpi[4 * (base + c + l - roundLeaf)];
+        for (int j = 0; j < 4; j++)
+          tpi[j] = correct(tpiBatch[4 * l + j], run->cs[j], bit);
+      }
+    }
+  }
 
-  int size = k[0];
-  int numLeaves = 1 << size;
-  int maxLayer = size;
+  free(buf0);
+  free(buf1);
+  destroyMMOHash(hash1);
+  destroyContext(ctx);
+}
 
-  int currLevel = 0;
-  int levelIndex = 0;
-  int numIndexesInLevel = 2;
+// Runs the blocks of run in rounds of about PARALLEL_PROOF_BYTES of hand-over
+// data on the workers and folds each round into pi
+static void fullDomainVDPFParallel(struct VDPFFullDomain *run, uint128_t *pi) {
+  uint64_t blockLeaves = 1ULL << run->blockLevels;
+  uint64_t blocks = 1ULL << run->topLevels;
+  uint64_t roundBlocks = PARALLEL_PROOF_BYTES / (64 * blockLeaves);
+  if (roundBlocks < 1)
+    roundBlocks = 1;
+  if (roundBlocks > blocks)
+    roundBlocks = blocks;
+  run->tpi = malloc(sizeof(uint128_t) * 4 * roundBlocks * blockLeaves);
 
-  int treeSize = 2 * numLeaves - 1;
+  uint128_t hashinput[4];
+  uint128_t cpi[4];
+  for (run->first = 0; run->first < blocks; run->first += roundBlocks) {
+    run->last = run->first + roundBlocks < blocks ? run->first + roundBlocks
+                                                   : blocks;
+    run->next = run->first;
+    runParallel(run->ctx, fullDomainVDPFTask, run);
+
+    // steps 2 and 3 chain the leaves, so they run here in order
+    uint64_t leaves = (run->last - run->first) * blockLeaves;
+    for (uint64_t i = 0; i < leaves; i++) {
+      for (int j = 0; j < 4; j++)
+        hashinput[j] = pi[j] ^ run->tpi[4 * i + j];
+      mmoHash4to4(run->hash2, (uint8_t *)hashinput, (uint8_t *)cpi);
+      for (int j = 0; j < 4; j++)
+        pi[j] ^= cpi[j];
+    }
+  }
+  free(run->tpi);
+}
 
-  // treeSize too big to allocate on stack
-  uint128_t *seeds = malloc(sizeof(uint128_t) * treeSize);
-  int *bits = malloc(sizeof(int) * treeSize);
-  uint128_t sCW[maxLayer + 1];
-  int tCW0[maxLayer + 1];
-  int tCW1[maxLayer + 1];
+// Evaluates every point of k into out, or, if out is NULL, into stream one
+// block at a time, and writes the proof
+static void fullDomainVDPFRun(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                              struct Hash *mmo_hash2, int dataSize,
+                              unsigned char *k, uint8_t *out,
+                              struct DPFChunkStream *stream, uint8_t *proof) {
+
+  int size = k[0];
+  uint64_t numLeaves = 1ULL << size;
+  int maxLayer = size;
+
+  // every node keeps its control bit in the lsb of its seed, which the PRG
+  // ignores
+  uint128_t cwL[maxLayer + 1], cwR[maxLayer + 1];
   uint128_t cs[4];
   uint128_t pi[4];
 
   uint128_t hashinput[4];
-  uint128_t tpi[4];
   uint128_t cpi[4];
 
-  memcpy(seeds, &k[1], 16);
-  bits[0] = k[CWSIZE - 1];
+  uint128_t root;
+  memcpy(&root, &k[1], 16);
+  root = set_lsb_zero(root) | (k[CWSIZE - 1] & KEY_CONTROL_BIT);
+  uint8_t flags = k[CWSIZE - 1] & ~KEY_CONTROL_BIT;
+  // seed CWs have a zero lsb, which carries the control bit CW of each child
   for (int i = 1; i <= maxLayer; i++) {
-    memcpy(&sCW[i - 1], &k[18 * i], 16);
-    tCW0[i - 1] = k[CWSIZE * i + CWSIZE - 2];
-    tCW1[i - 1] = k[CWSIZE * i + CWSIZE - 1];
+    uint128_t sCW;
+    memcpy(&sCW, &k[18 * i], 16);
+    cwL[i - 1] = sCW ^ k[CWSIZE * i + CWSIZE - 2];
+    cwR[i - 1] = sCW ^ k[CWSIZE * i + CWSIZE - 1];
   }
 
-  memcpy(cs, &k[INDEX_LASTCW + 16], 16 * (mmo_hash1->outblocks));
-  memcpy(pi, &k[INDEX_LASTCW + 16], 16 * (mmo_hash1->outblocks)); // pi = cs
-
-  uint128_t sL, sR;
-  int tL, tR;
-  for (int i = 1; i < treeSize; i += 2) {
-    int parentIndex = 0;
-    if (i > 1) {
-      parentIndex = i - levelIndex - ((numIndexesInLevel - levelIndex) / 2);
-    }
-
-    dpfPRG(ctx, seeds[parentIndex], &sL, &sR, &tL, &tR);
-
-    if (bits[parentIndex] == 1) {
-      sL = sL ^ sCW[currLevel];
-      sR = sR ^ sCW[currLevel];
-      tL = tL ^ tCW0[currLevel];
-      tR = tR ^ tCW1[currLevel];
-    }
+  memcpy(cs, &k[INDEX_LASTCW + dataSize], 16 * (mmo_hash1->outblocks));
+  memcpy(pi, &k[INDEX_LASTCW + dataSize],
+         16 * (mmo_hash1->outblocks)); // pi = cs
 
-    int lIndex = i;
-    int rIndex = i + 1;
-    seeds[lIndex] = sL;
-    bits[lIndex] = tL;
-    seeds[rIndex] = sR;
-    bits[rIndex] = tR;
-
-    levelIndex += 2;
-    if (levelIndex == numIndexesInLevel) {
-      currLevel++;
-      numIndexesInLevel *= 2;
-      levelIndex = 0;
-    }
+  // walk the top levels depth first and expand subtrees of 2^blockLevels
+  // leaves breadth first, like fullDomainDPF, so that the leaves come out in
+  // order with only O(size + block) seeds live
+  int blockLevels = size < DPF_BLOCK_LEVELS ? size : DPF_BLOCK_LEVELS;
+  int topLevels = size - blockLevels;
+  uint64_t blockLeaves = 1ULL << blockLevels;
+
+  // with several threads the workers take whole blocks and only the chain
+  // of steps 2 and 3 stays on this thread; a stream is fed in order by the
+  // calling thread
+  if (getFullDomainThreads(ctx) > 1 && topLevels > 0 && !stream) {
+    struct VDPFFullDomain run = {
+        .ctx = ctx,
+        .hash1 = mmo_hash1,
+        .hash2 = mmo_hash2,
+        .cwL = cwL,
+        .cwR = cwR,
+        .cs = cs,
+        .root = root,
+        .size = size,
+        .topLevels = topLevels,
+        .blockLevels = blockLevels,
+        .dataSize = dataSize,
+        .flags = flags,
+        .lastCW = &k[18 * size + 18],
+        .out = out,
+    };
+    fullDomainVDPFParallel(&run, pi);
+
+    uint8_t hash[32];
+    calc_sha_256(hash, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
+    memcpy(proof, hash, sizeof(uint8_t) * 32);
+    return;
   }
 
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  memset(zeros, 0, dataSize + 16);
-
-  EVP_CIPHER_CTX *seedCtx;
-  if (!(seedCtx = EVP_CIPHER_CTX_new()))
-    printf("errors occurred in creating context\n");
-
-  for (int i = 0; i < numLeaves; i++) {
-    int len = 0;
-    int index = treeSize - numLeaves + i;
-
-    if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                                (uint8_t *)&seeds[index], NULL))
-      printf("errors occurred in init of dpf eval\n");
-    if (1 !=
-        EVP_EncryptUpdate(seedCtx, out + i * dataSize, &len, zeros, dataSize))
-      printf("errors occurred in encrypt\n");
-
-    if (bits[index] == 1) {
-      for (int j = 0; j < dataSize; j++) {
-        out[i * dataSize + j] ^= k[18 * size + 18 + j];
-      }
+  uint128_t *buf0 = malloc(sizeof(uint128_t) * blockLeaves);
+  uint128_t *buf1 = malloc(sizeof(uint128_t) * blockLeaves);
+  uint8_t *blockBuf = stream ? malloc(blockLeaves * dataSize) : NULL;
+
+  uint128_t leafSeeds[PRG_BATCH];
+  uint8_t leafBits[PRG_BATCH];
+  uint128_t tpiBatch[PRG_BATCH * 4];
+  uint128_t inputBatch[PRG_BATCH * 2];
+
+  struct DPFWalk walk;
+  uint128_t *leaves = NULL;
+  dpfWalkStart(ctx, &walk, root, cwL, cwR, topLevels, 0);
+  for (uint64_t c = 0; c < numLeaves; c += PRG_BATCH) {
+    // a chunk never straddles two subtrees
+    uint64_t offset = c & (blockLeaves - 1);
+    if (c > 0 && offset == 0)
+      dpfWalkNext(ctx, &walk, cwL, cwR, c >> blockLevels);
+    if (offset == 0)
+      leaves = dpfExpandSubtree(ctx, walk.path[topLevels], cwL + topLevels,
+                                cwR + topLevels, blockLevels, buf0, buf1);
+
+    // split a chunk of leaves into seed and control bit, convert them and
+    // run step 1 of the proof: H(index||seeds[index]), as evalVDPF does
+    int m = numLeaves - c < PRG_BATCH ? numLeaves - c : PRG_BATCH;
+    for (int l = 0; l < m; l++) {
+      leafBits[l] = lsb(leaves[offset + l]);
+      leafSeeds[l] = set_lsb_zero(leaves[offset + l]);
+      inputBatch[2 * l] = c + l;
+      inputBatch[2 * l + 1] = leafSeeds[l];
     }
-
-    // *********************************
-    // START: DPF verification code
-    // *********************************
-    int bit = seed_lsb(seeds[index]);
-
-    hashinput[0] = index;
-    hashinput[1] = seeds[index];
-    hashinput[2] = 0;
-    hashinput[3] = 0;
-
-    // step 1: H(seeds[size]||X[l])
-    mmoHash2to4(mmo_hash1, (uint8_t *)&hashinput[0], (uint8_t *)&tpi[0]);
-
-    // step 2: pi^correct(tpi, cs, bit)
-    hashinput[0] = pi[0] ^ correct(tpi[0], cs[0], bit);
-    hashinput[1] = pi[1] ^ correct(tpi[1], cs[1], bit);
-    hashinput[2] = pi[2] ^ correct(tpi[2], cs[2], bit);
-    hashinput[3] = pi[3] ^ correct(tpi[3], cs[3], bit);
-
-    // step 3: comptue pi^H'(pi^tpi)
-    mmoHash4to4(mmo_hash2, (uint8_t *)&hashinput[0], (uint8_t *)&cpi[0]);
-
-    pi[0] ^= cpi[0];
-    pi[1] ^= cpi[1];
-    pi[2] ^= cpi[2];
-    pi[3] ^= cpi[3];
-    // *********************************
-    // END: DPF verification code
-    // *********************************
+    uint8_t *chunkOut =
+        stream ? blockBuf + offset * dataSize : out + c * dataSize;
+    leafConvert(ctx, flags, leafSeeds, m, dataSize, chunkOut);
+    mmoHash2to4Batch(mmo_hash1, (uint8_t *)inputBatch, m,
+                     (uint8_t *)tpiBatch);
+
+    for (int l = 0; l < m; l++) {
+      xorIfSet(&chunkOut[l * dataSize], &k[18 * size + 18], dataSize,
+               leafBits[l]);
+
+      // *********************************
+      // START: DPF verification code
+      // *********************************
+      int bit = seed_lsb(leafSeeds[l]);
+      uint128_t *tpi = &tpiBatch[4 * l];
+
+      // step 2: pi^correct(tpi, cs, bit)
+      hashinput[0] = pi[0] ^ correct(tpi[0], cs[0], bit);
+      hashinput[1] = pi[1] ^ correct(tpi[1], cs[1], bit);
+      hashinput[2] = pi[2] ^ correct(tpi[2], cs[2], bit);
+      hashinput[3] = pi[3] ^ correct(tpi[3], cs[3], bit);
+
+      // step 3: comptue pi^H'(pi^tpi)
+      mmoHash4to4(mmo_hash2, (uint8_t *)&hashinput[0], (uint8_t *)&cpi[0]);
+
+      pi[0] ^= cpi[0];
+      pi[1] ^= cpi[1];
+      pi[2] ^= cpi[2];
+      pi[3] ^= cpi[3];
+      // *********************************
+      // END: DPF verification code
+      // *********************************
+    }
+    if (stream && offset + m == blockLeaves)
+      chunkStreamPush(stream, blockBuf, blockLeaves);
   }
 
   // VDPF output hash
   uint8_t hash[32];
-  sha_256_init(&sha_256, hash);
-  sha_256_write(&sha_256, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
-  sha_256_close(&sha_256);
+  calc_sha_256(hash, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
   memcpy(proof, hash, sizeof(uint8_t) * 32);
 
-  free(bits);
-  free(seeds);
+  free(buf0);
+  free(buf1);
+  free(blockBuf);
+}
+
+void fullDomainVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                    struct Hash *mmo_hash2, int dataSize, unsigned char *k,
+                    uint8_t *out, uint8_t *proof) {
+  if (!checkVerifiableKey(ctx, k[CWSIZE - 1], out, (1ULL << k[0]) * dataSize,
+                          proof))
+    return;
+  fullDomainVDPFRun(ctx, mmo_hash1, mmo_hash2, dataSize, k, out, NULL, proof);
+}
+
+void fullDomainVDPFStream(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
+                          struct Hash *mmo_hash2, int dataSize,
+                          unsigned char *k, uint64_t chunkSize,
+                          DPFChunkFn visit, void *user, uint8_t *proof) {
+  if (!checkVerifiableKey(ctx, k[CWSIZE - 1], NULL, 0, proof))
+    return;
+  struct DPFChunkStream stream;
+  if (!chunkStreamInit(&stream, dataSize, chunkSize, visit, user))
+    return;
+  fullDomainVDPFRun(ctx, mmo_hash1, mmo_hash2, dataSize, k, NULL, &stream,
+                    proof);
+  chunkStreamFinish(&stream);
 }
 
 void evalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
@@ -437,7 +547,10 @@ void evalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
   uint128_t pi[4];
 
   memcpy(&seeds[0], &k[1], 16);
-  bits[0] = k[CWSIZE - 1];
+  bits[0] = k[CWSIZE - 1] & KEY_CONTROL_BIT;
+  uint8_t flags = k[CWSIZE - 1] & ~KEY_CONTROL_BIT;
+  if (!checkVerifiableKey(ctx, flags, out, dataSize, proof))
+    return;
 
   for (int i = 1; i <= size; i++) {
     memcpy(&sCW[i - 1], &k[18 * i], 16);
@@ -458,17 +571,16 @@ void evalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
   for (int i = 1; i <= size; i++) {
     dpfPRG(ctx, seeds[i - 1], &sL, &sR, &tL, &tR);
 
-    if (bits[i - 1] == 1) {
-      sL = sL ^ sCW[i - 1];
-      sR = sR ^ sCW[i - 1];
-      tL = tL ^ tCW0[i - 1];
-      tR = tR ^ tCW1[i - 1];
-    }
+    uint128_t mask = bitMask(bits[i - 1]);
+    sL = sL ^ (sCW[i - 1] & mask);
+    sR = sR ^ (sCW[i - 1] & mask);
+    tL = tL ^ (tCW0[i - 1] & -bits[i - 1]);
+    tR = tR ^ (tCW1[i - 1] & -bits[i - 1]);
 
     int xbit = getbit(index, size, i);
 
-    seeds[i] = (1 - xbit) * sL + xbit * sR;
-    bits[i] = (1 - xbit) * tL + xbit * tR;
+    seeds[i] = selectBlock(xbit, sL, sR);
+    bits[i] = selectBit(xbit, tL, tR);
   }
 
   // *********************************
@@ -500,30 +612,13 @@ void evalVDPF(EVP_CIPHER_CTX *ctx, struct Hash *mmo_hash1,
   // *********************************
 
   // Generate dataShare using PRG with the final seed
-  int len = 0;
-  uint8_t *zeros = (uint8_t *)malloc(dataSize + 16);
-  memset(zeros, 0, dataSize + 16);
-
-  EVP_CIPHER_CTX *seedCtx;
-  if (!(seedCtx = EVP_CIPHER_CTX_new()))
-    printf("errors occurred in creating context\n");
-  if (1 != EVP_EncryptInit_ex(seedCtx, EVP_aes_128_ctr(), NULL,
-                              (uint8_t *)&seeds[size], NULL))
-    printf("errors occurred in init of dpf eval\n");
-  if (1 != EVP_EncryptUpdate(seedCtx, out, &len, zeros, dataSize))
-    printf("errors occurred in encrypt\n");
+  leafConvert(ctx, flags, &seeds[size], 1, dataSize, out);
 
   // If bits[size] == 1, xor in the correction word (lastCW) from the key
-  if (bits[size] == 1) {
-    for (int i = 0; i < dataSize; i++) {
-      out[i] ^= k[18 * size + 18 + i];
-    }
-  }
+  xorIfSet(out, &k[18 * size + 18], dataSize, bits[size]);
 
   // VDPF output hash (just SHA256 of pi)
   uint8_t hash[32];
-  sha_256_init(&sha_256, hash);
-  sha_256_write(&sha_256, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
-  sha_256_close(&sha_256);
+  calc_sha_256(hash, (uint8_t *)&pi[0], sizeof(uint128_t) * 4);
   memcpy(proof, hash, sizeof(uint8_t) * 32);
 }
@@ -11,6 +11,7 @@ type DPFKey struct {
 	Bytes     []byte
 	DataSize  uint
 	RangeSize uint
+	Arity     uint // 2, 4 or 8 (GenKaryDPFKeys)
 }
 
 type DMPFKey struct {
@@ -110,6 +111,10 @@ func (dpf *Dpf) RequiredKeySize(dataSize uint, rangeSize uint) uint {
 	return (18 * rangeSize) + 18 + dataSize
 }
 
+func (dpf *Dpf) RequiredHalfTreeKeySize(dataSize uint, rangeSize uint) uint {
+	return 18 + 16*rangeSize + dataSize
+}
+
 func (dpf *Dpf) Free() {
 	DestroyDPFContext(dpf.ctx)
 }
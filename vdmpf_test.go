@@ -116,6 +116,114 @@ func TestCorrectPointFunctionTwoServerFullDomain(t *testing.T) {
 	}
 }
 
+func TestCorrectHalfTreePointFunctionFullDomain(t *testing.T) {
+
+	for trial := 0; trial < numTrials; trial++ {
+		num := 1 << 6
+		specialIndex := uint64(rand.Intn(num))
+		data := make([]byte, 10)
+		for i := range data {
+			data[i] = byte(rand.Intn(256))
+		}
+
+		prfKey := GeneratePRFKey()
+
+		client := DPFInitialize(prfKey)
+		keyA, keyB := client.GenHalfTreeDPFKeys(specialIndex, 6, 10, data)
+
+		server := DPFInitialize(client.PrfKey)
+		ans0 := server.FullDomainHalfTreeEval(keyA)
+		ans1 := server.FullDomainHalfTreeEval(keyB)
+
+		for testIndex := uint64(0); testIndex < uint64(num); testIndex++ {
+			point0 := server.EvalHalfTreeDPF(keyA, testIndex)
+			point1 := server.EvalHalfTreeDPF(keyB, testIndex)
+			for i := 0; i < 10; i++ {
+				expected := byte(0)
+				if testIndex == specialIndex {
+					expected = data[i]
+				}
+				ans := ans0[int(testIndex)*10+i] ^ ans1[int(testIndex)*10+i]
+				if ans != expected || point0[i]^point1[i] != expected {
+					t.Fatalf("Trial %v: At index %v, position %v: Expected: %v Got: %v",
+						trial, testIndex, i, expected, ans)
+				}
+			}
+		}
+	}
+}
+
+func TestCorrectPackedLeavesFullDomain(t *testing.T) {
+
+	for trial := 0; trial < numTrials; trial++ {
+		num := 1 << 6
+		specialIndex := uint64(rand.Intn(num))
+		data := []byte{byte(rand.Intn(256)), byte(rand.Intn(256))}
+
+		prfKey := GeneratePRFKey()
+		client := DPFInitialize(prfKey)
+		SetPackedLeaves(client.ctx, true)
+		keyA, keyB := client.GenDPFKeys(specialIndex, 6, 2, data)
+
+		server := DPFInitialize(client.PrfKey)
+		ans0 := server.FullDomainEval(keyA)
+		ans1 := server.FullDomainEval(keyB)
+
+		for testIndex := 0; testIndex < num; testIndex++ {
+			for i := 0; i < 2; i++ {
+				expected := byte(0)
+				if uint64(testIndex) == specialIndex {
+					expected = data[i]
+				}
+				ans := ans0[testIndex*2+i] ^ ans1[testIndex*2+i]
+				if ans != expected {
+					t.Fatalf("Trial %v: At index %v, position %v: Expected: %v Got: %v",
+						trial, testIndex, i, expected, ans)
+				}
+			}
+		}
+	}
+}
+
+func TestCorrectChaChaPointFunctionFullDomain(t *testing.T) {
+
+	for _, backend := range []int{PRGChaCha8, PRGChaCha12} {
+		for trial := 0; trial < numTrials; trial++ {
+			num := 1 << 6
+			specialIndex := uint64(rand.Intn(num))
+			data := make([]byte, 20)
+			for i := range data {
+				data[i] = byte(rand.Intn(256))
+			}
+
+			prfKey := GeneratePRFKey()
+			client := DPFInitialize(prfKey)
+			SetPRGBackend(client.ctx, backend)
+			keyA, keyB := client.GenDPFKeys(specialIndex, 6, 20, data)
+
+			server := DPFInitialize(client.PrfKey)
+			SetPRGBackend(server.ctx, backend)
+			ans0 := server.FullDomainEval(keyA)
+			ans1 := server.FullDomainEval(keyB)
+
+			for testIndex := 0; testIndex < num; testIndex++ {
+				share0 := server.EvalDPF(keyA, uint64(testIndex))
+				for i := 0; i < 20; i++ {
+					expected := byte(0)
+					if uint64(testIndex) == specialIndex {
+						expected = data[i]
+					}
+					ans := ans0[testIndex*20+i] ^ ans1[testIndex*20+i]
+					if ans != expected || share0[i] != ans0[testIndex*20+i] {
+						t.Fatalf("Backend %v trial %v: At index %v, position %v: Expected: %v Got: %v",
+							backend, trial, testIndex, i, expected, ans)
+					}
+				}
+			}
+		}
+	}
+}
+
 func TestCorrectVerifiablePointFunctionTwoServer(t *testing.T) {
 
 	for trial := 0; trial < numTrials; trial++ {
@@ -191,9 +299,8 @@ func TestCorrectVerifiablePointFunctionFullDomain(t *testing.T) {
 		// fmt.Printf("keyA = %v\n", keyA)
 		// fmt.Printf("keyB = %v\n", keyB)
 
-		// simulate the server
-		hashkeys := GenerateVDPFHashKeys()
-		server := VDPFInitialize(prfKey, hashkeys)
+		// simulate the server, with the hash keys the keys were generated under
+		server := VDPFInitialize(prfKey, hashKeys)
 
 		ans0, pi0 := server.FullDomainVerEval(keyA)
 		ans1, pi1 := server.FullDomainVerEval(keyB)
@@ -221,6 +328,51 @@ func TestCorrectVerifiablePointFunctionFullDomain(t *testing.T) {
 	}
 }
 
+func TestConcurrentVerifiablePointFunctionFullDomain(t *testing.T) {
+
+	rangeSize := 6
+	specialIndex := uint64(rand.Intn(1 << rangeSize))
+
+	hashKeys := GenerateVDPFHashKeys()
+	prfKey := GeneratePRFKey()
+	client := VDPFInitialize(prfKey, hashKeys)
+
+	data := make([]byte, 10)
+	for i := range data {
+		data[i] = byte(rand.Intn(256))
+	}
+	keyA, keyB := client.GenVDPFKeys(specialIndex, uint(rangeSize), uint(10), data)
+
+	// proofs computed on many goroutines at once must all agree
+	const workers = 8
+	proofs := make([][]byte, 2*workers)
+	done := make(chan bool)
+	for w := 0; w < workers; w++ {
+		go func(w int) {
+			server := VDPFInitialize(prfKey, hashKeys)
+			for trial := 0; trial < numTrials; trial++ {
+				_, pi0 := server.FullDomainVerEval(keyA)
+				_, pi1 := server.FullDomainVerEval(keyB)
+				if trial == 0 {
+					proofs[2*w], proofs[2*w+1] = pi0, pi1
+				} else if !bytes.Equal(pi0, proofs[2*w]) || !bytes.Equal(pi1, proofs[2*w+1]) {
+					proofs[2*w] = nil
+				}
+			}
+			done <- true
+		}(w)
+	}
+	for w := 0; w < workers; w++ {
+		<-done
+	}
+
+	for i := range proofs {
+		if !bytes.Equal(proofs[i], proofs[0]) {
+			t.Fatalf("proof %v =/= proof 0\n%v\n%v\n", i, proofs[i], proofs[0])
+		}
+	}
+}
+
 func TestCorrectMultiPointFunctionTwoServer(t *testing.T) {
 
 	for trial := 0; trial < numTrials; trial++ {
@@ -344,6 +496,152 @@ func TestCorrectMultiPointFunctionTwoServerFullDomain(t *testing.T) {
 	}
 }
 
+func TestParallelMultiPointFunctionFullDomain(t *testing.T) {
+
+	num := 1 << 14
+	specialIndexes := []uint64{3, 1000, 9999}
+	data := []byte{1, 2, 3, 4, 5, 6}
+	prfKey := GeneratePRFKey()
+	client := DMPFInitialize(prfKey)
+	keyA, keyB := client.GenDMPFKeys(specialIndexes, 14, 3, 2, data)
+
+	serial := DMPFInitialize(prfKey)
+	parallel := DMPFInitialize(prfKey)
+	SetFullDomainThreads(parallel.ctx, 4)
+	ans0 := parallel.FullDomainEval(keyA)
+	ans1 := parallel.FullDomainEval(keyB)
+	if !bytes.Equal(ans0, serial.FullDomainEval(keyA)) {
+		t.Fatalf("Parallel full domain differs from the serial one")
+	}
+	for i := 0; i < num; i++ {
+		expected := []byte{0, 0}
+		if j := slices.Index(specialIndexes, uint64(i)); j >= 0 {
+			expected = data[2*j : 2*j+2]
+		}
+		if ans0[2*i]^ans1[2*i] != expected[0] || ans0[2*i+1]^ans1[2*i+1] != expected[1] {
+			t.Fatalf("At index %v: Expected: %v", i, expected)
+		}
+	}
+}
+
+func TestMultiPointFunctionRangeEval(t *testing.T) {
+
+	specialIndexes := []uint64{3, 1000, 9999}
+	data := []byte{1, 2, 3, 4, 5, 6}
+	prfKey := GeneratePRFKey()
+	client := DMPFInitialize(prfKey)
+	keyA, _ := client.GenDMPFKeys(specialIndexes, 14, 3, 2, data)
+
+	server := DMPFInitialize(prfKey)
+	full := server.FullDomainEval(keyA)
+	for _, r := range [][2]uint64{{0, 1 << 14}, {999, 1001}, {4096, 8192}, {9000, 16383}} {
+		if !bytes.Equal(server.RangeEval(keyA, r[0], r[1]), full[2*r[0]:2*r[1]]) {
+			t.Fatalf("Range %v differs from the full domain", r)
+		}
+	}
+}
+
+func TestKaryPointFunctionRangeEval(t *testing.T) {
+
+	const rangeSize = 13
+	specialIndex := uint64(5000)
+	data := []byte{7, 9}
+	prfKey := GeneratePRFKey()
+	client := DPFInitialize(prfKey)
+	server := DPFInitialize(prfKey)
+
+	for _, arity := range []uint{4, 8} {
+		keyA, keyB := client.GenKaryDPFKeys(specialIndex, arity, rangeSize, 2, data)
+		fullA, fullB := server.FullDomainEval(keyA), server.FullDomainEval(keyB)
+		for i := uint64(0); i < 1<<rangeSize; i++ {
+			expected := []byte{0, 0}
+			if i == specialIndex {
+				expected = data
+			}
+			if fullA[2*i]^fullB[2*i] != expected[0] || fullA[2*i+1]^fullB[2*i+1] != expected[1] {
+				t.Fatalf("Arity %v at index %v: Expected: %v", arity, i, expected)
+			}
+		}
+		for _, r := range [][2]uint64{{0, 1 << rangeSize}, {4999, 5001}, {4096, 6000}, {8000, 8191}} {
+			if !bytes.Equal(server.RangeEval(keyA, r[0], r[1]), fullA[2*r[0]:2*r[1]]) {
+				t.Fatalf("Arity %v: range %v differs from the full domain", arity, r)
+			}
+		}
+	}
+}
+
+func TestPointFunctionFullDomainMulti(t *testing.T) {
+
+	const rangeSize, numKeys = 12, 20
+	data := []byte{5, 6, 7}
+	prfKey := GeneratePRFKey()
+	client := DPFInitialize(prfKey)
+	server := DPFInitialize(prfKey)
+
+	keys := make([]*DPFKey, numKeys)
+	for i := range keys {
+		keys[i], _ = client.GenDPFKeys(uint64(i*397)%(1<<rangeSize), rangeSize, 3, data)
+	}
+	outs := server.FullDomainEvalMulti(keys)
+	for i, key := range keys {
+		if !bytes.Equal(outs[i], server.FullDomainEval(key)) {
+			t.Fatalf("Key %v: lockstep output differs from FullDomainEval", i)
+		}
+	}
+}
+
+func TestMultiPointFunctionTruncatedDomain(t *testing.T) {
+
+	specialIndexes := []uint64{3, 1000, 9999}
+	data := []byte{1, 2, 3, 4, 5, 6}
+	prfKey := GeneratePRFKey()
+	client := DMPFInitialize(prfKey)
+	keyA, _ := client.GenDMPFKeys(specialIndexes, 14, 3, 2, data)
+
+	server := DMPFInitialize(prfKey)
+	full := server.FullDomainEval(keyA)
+	for _, n := range []uint64{1, 1000, 8193, 1 << 14} {
+		if !bytes.Equal(server.TruncatedDomainEval(keyA, n), full[:2*n]) {
+			t.Fatalf("Truncated domain %v differs from the full domain", n)
+		}
+	}
+}
+
+func TestLargeDomainRangeEval(t *testing.T) {
+
+	const rangeSize = 40
+	top := uint64(1) << rangeSize
+	specialIndexes := []uint64{12345, top - 100}
+	data := []byte{1, 2, 3, 4}
+	prfKey := GeneratePRFKey()
+
+	dpfClient := DPFInitialize(prfKey)
+	dpfA, dpfB := dpfClient.GenDPFKeys(top-100, rangeSize, 2, data[2:])
+	dmpfClient := DMPFInitialize(prfKey)
+	dmpfA, dmpfB := dmpfClient.GenDMPFKeys(specialIndexes, rangeSize, 2, 2, data)
+
+	dpfServer := DPFInitialize(prfKey)
+	dmpfServer := DMPFInitialize(prfKey)
+	lo := top - 1000
+	dpf0, dpf1 := dpfServer.RangeEval(dpfA, lo, top), dpfServer.RangeEval(dpfB, lo, top)
+	dmpf0, dmpf1 := dmpfServer.RangeEval(dmpfA, lo, top), dmpfServer.RangeEval(dmpfB, lo, top)
+	for i := uint64(0); i < top-lo; i++ {
+		expected := []byte{0, 0}
+		if lo+i == top-100 {
+			expected = data[2:]
+		}
+		if !bytes.Equal(dpf0[2*i:2*i+2], dpfServer.EvalDPF(dpfA, lo+i)) ||
+			!bytes.Equal(dmpf0[2*i:2*i+2], dmpfServer.EvalDMPF(dmpfA, lo+i)) {
+			t.Fatalf("At index %v: range differs from point evaluation", lo+i)
+		}
+		for j := uint64(0); j < 2; j++ {
+			if dpf0[2*i+j]^dpf1[2*i+j] != expected[j] || dmpf0[2*i+j]^dmpf1[2*i+j] != expected[j] {
+				t.Fatalf("At index %v: Expected: %v", lo+i, expected)
+			}
+		}
+	}
+}
+
 func TestCorrectVerMultiPointFunctionTwoServer(t *testing.T) {
 
 	for trial := 0; trial < numTrials; trial++ {
@@ -616,6 +914,39 @@ func BenchmarkDPFFullDomain(b *testing.B) {
 	}
 }
 
+func BenchmarkDPFFullDomainMulti(b *testing.B) {
+	// keys/sec of one FullDomainEval per key against lockstep evaluation
+	const rangeSize, dataSize = 16, 16
+	for _, numKeys := range []int{4, 8, 16} {
+		prfKey := GeneratePRFKey()
+		client := DPFInitialize(prfKey)
+		server := DPFInitialize(prfKey)
+		// fixed-key leaves, so the tree expansion is not hidden behind a key
+		// schedule per leaf
+		SetFixedKeyLeaf(client.ctx, true)
+
+		data := make([]byte, dataSize)
+		rand.Read(data)
+		keys := make([]*DPFKey, numKeys)
+		for i := range keys {
+			keys[i], _ = client.GenDPFKeys(uint64(rand.Intn(1<<rangeSize)), rangeSize, dataSize, data)
+		}
+
+		start := time.Now()
+		for _, key := range keys {
+			server.FullDomainEval(key)
+		}
+		single := time.Since(start)
+
+		start = time.Now()
+		server.FullDomainEvalMulti(keys)
+		lockstep := time.Since(start)
+
+		fmt.Printf("DPF FullDomain %d keys: one by one %.0f keys/s, lockstep %.0f keys/s\n",
+			numKeys, float64(numKeys)/single.Seconds(), float64(numKeys)/lockstep.Seconds())
+	}
+}
+
 func BenchmarkVDPFVerification(b *testing.B) {
 	// different dataSize
 	dataSizes := []int{10, 100, 1000, 10000, 100000}
@@ -1,14 +1,32 @@
 package vdmpf
 
 // #cgo CFLAGS: -I${SRCDIR}/include
-// #cgo LDFLAGS: -L${SRCDIR} -ldpf -lcrypto -lssl -lm -lstdc++
+// #cgo LDFLAGS: -L${SRCDIR} -ldpf -lcrypto -lssl -lm -lstdc++ -lpthread
 // #include "dpf.h"
 // #include "mmo.h"
 // #include "vdpf.h"
 // #include "dmpf.h"
 // #include "vdmpf.h"
+// #include <stdlib.h>
+//
+// // fullDomainDPFMulti over keys and outputs laid out back to back, since Go
+// // cannot hand C an array of pointers into Go memory
+// static void fullDomainDPFMultiFlat(EVP_CIPHER_CTX *ctx, int size,
+//                                    uint8_t *keys, int keySize, int numKeys,
+//                                    int dataSize, uint8_t *outs) {
+//   uint8_t **k = malloc(sizeof(uint8_t *) * numKeys);
+//   uint8_t **o = malloc(sizeof(uint8_t *) * numKeys);
+//   for (int i = 0; i < numKeys; i++) {
+//     k[i] = keys + (size_t)i * keySize;
+//     o[i] = outs + ((size_t)dataSize << size) * i;
+//   }
+//   fullDomainDPFMulti(ctx, size, k, numKeys, dataSize, o);
+//   free(k);
+//   free(o);
+// }
 import "C"
 import (
+	"math"
 	"unsafe"
 )
 
@@ -18,8 +36,20 @@ var HASH2BLOCKOUT uint = 2 // Matches test.c mmo_hash2 outblocks=2
 type PrfCtx *C.struct_evp_cipher_ctx_st
 type Hash *C.struct_Hash
 
+// outputBytes returns the size of the output for points shares of dataSize
+// bytes. The evaluators themselves only hold one block of leaves, so this
+// buffer is the limit: domains whose output does not fit in memory have to be
+// evaluated a range at a time (RangeEval, on binary and k-ary keys) or with
+// the C *Stream evaluators.
+func outputBytes(points uint64, dataSize uint) int {
+	if points == 0 || points > uint64(math.MaxInt)/uint64(dataSize) {
+		panic("domain is too big for one output buffer, evaluate it in ranges")
+	}
+	return int(points) * int(dataSize)
+}
+
 func NewDPFKey(bytes []byte, dataSize uint, rangeSize uint) *DPFKey {
-	return &DPFKey{bytes, dataSize, rangeSize}
+	return &DPFKey{bytes, dataSize, rangeSize, 2}
 }
 
 func NewDMPFKey(bytes []byte, dataSize uint, rangeSize uint, rangePoint uint) *DMPFKey {
@@ -51,6 +81,50 @@ func InitDMPFContext(prfKey []byte) PrfCtx {
 	return p
 }
 
+func setKeyFlag(ctx PrfCtx, flag C.uint8_t, enabled bool) {
+	flags := C.getKeyFlags(ctx)
+	if enabled {
+		flags |= flag
+	} else {
+		flags &^= flag
+	}
+	C.setKeyFlags(ctx, flags)
+}
+
+// SetFixedKeyLeaf makes keys generated with ctx use fixed-key leaf
+// conversion. Evaluation follows the mode recorded in each key.
+func SetFixedKeyLeaf(ctx PrfCtx, enabled bool) {
+	setKeyFlag(ctx, C.KEY_FLAG_FIXED_KEY_LEAF, enabled)
+}
+
+// SetPackedLeaves makes DPF and DMPF keys generated with ctx stop the tree
+// early for payloads of at most 8 bytes, packing adjacent outputs into one
+// leaf. Packed keys are never larger than the regular ones.
+func SetPackedLeaves(ctx PrfCtx, enabled bool) {
+	setKeyFlag(ctx, C.KEY_FLAG_PACKED_LEAVES, enabled)
+}
+
+// PRG backends for SetPRGBackend
+const (
+	PRGAES      = C.KEY_PRG_AES
+	PRGChaCha8  = C.KEY_PRG_CHACHA8
+	PRGChaCha12 = C.KEY_PRG_CHACHA12
+)
+
+// SetPRGBackend selects the PRG (AES, ChaCha8 or ChaCha12) that ctx expands
+// trees and leaves with. Keys record their backend and must be evaluated
+// with a context set to the same one. Compressed DMPF keys are AES-only.
+func SetPRGBackend(ctx PrfCtx, backend int) {
+	C.setPRGBackend(ctx, C.int(backend))
+}
+
+// SetFullDomainThreads makes the full-domain evaluations and decompressions
+// run with ctx split the tree across threads workers. Results do not depend
+// on the thread count.
+func SetFullDomainThreads(ctx PrfCtx, threads int) {
+	C.setFullDomainThreads(ctx, C.int(threads))
+}
+
 func InitMMOHash(key HashKey, outBlocks uint) Hash {
 
 	h := C.initMMOHash((*C.uint8_t)(unsafe.Pointer(&key[0])), C.uint64_t(outBlocks))
@@ -90,6 +164,72 @@ func (dpf *Dpf) GenDPFKeys(specialIndex uint64, rangeSize uint, dataSize uint, d
 	return NewDPFKey(k0, dataSize, rangeSize), NewDPFKey(k1, dataSize, rangeSize)
 }
 
+// GenKaryDPFKeys generates keys of a 4- or 8-ary tree (arity 2 is GenDPFKeys),
+// which EvalDPF, FullDomainEval and RangeEval accept like binary keys
+func (dpf *Dpf) GenKaryDPFKeys(specialIndex uint64, arity uint, rangeSize uint, dataSize uint, data []byte) (*DPFKey, *DPFKey) {
+	if len(data) != int(dataSize) {
+		panic("invalid data size")
+	}
+	if arity != 2 && arity != 4 && arity != 8 {
+		panic("invalid arity")
+	}
+	keySize := dpf.RequiredKaryKeySize(arity, dataSize, rangeSize)
+	k0 := make([]byte, keySize)
+	k1 := make([]byte, keySize)
+
+	C.genKaryDPF(
+		dpf.ctx,
+		C.int(arity),
+		C.int(rangeSize),
+		C.uint64_t(specialIndex),
+		C.int(dataSize),
+		(*C.uint8_t)(unsafe.Pointer(&data[0])),
+		(*C.uint8_t)(unsafe.Pointer(&k0[0])),
+		(*C.uint8_t)(unsafe.Pointer(&k1[0])),
+	)
+
+	key0, key1 := NewDPFKey(k0, dataSize, rangeSize), NewDPFKey(k1, dataSize, rangeSize)
+	key0.Arity, key1.Arity = arity, arity
+	return key0, key1
+}
+
+func (dpf *Dpf) RequiredKaryKeySize(arity uint, dataSize uint, rangeSize uint) uint {
+	return uint(C.karyDPFKeySize(C.int(arity), C.int(rangeSize), C.int(dataSize)))
+}
+
+// checkKeySize panics unless key has the size of a key of its arity (binary
+// if unset)
+func (dpf *Dpf) checkKeySize(key *DPFKey) {
+	arity := key.Arity
+	if arity == 0 {
+		arity = 2
+	}
+	if len(key.Bytes) != int(dpf.RequiredKaryKeySize(arity, key.DataSize, key.RangeSize)) {
+		panic("invalid key size")
+	}
+}
+
+func (dpf *Dpf) GenHalfTreeDPFKeys(specialIndex uint64, rangeSize uint, dataSize uint, data []byte) (*DPFKey, *DPFKey) {
+	if len(data) != int(dataSize) {
+		panic("invalid data size")
+	}
+	keySize := dpf.RequiredHalfTreeKeySize(dataSize, rangeSize)
+	k0 := make([]byte, keySize)
+	k1 := make([]byte, keySize)
+
+	C.genHalfTreeDPF(
+		dpf.ctx,
+		C.int(rangeSize),
+		C.uint64_t(specialIndex),
+		C.int(dataSize),
+		(*C.uint8_t)(unsafe.Pointer(&data[0])),
+		(*C.uint8_t)(unsafe.Pointer(&k0[0])),
+		(*C.uint8_t)(unsafe.Pointer(&k1[0])),
+	)
+
+	return NewDPFKey(k0, dataSize, rangeSize), NewDPFKey(k1, dataSize, rangeSize)
+}
+
 func (vdpf *Vdpf) GenVDPFKeys(specialIndex uint64, rangeSize uint, dataSize uint, data []byte) (*DPFKey, *DPFKey) {
 	if len(data) != int(dataSize) {
 		panic("invalid data size")
@@ -115,14 +255,30 @@ func (vdpf *Vdpf) GenVDPFKeys(specialIndex uint64, rangeSize uint, dataSize uint
 
 func (dpf *Dpf) EvalDPF(key *DPFKey, index uint64) []byte {
 
-	keySize := dpf.RequiredKeySize(key.DataSize, key.RangeSize)
+	dpf.checkKeySize(key)
+
+	res := make([]byte, key.DataSize)
+
+	C.evalDPF(
+		dpf.ctx,
+		(*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])),
+		C.uint64_t(index),
+		C.int(key.DataSize),
+		(*C.uint8_t)(unsafe.Pointer(&res[0])),
+	)
+
+	return res
+}
+
+func (dpf *Dpf) EvalHalfTreeDPF(key *DPFKey, index uint64) []byte {
+	keySize := dpf.RequiredHalfTreeKeySize(key.DataSize, key.RangeSize)
 	if len(key.Bytes) != int(keySize) {
 		panic("invalid key size")
 	}
 
 	res := make([]byte, key.DataSize)
 
-	C.evalDPF(
+	C.evalHalfTreeDPF(
 		dpf.ctx,
 		(*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])),
 		C.uint64_t(index),
@@ -191,47 +347,113 @@ func (vdpf *Vdpf) BatchVerEval(key *DPFKey, indices []uint64) ([]byte, []byte) {
 
 func (dpf *Dpf) FullDomainEval(key *DPFKey) []byte {
 
-	if key.RangeSize > 32 {
-		panic("range size is too big for full domain evaluation")
+	dpf.checkKeySize(key)
+
+	// extern void batchEvalDPF(EVP_CIPHER_CTX *ctx, int size, bool b, unsigned char* k, uint64_t *in, size_t inl, uint64_t* out);
+
+	res := make([]byte, outputBytes(1<<key.RangeSize, key.DataSize))
+
+	C.fullDomainDPF(
+		dpf.ctx,
+		C.int(key.RangeSize),
+		(*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])),
+		C.int(key.DataSize),
+		(*C.uint8_t)(unsafe.Pointer(&res[0])),
+	)
+
+	return res
+
+}
+
+// FullDomainEvalMulti evaluates binary keys of the same domain and data size
+// in lockstep (fullDomainDPFMulti), returning the full domain of each key
+func (dpf *Dpf) FullDomainEvalMulti(keys []*DPFKey) [][]byte {
+	if len(keys) == 0 {
+		return nil
+	}
+	first := keys[0]
+	keySize := len(first.Bytes)
+	for _, key := range keys {
+		if key.RangeSize != first.RangeSize || key.DataSize != first.DataSize ||
+			(key.Arity != 0 && key.Arity != 2) {
+			panic("keys of different shapes")
+		}
+		dpf.checkKeySize(key)
+	}
+
+	outBytes := outputBytes(1<<first.RangeSize, first.DataSize)
+	flatKeys := make([]byte, 0, keySize*len(keys))
+	for _, key := range keys {
+		flatKeys = append(flatKeys, key.Bytes...)
 	}
+	res := make([]byte, outputBytes(uint64(len(keys))<<first.RangeSize, first.DataSize))
 
-	keySize := dpf.RequiredKeySize(key.DataSize, key.RangeSize)
+	C.fullDomainDPFMultiFlat(
+		dpf.ctx,
+		C.int(first.RangeSize),
+		(*C.uint8_t)(unsafe.Pointer(&flatKeys[0])),
+		C.int(keySize),
+		C.int(len(keys)),
+		C.int(first.DataSize),
+		(*C.uint8_t)(unsafe.Pointer(&res[0])),
+	)
 
-	if len(key.Bytes) != int(keySize) {
-		panic("invalid key size")
+	outs := make([][]byte, len(keys))
+	for i := range outs {
+		outs[i] = res[i*outBytes : (i+1)*outBytes : (i+1)*outBytes]
 	}
+	return outs
+}
 
-	// extern void batchEvalDPF(EVP_CIPHER_CTX *ctx, int size, bool b, unsigned char* k, uint64_t *in, size_t inl, uint64_t* out);
+// RangeEval evaluates the key on the points [lo, hi) only
+func (dpf *Dpf) RangeEval(key *DPFKey, lo uint64, hi uint64) []byte {
+	if key.RangeSize >= 64 || lo >= hi || hi > 1<<key.RangeSize {
+		panic("invalid range")
+	}
 
-	resSize := 1 << key.RangeSize
+	dpf.checkKeySize(key)
 
-	res := make([]byte, int(key.DataSize)*resSize)
+	res := make([]byte, outputBytes(hi-lo, key.DataSize))
 
-	C.fullDomainDPF(
+	C.evalRangeDPF(
 		dpf.ctx,
 		C.int(key.RangeSize),
 		(*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])),
 		C.int(key.DataSize),
+		C.uint64_t(lo),
+		C.uint64_t(hi),
 		(*C.uint8_t)(unsafe.Pointer(&res[0])),
 	)
 
 	return res
-
 }
 
-func (vdpf *Vdpf) FullDomainVerEval(key *DPFKey) ([]byte, []byte) {
-	if key.RangeSize > 32 {
-		panic("range size is too big for full domain evaluation")
+func (dpf *Dpf) FullDomainHalfTreeEval(key *DPFKey) []byte {
+	keySize := dpf.RequiredHalfTreeKeySize(key.DataSize, key.RangeSize)
+	if len(key.Bytes) != int(keySize) {
+		panic("invalid key size")
 	}
 
+	res := make([]byte, outputBytes(1<<key.RangeSize, key.DataSize))
+
+	C.fullDomainHalfTreeDPF(
+		dpf.ctx,
+		(*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])),
+		C.int(key.DataSize),
+		(*C.uint8_t)(unsafe.Pointer(&res[0])),
+	)
+
+	return res
+}
+
+func (vdpf *Vdpf) FullDomainVerEval(key *DPFKey) ([]byte, []byte) {
 	keySize := vdpf.RequiredKeySize(key.DataSize, key.RangeSize)
 	if len(key.Bytes) != int(keySize) {
 		panic("invalid key size")
 	}
 
-	resSize := 1 << key.RangeSize
 	pi := make([]byte, 16*HASH2BLOCKOUT)
-	res := make([]byte, int(key.DataSize)*resSize)
+	res := make([]byte, outputBytes(1<<key.RangeSize, key.DataSize))
 
 	// re-initialize hash instances
 	h1 := C.initMMOHash((*C.uint8_t)(unsafe.Pointer(&vdpf.H1Key)), C.uint64_t(HASH1BLOCKOUT))
@@ -295,8 +517,22 @@ func (dmpf *Dmpf) EvalDMPF(key *DMPFKey, index uint64) []byte {
 }
 
 func (dmpf *Dmpf) FullDomainEval(key *DMPFKey) []byte {
-	if key.RangeSize > 32 {
-		panic("range size is too big for full domain evaluation")
+	keySize := dmpf.RequiredKeySize(key.DataSize, key.RangeSize, key.RangePoint)
+	if len(key.Bytes) != int(keySize) {
+		panic("invalid key size")
+	}
+
+	res := make([]byte, outputBytes(1<<key.RangeSize, key.DataSize))
+
+	C.fullDomainDMPF(dmpf.ctx, (*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])), C.int(key.DataSize), (*C.uint8_t)(unsafe.Pointer(&res[0])))
+
+	return res
+}
+
+// TruncatedDomainEval evaluates the key on the first domainSize points only
+func (dmpf *Dmpf) TruncatedDomainEval(key *DMPFKey, domainSize uint64) []byte {
+	if key.RangeSize >= 64 || domainSize == 0 || domainSize > 1<<key.RangeSize {
+		panic("invalid domain size")
 	}
 
 	keySize := dmpf.RequiredKeySize(key.DataSize, key.RangeSize, key.RangePoint)
@@ -304,10 +540,27 @@ func (dmpf *Dmpf) FullDomainEval(key *DMPFKey) []byte {
 		panic("invalid key size")
 	}
 
-	resSize := 1 << key.RangeSize
-	res := make([]byte, int(key.DataSize)*resSize)
+	res := make([]byte, outputBytes(domainSize, key.DataSize))
 
-	C.fullDomainDMPF(dmpf.ctx, (*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])), C.int(key.DataSize), (*C.uint8_t)(unsafe.Pointer(&res[0])))
+	C.truncatedDomainDMPF(dmpf.ctx, (*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])), C.int(key.DataSize), C.uint64_t(domainSize), (*C.uint8_t)(unsafe.Pointer(&res[0])))
+
+	return res
+}
+
+// RangeEval evaluates the key on the points [lo, hi) only
+func (dmpf *Dmpf) RangeEval(key *DMPFKey, lo uint64, hi uint64) []byte {
+	if key.RangeSize >= 64 || lo >= hi || hi > 1<<key.RangeSize {
+		panic("invalid range")
+	}
+
+	keySize := dmpf.RequiredKeySize(key.DataSize, key.RangeSize, key.RangePoint)
+	if len(key.Bytes) != int(keySize) {
+		panic("invalid key size")
+	}
+
+	res := make([]byte, outputBytes(hi-lo, key.DataSize))
+
+	C.evalRangeDMPF(dmpf.ctx, (*C.uint8_t)(unsafe.Pointer(&key.Bytes[0])), C.int(key.DataSize), C.uint64_t(lo), C.uint64_t(hi), (*C.uint8_t)(unsafe.Pointer(&res[0])))
 
 	return res
 }
@@ -335,12 +588,7 @@ func (dmpf *Dmpf) CompressDMPF(specialIndexes []uint64, rangeSize uint, rangePoi
 }
 
 func (compressedKey *CompressedDMPFKey) Decompress(ctx PrfCtx) []byte {
-	if compressedKey.RangeSize > 32 {
-		panic("range size is too big for full domain evaluation")
-	}
-
-	resSize := 1 << compressedKey.RangeSize
-	res := make([]byte, int(compressedKey.DataSize)*resSize)
+	res := make([]byte, outputBytes(1<<compressedKey.RangeSize, compressedKey.DataSize))
 
 	C.decompressDMPF(
 		ctx,
@@ -414,17 +662,12 @@ func (vdmpf *Vdmpf) EvalVDMPF(key *DMPFKey, index uint64) ([]byte, []byte) {
 }
 
 func (vdmpf *Vdmpf) FullDomainVerEval(key *DMPFKey) ([]byte, []byte) {
-	if key.RangeSize > 32 {
-		panic("range size is too big for full domain evaluation")
-	}
-
 	keySize := vdmpf.RequiredKeySize(key.DataSize, key.RangeSize, key.RangePoint)
 	if len(key.Bytes) != int(keySize) {
 		panic("invalid key size")
 	}
 
-	resSize := 1 << key.RangeSize
-	res := make([]byte, int(key.DataSize)*resSize)
+	res := make([]byte, outputBytes(1<<key.RangeSize, key.DataSize))
 	pi := make([]byte, 16*HASH2BLOCKOUT)
 
 	// re-initialize hash instances